@@ -164,6 +164,11 @@ Returns true on success, false on failure
 */
 bool _FAT_directory_entryFromPosition (PARTITION* partition, DIR_ENTRY* entry);
 
+/*
+Forget every cached directory entry belonging to partition
+*/
+void _FAT_directory_invalidateCache (PARTITION* partition);
+
 /*
 Fill in a stat struct based on a file entry
 */
@@ -65,9 +65,19 @@ Initialise any inserted block-devices.
 Add the fat device driver to the devoptab, making it available for standard file functions.
 cacheSize: The number of pages to allocate for each inserted block-device
 setAsDefaultDevice: if true, make this the default device driver for file operations
+Each page holds one sector, and nothing is read ahead.
 */
 bool fatInit (u32 cacheSize, bool setAsDefaultDevice);
 
+/*
+As fatInit, also choosing the shape of the cache.
+cachePageSectors: The number of sectors in each page, or CACHE_PAGE_CLUSTER for
+ pages the size of a cluster
+cacheReadAhead: The number of extra pages to read at once when sectors are read
+ sequentially, 0 to disable read-ahead
+*/
+bool fatInitEx (u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead, bool setAsDefaultDevice);
+
 /*
 Calls fatInit with setAsDefaultDevice = true and cacheSize optimised for the host system.
 */
@@ -85,11 +95,21 @@ PD_CUSTOM is not allowed, use _FAT_partition_mountCustomDevice
 */
 bool fatMountNormalInterface (PARTITION_INTERFACE partitionNumber, u32 cacheSize);
 
+/*
+As fatMountNormalInterface, with the cache parameters of fatInitEx
+*/
+bool fatMountNormalInterfaceEx (PARTITION_INTERFACE partitionNumber, u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead);
+
 /*
 Mount a partition on a custom device
 */
 bool fatMountCustomInterface (struct IO_INTERFACE_STRUCT* device, u32 cacheSize);
 
+/*
+As fatMountCustomInterface, with the cache parameters of fatInitEx
+*/
+bool fatMountCustomInterfaceEx (struct IO_INTERFACE_STRUCT* device, u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead);
+
 /*
 Unmount the partition specified by partitionNumber
 If there are open files, it will fail
@@ -58,6 +58,13 @@ typedef struct {
 	s32 byte;
 } FILE_POSITION;
 
+// A run of clusters that follow each other both in the file and on disc
+typedef struct {
+	u32 cluster;	// First cluster of the run
+	u32 index;		// Position of that cluster in the file, counted in clusters
+	u32 length;		// Number of clusters in the run
+} FILE_EXTENT;
+
 typedef struct {
 	int	fd;
 	u32 filesize;
@@ -72,6 +79,12 @@ typedef struct {
 	PARTITION* partition;
 	DIR_ENTRY_POSITION dirEntryStart;		// Points to the start of the LFN entries of a file, or the alias for no LFN
 	DIR_ENTRY_POSITION dirEntryEnd;			// Always points to the file's alias entry
+	FILE_EXTENT* extents;	// The whole cluster chain, in order, NULL until it is needed
+	u32 extentCount;
+	u32 extentCapacity;
+	u32 extentCursor;		// Extent of the last cluster looked up
+	bool extentsFailed;		// Not enough memory for the extents, use the FAT directly
+	bool preallocated;		// Clusters may be linked past the end of the file
 } FILE_STRUCT;
 
 extern int _FAT_open_r (struct _reent *r, void *fileStruct, const char *path, int flags);
@@ -86,4 +99,12 @@ extern int _FAT_seek_r (struct _reent *r, int fd,int pos, int dir);
 
 extern int _FAT_fstat_r (struct _reent *r, int fd, struct stat *st);
 
+/*
+Reserve clusters so that the file can grow to size bytes without
+allocating any more, in as few runs of consecutive clusters as possible.
+The size of the file is unchanged. Clusters still unused when the file
+is closed are freed.
+*/
+extern int _FAT_fallocate_r (struct _reent *r, int fd, u32 size);
+
 #endif // _FATFILE_H
@@ -44,6 +44,8 @@
 #define CLUSTER_FREE	0x0000
 #define CLUSTER_FIRST	0x0002
 
+#define CLUSTER_COUNT_UNKNOWN	0xFFFFFFFF
+
 #define CLUSTERS_PER_FAT12 4085
 #define CLUSTERS_PER_FAT16 65525
 
@@ -55,8 +57,38 @@ u32 _FAT_fat_linkFreeClusterCleared (PARTITION* partition, u32 cluster);
 
 bool _FAT_fat_clearLinks (PARTITION* partition, u32 cluster);
 
+/*
+Make cluster the last one of its chain, freeing any clusters after it
+*/
+bool _FAT_fat_trimLinks (PARTITION* partition, u32 cluster);
+
+/*
+Find a run of free clusters at most maxLength long. The first run that is
+maxLength long, searching from hint, is taken. Failing that, the longest
+run is. Returns the first cluster of the run and its length in *length,
+or CLUSTER_FREE if there are no free clusters or they can't be tracked.
+*/
+u32 _FAT_fat_findFreeRun (PARTITION* partition, u32 hint, u32 maxLength, u32* length);
+
+/*
+Link length free clusters starting at first, one after the other, to the
+end of the chain ending at cluster, or into a new chain if cluster is CLUSTER_FREE
+*/
+bool _FAT_fat_linkClusterRun (PARTITION* partition, u32 cluster, u32 first, u32 length);
+
 u32 _FAT_fat_lastCluster (PARTITION* partition, u32 cluster);
 
+/*
+Number of free clusters on the partition, counted once from the FAT if needed
+Returns CLUSTER_COUNT_UNKNOWN if they couldn't be counted
+*/
+u32 _FAT_fat_freeClusterCount (PARTITION* partition);
+
+/*
+Release the memory used to track free clusters
+*/
+void _FAT_fat_freeUsedBitmap (PARTITION* partition);
+
 static inline u32 _FAT_fat_clusterToSector (PARTITION* partition, u32 cluster) {
 	return (cluster >= 2) ? ((cluster - 2) * partition->sectorsPerCluster) + partition->dataStart : partition->rootDirStart;
 }
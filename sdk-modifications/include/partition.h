@@ -55,8 +55,25 @@ typedef struct {
 	u32 sectorsPerFat;
 	u32 lastCluster;
 	u32 firstFree;
+	u32 numberFree;			// Free clusters, CLUSTER_COUNT_UNKNOWN if not known
+	u32* usedBitmap;		// One bit per cluster, set if the cluster is in use, NULL until needed
+	u32 fsInfoSector;		// FAT32 FSInfo sector, 0 if there is none
+	u32 fsInfoFree;			// Free cluster count as stored in the FSInfo sector
+	u32 fsInfoNextFree;		// Next free cluster hint as stored in the FSInfo sector
 } FAT;
 
+typedef struct {
+	u32 fatLookups;			// FAT entries read
+	u32 fatUpdates;			// FAT entries written
+	u32 pathComponents;		// Path components resolved
+	u32 dentryHits;			// Path components found in the directory entry cache
+} PARTITION_STATS;
+
+typedef struct {
+	CACHE_STATS cache;
+	PARTITION_STATS partition;
+} FAT_STATS;
+
 typedef struct {
 	const IO_INTERFACE* disc;
 	CACHE* cache;
@@ -75,25 +92,31 @@ typedef struct {
 	// Values that may change after construction
 	u32 cwdCluster;			// Current working directory cluser
 	u32 openFileCount;
+	PARTITION_STATS stats;
 } PARTITION;
 
 /*
 Mount the device specified by partitionDevice
 PD_DEFAULT is not allowed, use _FAT_partition_setDefaultDevice
 PD_CUSTOM is not allowed, use _FAT_partition_mountCustomDevice
+cacheSize: The number of cache pages to allocate
+cachePageSectors: The number of sectors in each cache page, or CACHE_PAGE_CLUSTER
+ for pages the size of a cluster
+cacheReadAhead: The number of extra pages to read at once when sectors are read
+ sequentially, 0 to disable read-ahead
 */
-bool _FAT_partition_mount (PARTITION_INTERFACE partitionNumber, u32 cacheSize);
+bool _FAT_partition_mount (PARTITION_INTERFACE partitionNumber, u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead);
 
 /*
 Mount a partition on a custom device
 */
-bool _FAT_partition_mountCustomInterface (const IO_INTERFACE* device, u32 cacheSize);
+bool _FAT_partition_mountCustomInterface (const IO_INTERFACE* device, u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead);
 
 
 /*
 Free Mount a partition on a custom device
 */
-bool _FAT_partition_freeMount( int partitionNumber, const IO_INTERFACE* device, u32 cacheSize);
+bool _FAT_partition_freeMount( int partitionNumber, const IO_INTERFACE* device, u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead);
 
 
 /*
@@ -121,6 +144,12 @@ based on the partition pointer
 */
 bool _FAT_partition_setDefaultPartition (PARTITION* partition);
 
+/*
+Store the free cluster count and next free cluster in the FAT32 FSInfo
+sector, through the cache, if they changed since it was last read or written
+*/
+void _FAT_partition_writeFSInfo (PARTITION* partition);
+
 /*
 Return the partition specified in a path
 For instance, "fat0:", "fat:", "/" and "fat:/" will all
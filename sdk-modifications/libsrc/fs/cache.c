@@ -3,11 +3,18 @@
  The cache is not visible to the user. It should be flushed 
  when any file is closed or changes are made to the filesystem.
  
- This cache implements a least-used-page replacement policy. This will 
- distribute sectors evenly over the pages, so if less than the maximum 
- pages are used at once, they should all eventually remain in the cache.
- This also has the benefit of throwing out old sectors, so as not to keep
- too many stale pages around.
+ This cache implements a segmented least-recently-used page replacement
+ policy. Pages are found through a hash table indexed by sector number, so
+ a lookup costs the same no matter how many pages the cache holds. A page
+ that has just been loaded goes into the probation segment, and moves to
+ the protected segment once it is used again. New sectors replace the page
+ that has gone unused for the longest time in the probation segment, so
+ sectors used once, such as those of a directory being scanned, don't push
+ out the FAT and directory sectors that keep being used.
+
+ A page may hold several consecutive sectors, such as a whole cluster, so
+ that a miss costs one command to the card instead of one per sector. When
+ pages are missed in order, the following pages are read in the same command.
 
  Copyright (c) 2006 Michael "Chishm" Chisholm
 	
@@ -41,16 +48,197 @@
 
 #include "mem_allocate.h"
 
-#define CACHE_FREE 0xFFFFFFFF
+#define CACHE_DIRTY 0xC33CA55A
 
-CACHE* _FAT_cache_constructor (u32 numberOfPages, const IO_INTERFACE* discInterface) {
-	CACHE* cache;
+// Smallest number of sectors written back in one command, when pages are small
+#define CACHE_MIN_STAGING_SECTORS 64
+
+// Part of the pages always left to the probation segment: 1/4
+#define CACHE_PROBATION_SHARE 4
+
+/*
+Fibonacci hashing: spreads runs of consecutive sectors, such as
+the sectors of the FAT, over all of the buckets
+*/
+static inline u32 _FAT_cache_hash (CACHE* cache, u32 sector) {
+	return (sector * 0x9E3779B1) >> cache->hashShift;
+}
+
+/*
+Find the page holding a sector, without changing the replacement order.
+Return CACHE_FREE if the sector is not in the cache.
+*/
+static u32 _FAT_cache_findPage (CACHE* cache, u32 sector) {
+	CACHE_ENTRY* cacheEntries = cache->cacheEntries;
+	u32 i;
+
+	for (i = cache->hashTable[_FAT_cache_hash (cache, sector)];
+		(i != CACHE_FREE) && (cacheEntries[i].sector != sector);
+		i = cacheEntries[i].hashNext);
+
+	return i;
+}
+
+static void _FAT_cache_hashInsert (CACHE* cache, u32 page) {
+	u32 bucket = _FAT_cache_hash (cache, cache->cacheEntries[page].sector);
+
+	cache->cacheEntries[page].hashNext = cache->hashTable[bucket];
+	cache->hashTable[bucket] = page;
+}
+
+static void _FAT_cache_hashRemove (CACHE* cache, u32 page) {
+	CACHE_ENTRY* cacheEntries = cache->cacheEntries;
+	u32* link = &cache->hashTable[_FAT_cache_hash (cache, cacheEntries[page].sector)];
+
+	while (*link != page) {
+		if (*link == CACHE_FREE) {
+			return;
+		}
+		link = &cacheEntries[*link].hashNext;
+	}
+	*link = cacheEntries[page].hashNext;
+	cacheEntries[page].hashNext = CACHE_FREE;
+}
+
+/*
+Take a page out of the replacement list, and out of the protected segment
+if it was in it
+*/
+static void _FAT_cache_lruUnlink (CACHE* cache, u32 page) {
+	CACHE_ENTRY* cacheEntries = cache->cacheEntries;
+	u32 prev = cacheEntries[page].prev;
+	u32 next = cacheEntries[page].next;
+
+	if (prev != CACHE_FREE) {
+		cacheEntries[prev].next = next;
+	} else {
+		cache->lruHead = next;
+	}
+	if (next != CACHE_FREE) {
+		cacheEntries[next].prev = prev;
+	} else {
+		cache->lruTail = prev;
+	}
+	if (cache->probationHead == page) {
+		cache->probationHead = next;
+	}
+	if (cacheEntries[page].reused) {
+		cacheEntries[page].reused = false;
+		cache->reusedPages--;
+	}
+}
+
+/*
+Put a page in the replacement list just before another one, or at the
+end if before is CACHE_FREE
+*/
+static void _FAT_cache_lruInsert (CACHE* cache, u32 page, u32 before) {
+	CACHE_ENTRY* cacheEntries = cache->cacheEntries;
+	u32 prev = (before == CACHE_FREE) ? cache->lruTail : cacheEntries[before].prev;
+
+	cacheEntries[page].prev = prev;
+	cacheEntries[page].next = before;
+	if (prev != CACHE_FREE) {
+		cacheEntries[prev].next = page;
+	} else {
+		cache->lruHead = page;
+	}
+	if (before != CACHE_FREE) {
+		cacheEntries[before].prev = page;
+	} else {
+		cache->lruTail = page;
+	}
+}
+
+/*
+Make a page that is used again the most recently used one, in the protected
+segment. If the segment grows too large, its least recently used page goes
+back to the front of the probation segment.
+*/
+static void _FAT_cache_lruTouch (CACHE* cache, u32 page) {
+	CACHE_ENTRY* cacheEntries = cache->cacheEntries;
+	u32 last;
+
+	if ((cache->lruHead == page) && cacheEntries[page].reused) {
+		return;
+	}
+	_FAT_cache_lruUnlink (cache, page);
+	_FAT_cache_lruInsert (cache, page, cache->lruHead);
+	cacheEntries[page].reused = true;
+	cache->reusedPages++;
+
+	if (cache->reusedPages > cache->maxReusedPages) {
+		last = (cache->probationHead == CACHE_FREE) ? cache->lruTail : cacheEntries[cache->probationHead].prev;
+		cacheEntries[last].reused = false;
+		cache->reusedPages--;
+		cache->probationHead = last;
+	}
+}
+
+/*
+Make a page that has just been loaded the most recently used one in the
+probation segment
+*/
+static void _FAT_cache_lruAdd (CACHE* cache, u32 page) {
+	cache->cacheEntries[page].reused = false;
+	_FAT_cache_lruInsert (cache, page, cache->probationHead);
+	cache->probationHead = page;
+}
+
+/*
+Empty the hash table and chain all pages, now free, into the replacement list
+*/
+static void _FAT_cache_reset (CACHE* cache) {
+	CACHE_ENTRY* cacheEntries = cache->cacheEntries;
+	u32 numberOfPages = cache->numberOfPages;
 	u32 i;
+
+	for (i = 0; i < (1u << (32 - cache->hashShift)); i++) {
+		cache->hashTable[i] = CACHE_FREE;
+	}
+
+	for (i = 0; i < numberOfPages; i++) {
+		cacheEntries[i].sector = CACHE_FREE;
+		cacheEntries[i].count = 0;
+		cacheEntries[i].dirty = 0;
+		cacheEntries[i].reused = false;
+		cacheEntries[i].prev = (i > 0) ? i - 1 : CACHE_FREE;
+		cacheEntries[i].next = (i + 1 < numberOfPages) ? i + 1 : CACHE_FREE;
+		cacheEntries[i].hashNext = CACHE_FREE;
+	}
+
+	cache->lruHead = 0;
+	cache->lruTail = numberOfPages - 1;
+	cache->probationHead = 0;
+	cache->reusedPages = 0;
+	cache->lastPage = CACHE_FREE;
+	cache->nextSequential = CACHE_FREE;
+}
+
+CACHE* _FAT_cache_constructor (u32 numberOfPages, u32 sectorsPerPage, u32 readAheadPages,
+	u32 pageAlignment, u32 endOfPartition, const IO_INTERFACE* discInterface)
+{
+	CACHE* cache;
 	CACHE_ENTRY* cacheEntries;
+	u32 hashBits;
 
 	if (numberOfPages < 2) {
 		numberOfPages = 2;
 	}
+
+	// Round the page size down to a power of 2
+	if (sectorsPerPage < 1) {
+		sectorsPerPage = 1;
+	}
+	while (sectorsPerPage & (sectorsPerPage - 1)) {
+		sectorsPerPage &= sectorsPerPage - 1;
+	}
+
+	// Pages read ahead replace the least recently used ones, which must not
+	// include pages from the same read
+	if (readAheadPages > numberOfPages / 2) {
+		readAheadPages = numberOfPages / 2;
+	}
 	
 	cache = (CACHE*) _FAT_mem_allocate (sizeof(CACHE));
 	if (cache == NULL) {
@@ -59,6 +247,12 @@ CACHE* _FAT_cache_constructor (u32 numberOfPages, const IO_INTERFACE* discInterf
 
 	cache->disc = discInterface;
 	cache->numberOfPages = numberOfPages;
+	cache->sectorsPerPage = sectorsPerPage;
+	cache->bytesPerPage = sectorsPerPage * BYTES_PER_READ;
+	cache->pageAlignment = pageAlignment & (sectorsPerPage - 1);
+	cache->endOfPartition = endOfPartition;
+	cache->readAheadPages = readAheadPages;
+	cache->maxReusedPages = numberOfPages - numberOfPages / CACHE_PROBATION_SHARE;
 	
 
 	cacheEntries = (CACHE_ENTRY*) _FAT_mem_allocate ( sizeof(CACHE_ENTRY) * numberOfPages);
@@ -67,21 +261,51 @@ CACHE* _FAT_cache_constructor (u32 numberOfPages, const IO_INTERFACE* discInterf
 		return NULL;
 	}
 
-	for (i = 0; i < numberOfPages; i++) {
-		cacheEntries[i].sector = CACHE_FREE;
-		cacheEntries[i].count = 0;
-		cacheEntries[i].dirty = 0;
-	}
-
 	cache->cacheEntries = cacheEntries;
 
-	cache->pages = (u8*) _FAT_mem_allocate ( CACHE_PAGE_SIZE * numberOfPages);
+	// Use at least as many buckets as pages, so chains stay one page long on average
+	for (hashBits = 1; (1u << hashBits) < numberOfPages; hashBits++);
+	cache->hashShift = 32 - hashBits;
+
+	cache->hashTable = (u32*) _FAT_mem_allocate ( sizeof(u32) << hashBits);
+	if (cache->hashTable == NULL) {
+		_FAT_mem_free (cache->cacheEntries);
+		_FAT_mem_free (cache);
+		return NULL;
+	}
+
+	cache->pages = (u8*) _FAT_mem_allocate ( cache->bytesPerPage * numberOfPages);
 	if (cache->pages == NULL) {
+		_FAT_mem_free (cache->hashTable);
+		_FAT_mem_free (cache->cacheEntries);
+		_FAT_mem_free (cache);
+		return NULL;
+	}
+
+	cache->writeOrder = (u32*) _FAT_mem_allocate ( sizeof(u32) * numberOfPages);
+	if (cache->writeOrder == NULL) {
+		_FAT_mem_free (cache->pages);
+		_FAT_mem_free (cache->hashTable);
 		_FAT_mem_free (cache->cacheEntries);
 		_FAT_mem_free (cache);
 		return NULL;
 	}
 
+	cache->stagingSectors = sectorsPerPage * (readAheadPages + 1);
+	if (cache->stagingSectors < CACHE_MIN_STAGING_SECTORS) {
+		cache->stagingSectors = CACHE_MIN_STAGING_SECTORS;
+	}
+	cache->stagingBuffer = (u8*) _FAT_mem_allocate ( cache->stagingSectors * BYTES_PER_READ);
+	if (cache->stagingBuffer == NULL) {
+		// Work one page at a time rather than not at all
+		cache->stagingSectors = 0;
+		cache->readAheadPages = 0;
+	}
+
+	memset (&cache->stats, 0, sizeof(CACHE_STATS));
+
+	_FAT_cache_reset (cache);
+
 	return cache;
 }
 
@@ -90,7 +314,12 @@ void _FAT_cache_destructor (CACHE* cache) {
 	_FAT_cache_flush(cache);
 
 	// Free memory in reverse allocation order
+	if (cache->stagingBuffer != NULL) {
+		_FAT_mem_free (cache->stagingBuffer);
+	}
+	_FAT_mem_free (cache->writeOrder);
 	_FAT_mem_free (cache->pages);
+	_FAT_mem_free (cache->hashTable);
 	_FAT_mem_free (cache->cacheEntries);
 	_FAT_mem_free (cache);
 
@@ -98,51 +327,380 @@ void _FAT_cache_destructor (CACHE* cache) {
 }
 
 /*
-Retrieve a sector's page from the cache. If it is not found in the cache,
-load it into the cache and return the page it was loaded to.
-Return CACHE_FREE on error.
+Get the first sector of the page that holds a sector
 */
-static u32 _FAT_cache_getSector (CACHE* cache, u32 sector) {
-	u32 i;
-	CACHE_ENTRY* cacheEntries = cache->cacheEntries;
-	u32 numberOfPages = cache->numberOfPages;
+static inline u32 _FAT_cache_pageStart (CACHE* cache, u32 sector) {
+	u32 phase = (sector - cache->pageAlignment) & (cache->sectorsPerPage - 1);
+
+	// The first page of the disc may be cut short by the alignment
+	return (phase > sector) ? 0 : sector - phase;
+}
+
+/*
+Get the number of sectors in the page starting at pageStart
+*/
+static inline u32 _FAT_cache_pageLength (CACHE* cache, u32 pageStart) {
+	u32 pageEnd;
+
+	if (pageStart < cache->pageAlignment) {
+		// First page of the disc, cut short by the alignment
+		pageEnd = cache->pageAlignment;
+	} else {
+		pageEnd = pageStart + cache->sectorsPerPage;
+	}
+	if (pageEnd > cache->endOfPartition) {
+		pageEnd = cache->endOfPartition;
+	}
+	return pageEnd - pageStart;
+}
+
+static inline u8* _FAT_cache_pageData (CACHE* cache, u32 page) {
+	return cache->pages + cache->bytesPerPage * page;
+}
+
+bool _FAT_cache_readDirect (CACHE* cache, u32 sector, u32 numSectors, void* buffer) {
+	cache->stats.readCommands++;
+	cache->stats.sectorsRead += numSectors;
+	return _FAT_disc_readSectors (cache->disc, sector, numSectors, buffer);
+}
+
+bool _FAT_cache_writeDirect (CACHE* cache, u32 sector, u32 numSectors, const void* buffer) {
+	cache->stats.writeCommands++;
+	cache->stats.sectorsWritten += numSectors;
+	return _FAT_disc_writeSectors (cache->disc, sector, numSectors, buffer);
+}
+
+/*
+Write the modified sectors of a page back to disc
+*/
+static bool _FAT_cache_writeBack (CACHE* cache, u32 page) {
+	CACHE_ENTRY* entry = &cache->cacheEntries[page];
+
+	if (CACHE_DIRTY != entry->dirty) {
+		return true;
+	}
+	if (!_FAT_cache_writeDirect (cache, entry->sector + entry->dirtyStart,
+		entry->dirtyEnd - entry->dirtyStart,
+		_FAT_cache_pageData (cache, page) + entry->dirtyStart * BYTES_PER_READ))
+	{
+		return false;
+	}
+	entry->dirty = 0;
+	return true;
+}
+
+/*
+First and one past the last modified sectors of a dirty page, on disc
+*/
+static inline u32 _FAT_cache_dirtyStart (CACHE* cache, u32 page) {
+	return cache->cacheEntries[page].sector + cache->cacheEntries[page].dirtyStart;
+}
+
+static inline u32 _FAT_cache_dirtyEnd (CACHE* cache, u32 page) {
+	return cache->cacheEntries[page].sector + cache->cacheEntries[page].dirtyEnd;
+}
+
+/*
+Write back a run of dirty pages whose modified sectors follow each other
+on disc in a single command, gathering them in the staging buffer
+*/
+static bool _FAT_cache_writeRun (CACHE* cache, const u32* run, u32 runLength) {
+	CACHE_ENTRY* entry;
+	u8* data = cache->stagingBuffer;
+	u32 i, count;
+
+	if (runLength == 1) {
+		return _FAT_cache_writeBack (cache, run[0]);
+	}
+
+	for (i = 0; i < runLength; i++) {
+		entry = &cache->cacheEntries[run[i]];
+		count = entry->dirtyEnd - entry->dirtyStart;
+		memcpy (data, _FAT_cache_pageData (cache, run[i]) + entry->dirtyStart * BYTES_PER_READ, count * BYTES_PER_READ);
+		data += count * BYTES_PER_READ;
+	}
+
+	count = (data - cache->stagingBuffer) / BYTES_PER_READ;
+	if (!_FAT_cache_writeDirect (cache, _FAT_cache_dirtyStart (cache, run[0]), count, cache->stagingBuffer)) {
+		return false;
+	}
+
+	for (i = 0; i < runLength; i++) {
+		cache->cacheEntries[run[i]].dirty = 0;
+	}
+	return true;
+}
+
+/*
+Find a dirty page whose modified sectors end just before sector
+*/
+static u32 _FAT_cache_dirtyPageEndingAt (CACHE* cache, u32 sector) {
+	u32 page;
+
+	if (sector == 0) {
+		return CACHE_FREE;
+	}
+	page = _FAT_cache_findPage (cache, _FAT_cache_pageStart (cache, sector - 1));
+	if ((page == CACHE_FREE) || (CACHE_DIRTY != cache->cacheEntries[page].dirty)
+		|| (_FAT_cache_dirtyEnd (cache, page) != sector))
+	{
+		return CACHE_FREE;
+	}
+	return page;
+}
+
+/*
+Find a dirty page whose modified sectors start at sector
+*/
+static u32 _FAT_cache_dirtyPageStartingAt (CACHE* cache, u32 sector) {
+	u32 page;
+
+	if (sector >= cache->endOfPartition) {
+		return CACHE_FREE;
+	}
+	page = _FAT_cache_findPage (cache, _FAT_cache_pageStart (cache, sector));
+	if ((page == CACHE_FREE) || (CACHE_DIRTY != cache->cacheEntries[page].dirty)
+		|| (_FAT_cache_dirtyStart (cache, page) != sector))
+	{
+		return CACHE_FREE;
+	}
+	return page;
+}
+
+/*
+Write back a dirty page that is about to be replaced, along with the dirty
+pages next to it on disc, so that they don't need a command each later
+*/
+static bool _FAT_cache_writeBackNeighbours (CACHE* cache, u32 page) {
+	u32 first, next, total, runLength;
+
+	if (CACHE_DIRTY != cache->cacheEntries[page].dirty) {
+		return true;
+	}
+
+	// Go back to the first page of the run
+	first = page;
+	total = _FAT_cache_dirtyEnd (cache, page) - _FAT_cache_dirtyStart (cache, page);
+	for (;;) {
+		next = _FAT_cache_dirtyPageEndingAt (cache, _FAT_cache_dirtyStart (cache, first));
+		if ((next == CACHE_FREE)
+			|| (total + _FAT_cache_dirtyEnd (cache, next) - _FAT_cache_dirtyStart (cache, next) > cache->stagingSectors))
+		{
+			break;
+		}
+		total += _FAT_cache_dirtyEnd (cache, next) - _FAT_cache_dirtyStart (cache, next);
+		first = next;
+	}
+
+	// Then collect the pages of the run going forward
+	runLength = 0;
+	total = 0;
+	next = first;
+	do {
+		cache->writeOrder[runLength++] = next;
+		total += _FAT_cache_dirtyEnd (cache, next) - _FAT_cache_dirtyStart (cache, next);
+		next = _FAT_cache_dirtyPageStartingAt (cache, _FAT_cache_dirtyEnd (cache, next));
+	} while ((next != CACHE_FREE)
+		&& (total + _FAT_cache_dirtyEnd (cache, next) - _FAT_cache_dirtyStart (cache, next) <= cache->stagingSectors));
+
+	return _FAT_cache_writeRun (cache, cache->writeOrder, runLength);
+}
+
+/*
+Empty the least recently used page, writing it back first if needed, and
+take it out of the replacement list. Return the page, or CACHE_FREE on error.
+*/
+static u32 _FAT_cache_evict (CACHE* cache) {
+	u32 page = cache->lruTail;
+
+	if (cache->cacheEntries[page].sector != CACHE_FREE) {
+		if (CACHE_DIRTY == cache->cacheEntries[page].dirty) {
+			cache->stats.writeBacks++;
+		}
+		if (!_FAT_cache_writeBackNeighbours (cache, page)) {
+			return CACHE_FREE;
+		}
+		_FAT_cache_hashRemove (cache, page);
+		cache->cacheEntries[page].sector = CACHE_FREE;
+		cache->cacheEntries[page].count = 0;
+	}
+	_FAT_cache_lruUnlink (cache, page);
+	return page;
+}
+
+/*
+Put the pages emptied by _FAT_cache_evictRun, starting with page, back at
+the end of the replacement list
+*/
+static void _FAT_cache_releaseRun (CACHE* cache, u32 page) {
+	u32 next;
+
+	while (page != CACHE_FREE) {
+		next = cache->cacheEntries[page].next;
+		_FAT_cache_lruInsert (cache, page, CACHE_FREE);
+		if (cache->probationHead == CACHE_FREE) {
+			cache->probationHead = page;
+		}
+		page = next;
+	}
+}
 
-	u32 leastUsed = 0;
-	u32 lowestCount = 0xFFFFFFFF;
+/*
+Empty the count least recently used pages and take them out of the
+replacement list, chained through their next links. The last page emptied
+comes first. Return that page, or CACHE_FREE on error, with the pages
+emptied so far put back at the end of the list.
+*/
+static u32 _FAT_cache_evictRun (CACHE* cache, u32 count) {
+	u32 first = CACHE_FREE;
+	u32 page;
 
-	for (i = 0; (i < numberOfPages) && (cacheEntries[i].sector != sector); i++) {
-		// While searching for the desired sector, also search for the leased used page
-		if ( (cacheEntries[i].sector == CACHE_FREE) || (cacheEntries[i].count < lowestCount) ) {
-			leastUsed = i;
-			lowestCount = cacheEntries[i].count;
+	while (count-- > 0) {
+		page = _FAT_cache_evict (cache);
+		if (page == CACHE_FREE) {
+			_FAT_cache_releaseRun (cache, first);
+			return CACHE_FREE;
 		}
+		cache->cacheEntries[page].next = first;
+		first = page;
 	}
+	return first;
+}
+
+/*
+Put a page that has just been loaded into the cache
+*/
+static void _FAT_cache_install (CACHE* cache, u32 page, u32 sector, u32 count) {
+	cache->cacheEntries[page].sector = sector;
+	cache->cacheEntries[page].count = count;
+	cache->cacheEntries[page].dirty = 0;
+	_FAT_cache_hashInsert (cache, page);
+	_FAT_cache_lruAdd (cache, page);
+}
 
-	// If it found the sector in the cache, return it
-	if ((i < numberOfPages) && (cacheEntries[i].sector == sector)) {
-		// Increment usage counter
-		cacheEntries[i].count += 1;
-		return i;
+/*
+Load the page starting at pageStart, along with the following pages if
+the disc is being read sequentially, and return the page it was loaded to.
+Return CACHE_FREE on error.
+*/
+static u32 _FAT_cache_loadPage (CACHE* cache, u32 pageStart) {
+	u32 page, next, count, runPages, runSectors, sector, i;
+	u8* data;
+
+	count = _FAT_cache_pageLength (cache, pageStart);
+
+	// Find out how many of the following pages can be read along with this one
+	runPages = 1;
+	runSectors = count;
+	if ((cache->readAheadPages > 0) && (pageStart == cache->nextSequential)) {
+		sector = pageStart + count;
+		while ((runPages <= cache->readAheadPages) && (sector < cache->endOfPartition)
+			&& (_FAT_cache_findPage (cache, sector) == CACHE_FREE))
+		{
+			runSectors += _FAT_cache_pageLength (cache, sector);
+			sector = pageStart + runSectors;
+			runPages++;
+		}
 	}
+	cache->nextSequential = pageStart + runSectors;
 
-	// If it didn't, replace the least used cache page with the desired sector
-	if ((cacheEntries[leastUsed].sector != CACHE_FREE) && (0xC33CA55A == cacheEntries[leastUsed].dirty)) {
-		// Write the page back to disc if it has been written to
-		if (!_FAT_disc_writeSectors (cache->disc, cacheEntries[leastUsed].sector, 1, cache->pages + CACHE_PAGE_SIZE * leastUsed)) {
+	// Make room for all of the pages before reading anything, since writing
+	// back the dirty pages they replace goes through the staging buffer too
+	page = _FAT_cache_evictRun (cache, runPages);
+	if (page == CACHE_FREE) {
+		cache->nextSequential = CACHE_FREE;
+		return CACHE_FREE;
+	}
+
+	if (runPages == 1) {
+		if (!_FAT_cache_readDirect (cache, pageStart, count, _FAT_cache_pageData (cache, page))) {
+			_FAT_cache_releaseRun (cache, page);
+			cache->nextSequential = CACHE_FREE;
 			return CACHE_FREE;
 		}
-		cacheEntries[leastUsed].dirty = 0;
+		_FAT_cache_install (cache, page, pageStart, count);
+		return page;
+	}
+
+	// Read all of the pages in one command, then spread them out
+	if (!_FAT_cache_readDirect (cache, pageStart, runSectors, cache->stagingBuffer)) {
+		_FAT_cache_releaseRun (cache, page);
+		cache->nextSequential = CACHE_FREE;
+		return CACHE_FREE;
 	}
+	cache->stats.readAheadSectors += runSectors - count;
+	// Install the pages read ahead first, so that the one that was
+	// asked for is the most recently used
+	data = cache->stagingBuffer + count * BYTES_PER_READ;
+	sector = pageStart + count;
+	for (i = 1; i < runPages; i++) {
+		u32 length = _FAT_cache_pageLength (cache, sector);
+		next = cache->cacheEntries[page].next;
+		memcpy (_FAT_cache_pageData (cache, page), data, length * BYTES_PER_READ);
+		_FAT_cache_install (cache, page, sector, length);
+		data += length * BYTES_PER_READ;
+		sector += length;
+		page = next;
+	}
+	memcpy (_FAT_cache_pageData (cache, page), cache->stagingBuffer, count * BYTES_PER_READ);
+	_FAT_cache_install (cache, page, pageStart, count);
+	return page;
+}
+
+/*
+Retrieve a sector's page from the cache. If it is not found in the cache,
+load it into the cache and return the page it was loaded to.
+Return CACHE_FREE on error.
+*/
+static u32 _FAT_cache_getSector (CACHE* cache, u32 sector) {
+	u32 page;
 
-	// Load the new sector into the cache
-	if (!_FAT_disc_readSectors (cache->disc, sector, 1, cache->pages + CACHE_PAGE_SIZE * leastUsed)) {
+	if (sector >= cache->endOfPartition) {
 		return CACHE_FREE;
 	}
-	cacheEntries[leastUsed].sector = sector;
-	// Increment the usage count, don't reset it
-	// This creates a paging policy of least used PAGE, not sector
-	cacheEntries[leastUsed].count += 1;
-	return leastUsed;
+
+	// If it found the sector in the cache, return it. Going back to the page
+	// that was just used, such as for the next entry of the same FAT sector,
+	// doesn't count as using it again.
+	page = _FAT_cache_findPage (cache, _FAT_cache_pageStart (cache, sector));
+	if (page != CACHE_FREE) {
+		cache->stats.hits++;
+		if (page != cache->lastPage) {
+			_FAT_cache_lruTouch (cache, page);
+			cache->lastPage = page;
+		}
+		return page;
+	}
+	cache->stats.misses++;
+
+	// If it didn't, replace the least recently used page with the desired sector
+	cache->lastPage = _FAT_cache_loadPage (cache, _FAT_cache_pageStart (cache, sector));
+	return cache->lastPage;
+}
+
+/*
+Get a pointer to a sector within the page that holds it
+*/
+static inline u8* _FAT_cache_sectorData (CACHE* cache, u32 page, u32 sector) {
+	return _FAT_cache_pageData (cache, page) + (sector - cache->cacheEntries[page].sector) * BYTES_PER_READ;
+}
+
+/*
+Record that a sector of a page has been written to
+*/
+static inline void _FAT_cache_markDirty (CACHE* cache, u32 page, u32 sector) {
+	CACHE_ENTRY* entry = &cache->cacheEntries[page];
+	u32 index = sector - entry->sector;
+
+	if (CACHE_DIRTY != entry->dirty) {
+		entry->dirty = CACHE_DIRTY;
+		entry->dirtyStart = index;
+		entry->dirtyEnd = index + 1;
+	} else if (index < entry->dirtyStart) {
+		entry->dirtyStart = index;
+	} else if (index >= entry->dirtyEnd) {
+		entry->dirtyEnd = index + 1;
+	}
 }
 
 /*
@@ -160,7 +718,7 @@ bool _FAT_cache_readPartialSector (CACHE* cache, void* buffer, u32 sector, u32 o
 		return false;
 	}
 
-	memcpy (buffer, cache->pages + (CACHE_PAGE_SIZE * page) + offset, size);
+	memcpy (buffer, _FAT_cache_sectorData (cache, page, sector) + offset, size);
 	return true;
 }
 
@@ -179,8 +737,8 @@ bool _FAT_cache_writePartialSector (CACHE* cache, const void* buffer, u32 sector
 		return false;
 	}
 
-	memcpy (cache->pages + (CACHE_PAGE_SIZE * page) + offset, buffer, size);
-	cache->cacheEntries[page].dirty = 0xC33CA55A;
+	memcpy (_FAT_cache_sectorData (cache, page, sector) + offset, buffer, size);
+	_FAT_cache_markDirty (cache, page, sector);
 
 	return true;
 }
@@ -192,37 +750,40 @@ cancel the dirty state of sector m
 */
 void _FAT_cache_writePartialSector_check (CACHE* cache, u32 sector, u32 num, const void* buffer)
 {
-	u32 i, m;
-	CACHE_ENTRY* cacheEntries = cache->cacheEntries;
-	u32 numberOfPages = cache->numberOfPages;
+	CACHE_ENTRY* entry;
+	u32 page, m, index;
 
-	m = 0;
-	while(m++ < num)
+	for (m = 0; m < num; m++)
 	{
-		for (i = 0; i < numberOfPages; i++)
-		{
-			if(cacheEntries[i].sector == sector)
-				break;
-		}
-
-		if(i >= numberOfPages)
-			return;
+		page = _FAT_cache_findPage (cache, _FAT_cache_pageStart (cache, sector + m));
+		if (page == CACHE_FREE)
+			continue;
 
 		//cache the data
-		memcpy (cache->pages + (CACHE_PAGE_SIZE * i), buffer, CACHE_PAGE_SIZE);
-		//cancel the dirty state
-		cache->cacheEntries[i].dirty = 0;
-
-		sector += 1;
-		buffer += CACHE_PAGE_SIZE;
+		memcpy (_FAT_cache_sectorData (cache, page, sector + m), (const u8*)buffer + BYTES_PER_READ * m, BYTES_PER_READ);
+
+		//cancel the dirty state, if it was the first or last modified sector of the page
+		entry = &cache->cacheEntries[page];
+		index = sector + m - entry->sector;
+		if (CACHE_DIRTY == entry->dirty) {
+			if (index == entry->dirtyStart) {
+				entry->dirtyStart++;
+			} else if (index + 1 == entry->dirtyEnd) {
+				entry->dirtyEnd--;
+			}
+			if (entry->dirtyStart >= entry->dirtyEnd) {
+				entry->dirty = 0;
+			}
+		}
 	}
 }
 
 /* 
-Writes some data to a cache page, zeroing out the page first
+Writes some data to a cache page, zeroing out the sector first
 */
 bool _FAT_cache_eraseWritePartialSector (CACHE* cache, const void* buffer, u32 sector, u32 offset, u32 size) {
 	u32 page;
+	u8* data;
 
 	if (offset + size > BYTES_PER_READ) {
 		return false;
@@ -233,9 +794,10 @@ bool _FAT_cache_eraseWritePartialSector (CACHE* cache, const void* buffer, u32 s
 		return false;
 	}
 
-	memset (cache->pages + (CACHE_PAGE_SIZE * page), 0, CACHE_PAGE_SIZE);
-	memcpy (cache->pages + (CACHE_PAGE_SIZE * page) + offset, buffer, size);
-	cache->cacheEntries[page].dirty = 0xC33CA55A;
+	data = _FAT_cache_sectorData (cache, page, sector);
+	memset (data, 0, BYTES_PER_READ);
+	memcpy (data + offset, buffer, size);
+	_FAT_cache_markDirty (cache, page, sector);
 
 	return true;
 }
@@ -243,19 +805,44 @@ bool _FAT_cache_eraseWritePartialSector (CACHE* cache, const void* buffer, u32 s
 
 /*
 Flushes all dirty pages to disc, clearing the dirty flag. 
-Also resets all pages' page count to 0.
+The pages stay in the cache, in the same replacement order.
+Pages are written in sector order, and runs of modified sectors that follow
+each other are written in one command.
 */
 bool _FAT_cache_flush (CACHE* cache) {
-	u32 i;
+	u32* writeOrder = cache->writeOrder;
+	u32 numberOfDirty = 0;
+	u32 i, j, gap, page, total;
 
 	for (i = 0; i < cache->numberOfPages; i++) {
-		if (0xC33CA55A == cache->cacheEntries[i].dirty) {
-			if (!_FAT_disc_writeSectors (cache->disc, cache->cacheEntries[i].sector, 1, cache->pages + CACHE_PAGE_SIZE * i)) {
-				return CACHE_FREE;
+		if (CACHE_DIRTY == cache->cacheEntries[i].dirty) {
+			writeOrder[numberOfDirty++] = i;
+		}
+	}
+
+	// Shell sort the dirty pages by their first modified sector
+	for (gap = numberOfDirty / 2; gap > 0; gap /= 2) {
+		for (i = gap; i < numberOfDirty; i++) {
+			page = writeOrder[i];
+			for (j = i; (j >= gap) && (_FAT_cache_dirtyStart (cache, writeOrder[j - gap]) > _FAT_cache_dirtyStart (cache, page)); j -= gap) {
+				writeOrder[j] = writeOrder[j - gap];
 			}
+			writeOrder[j] = page;
+		}
+	}
+
+	for (i = 0; i < numberOfDirty; i = j) {
+		total = _FAT_cache_dirtyEnd (cache, writeOrder[i]) - _FAT_cache_dirtyStart (cache, writeOrder[i]);
+		for (j = i + 1; (j < numberOfDirty)
+			&& (_FAT_cache_dirtyStart (cache, writeOrder[j]) == _FAT_cache_dirtyEnd (cache, writeOrder[j - 1]))
+			&& (total + _FAT_cache_dirtyEnd (cache, writeOrder[j]) - _FAT_cache_dirtyStart (cache, writeOrder[j]) <= cache->stagingSectors);
+			j++)
+		{
+			total += _FAT_cache_dirtyEnd (cache, writeOrder[j]) - _FAT_cache_dirtyStart (cache, writeOrder[j]);
+		}
+		if (!_FAT_cache_writeRun (cache, &writeOrder[i], j - i)) {
+			return false;
 		}
-		cache->cacheEntries[i].count = 0;
-		cache->cacheEntries[i].dirty = 0;
 	}
 
 	_FAT_disc_clearStatus( cache->disc );
@@ -263,11 +850,5 @@ bool _FAT_cache_flush (CACHE* cache) {
 }
 
 void _FAT_cache_invalidate (CACHE* cache) {
-	int i;
-	for (i = 0; i < cache->numberOfPages; i++) {
-		cache->cacheEntries[i].sector = CACHE_FREE;
-		cache->cacheEntries[i].count = 0;
-		cache->cacheEntries[i].dirty = 0;
-	}
+	_FAT_cache_reset (cache);
 }
-
@@ -54,11 +54,69 @@
 #include "bit_ops.h"
 #include "filetime.h"
 #include "fs_unicode.h"
+#include "mem_allocate.h"
 
 // Directory entry codes
 #define DIR_ENTRY_LAST 0x00
 #define DIR_ENTRY_FREE 0xE5
 
+// Directory entry cache
+#define DIR_CACHE_SIZE 256	// Must be a power of 2
+
+typedef struct {
+	PARTITION* partition;			// NULL if the slot is unused
+	u32 dirCluster;
+	u32 nameHash;
+	DIR_ENTRY_POSITION dataStart;
+} DIR_CACHE_ENTRY;
+
+/*
+Path components resolved by _FAT_directory_entryFromPath, keyed by parent
+directory cluster and case folded name. Only the position of the entry is
+kept; the entry itself is always re-read through the sector cache, since
+closing a file rewrites its size and cluster on disc.
+*/
+static DIR_CACHE_ENTRY _FAT_directory_cache[DIR_CACHE_SIZE];
+
+// Directory index
+#define DIR_INDEX_COUNT 2
+#define DIR_INDEX_MIN_NAMES 64	// Must be a power of 2
+#define DIR_INDEX_MAX_GAPS 32
+#define DIR_INDEX_EMPTY 0
+#define DIR_INDEX_DELETED 1
+
+typedef struct {
+	DIR_ENTRY_POSITION start;
+	u32 length;
+} DIR_INDEX_GAP;
+
+typedef struct {
+	PARTITION* partition;			// NULL if the slot is unused
+	u32 dirCluster;
+	u32 lastUse;
+	u32* names;						// Open addressed set of name and alias hashes
+	u32 nameCapacity;
+	u32 nameCount;
+	u32 nameSlotsUsed;				// Names plus deleted slots
+	u32* clusters;					// Clusters of the directory, to recognise its entries
+	u32 clusterCount;
+	u32 clusterCapacity;
+	DIR_INDEX_GAP gaps[DIR_INDEX_MAX_GAPS];
+	u32 gapCount;
+	bool endKnown;					// If false, free entries are found by scanning
+	DIR_ENTRY_POSITION end;			// Position of the end of directory marker
+} DIR_INDEX;
+
+/*
+Indexes of the directories most recently added to. Each one knows every
+name and alias in its directory, where the runs of deleted entries are and
+where the directory ends, so creating a file does not have to scan the
+directory to check the name, pick an alias tail and find room for it.
+A name being in the index is only a hint and is confirmed by a scan.
+*/
+static DIR_INDEX _FAT_directory_index[DIR_INDEX_COUNT];
+static u32 _FAT_directory_indexUse;
+
 
 // Long file name directory entry
 enum LFN_offset {
@@ -269,7 +327,6 @@ bool _FAT_directory_getNextEntry (PARTITION* partition, DIR_ENTRY* entry) {
 	u8 entryData[0x20];
 
 	bool notFound, found;
-	u32 maxSectors;
 	int lfnPos;
 	u8 lfnChkSum, chkSum;
 	char* filename;
@@ -292,13 +349,6 @@ bool _FAT_directory_getNextEntry (PARTITION* partition, DIR_ENTRY* entry) {
 	//unicodeFilename = entry->unicodeFilename;
 	memset( unicodeFilename, 0, 512 );
 
-	// Can only be FAT16_ROOT_DIR_CLUSTER if it is the root directory on a FAT12 or FAT16 partition
-	if (entryStart.cluster == FAT16_ROOT_DIR_CLUSTER) {
-		maxSectors = partition->dataStart - partition->rootDirStart;
-	} else {
-		maxSectors = partition->sectorsPerCluster;
-	}
-
 	lfnExists = false;
 
 	found = false;
@@ -468,6 +518,105 @@ bool _FAT_directory_entryFromPosition (PARTITION* partition, DIR_ENTRY* entry) {
 	return true;
 }
 
+static u32 _FAT_directory_hashName (u32 dirCluster, const char* name, size_t nameLength) {
+	u32 hash = 2166136261u ^ dirCluster;
+	size_t i;
+
+	// FNV-1a over the lower case name, matching the strncasecmp used by the scan
+	for (i = 0; i < nameLength; i++) {
+		hash ^= (u8)tolower((unsigned char)name[i]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static inline DIR_CACHE_ENTRY* _FAT_directory_cacheSlot (u32 nameHash) {
+	return &_FAT_directory_cache[nameHash & (DIR_CACHE_SIZE - 1)];
+}
+
+static inline bool _FAT_directory_samePosition (const DIR_ENTRY_POSITION* a, const DIR_ENTRY_POSITION* b) {
+	return (a->cluster == b->cluster) && (a->sector == b->sector) && (a->offset == b->offset);
+}
+
+/*
+Look up name in the directory entry cache and re-read the entry from its
+cached position. The entry is only returned if it is still there, still has
+the same name and, when isDirectory is set, is still a directory.
+*/
+static bool _FAT_directory_cacheFind (PARTITION* partition, DIR_ENTRY* entry, u32 dirCluster, const char* name, size_t nameLength, bool isDirectory) {
+	u32 nameHash = _FAT_directory_hashName (dirCluster, name, nameLength);
+	DIR_CACHE_ENTRY* slot = _FAT_directory_cacheSlot (nameHash);
+
+	if ((slot->partition != partition) || (slot->dirCluster != dirCluster) || (slot->nameHash != nameHash)) {
+		return false;
+	}
+
+	// Start just before the cached entry, the same way getFirstEntry starts a scan
+	entry->dataEnd = slot->dataStart;
+	entry->dataEnd.offset -= 1;
+
+	if (!_FAT_directory_getNextEntry (partition, entry)
+		|| !_FAT_directory_samePosition (&entry->dataStart, &slot->dataStart)
+		|| (strlen(entry->d_name) != nameLength)
+		|| strncasecmp(entry->d_name, name, nameLength)
+		|| (isDirectory && !(entry->entryData[DIR_ENTRY_attributes] & ATTRIB_DIR)))
+	{
+		// Stale, forget it and let the caller scan the directory
+		slot->partition = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static void _FAT_directory_cacheStore (PARTITION* partition, const DIR_ENTRY* entry, u32 dirCluster, const char* name, size_t nameLength) {
+	u32 nameHash = _FAT_directory_hashName (dirCluster, name, nameLength);
+	DIR_CACHE_ENTRY* slot = _FAT_directory_cacheSlot (nameHash);
+
+	slot->partition = partition;
+	slot->dirCluster = dirCluster;
+	slot->nameHash = nameHash;
+	slot->dataStart = entry->dataStart;
+}
+
+static void _FAT_directory_cacheRemove (PARTITION* partition, const DIR_ENTRY_POSITION* dataStart) {
+	int i;
+
+	for (i = 0; i < DIR_CACHE_SIZE; i++) {
+		if ((_FAT_directory_cache[i].partition == partition)
+			&& _FAT_directory_samePosition (&_FAT_directory_cache[i].dataStart, dataStart))
+		{
+			_FAT_directory_cache[i].partition = NULL;
+		}
+	}
+}
+
+static void _FAT_directory_indexFree (DIR_INDEX* index) {
+	if (index->names != NULL) {
+		_FAT_mem_free (index->names);
+	}
+	if (index->clusters != NULL) {
+		_FAT_mem_free (index->clusters);
+	}
+	memset (index, 0, sizeof(DIR_INDEX));
+}
+
+void _FAT_directory_invalidateCache (PARTITION* partition) {
+	int i;
+
+	for (i = 0; i < DIR_CACHE_SIZE; i++) {
+		if (_FAT_directory_cache[i].partition == partition) {
+			_FAT_directory_cache[i].partition = NULL;
+		}
+	}
+
+	for (i = 0; i < DIR_INDEX_COUNT; i++) {
+		if (_FAT_directory_index[i].partition == partition) {
+			_FAT_directory_indexFree (&_FAT_directory_index[i]);
+		}
+	}
+}
+
 bool _FAT_directory_entryFromPath (PARTITION* partition, DIR_ENTRY* entry, const char* path, const char* pathEnd) {
 	size_t dirnameLength;
 	const char* pathPosition;
@@ -549,8 +698,17 @@ bool _FAT_directory_entryFromPath (PARTITION* partition, DIR_ENTRY* entry, const
 		//	return false;
 		//}
 
-		// Look for the directory within the path
-		foundFile = _FAT_directory_getFirstEntry (partition, entry, dirCluster);
+		partition->stats.pathComponents++;
+
+		// Try the directory entry cache before scanning the directory
+		if (_FAT_directory_cacheFind (partition, entry, dirCluster, pathPosition, dirnameLength, nextPathPosition != NULL)) {
+			partition->stats.dentryHits++;
+			found = true;
+			foundFile = true;
+		} else {
+			// Look for the directory within the path
+			foundFile = _FAT_directory_getFirstEntry (partition, entry, dirCluster);
+		}
 
 		while (foundFile && !found && !notFound) {			// It hasn't already found the file
 			// Check if the filename matches
@@ -577,6 +735,8 @@ bool _FAT_directory_entryFromPath (PARTITION* partition, DIR_ENTRY* entry, const
 
 			if (!found) {
 				foundFile = _FAT_directory_getNextEntry (partition, entry);
+			} else {
+				_FAT_directory_cacheStore (partition, entry, dirCluster, pathPosition, dirnameLength);
 			}
 		}
 
@@ -614,6 +774,268 @@ bool _FAT_directory_entryFromPath (PARTITION* partition, DIR_ENTRY* entry, const
 	}
 }
 
+static u32 _FAT_directory_indexHash (const char* name) {
+	u32 hash = _FAT_directory_hashName (0, name, strlen (name));
+
+	// Keep clear of the empty and deleted markers
+	return (hash <= DIR_INDEX_DELETED) ? hash + 2 : hash;
+}
+
+static bool _FAT_directory_indexResize (DIR_INDEX* index) {
+	u32* oldNames = index->names;
+	u32 oldCapacity = index->nameCapacity;
+	u32 capacity, i, pos;
+
+	// Keep the table at most a quarter full after resizing, dropping deleted slots
+	for (capacity = DIR_INDEX_MIN_NAMES; capacity < (index->nameCount + 1) * 4; capacity *= 2) ;
+
+	index->names = (u32*) _FAT_mem_allocate (capacity * sizeof(u32));
+	if (index->names == NULL) {
+		index->names = oldNames;
+		return false;
+	}
+	memset (index->names, 0, capacity * sizeof(u32));
+	index->nameCapacity = capacity;
+	index->nameSlotsUsed = index->nameCount;
+
+	for (i = 0; i < oldCapacity; i++) {
+		if (oldNames[i] > DIR_INDEX_DELETED) {
+			for (pos = oldNames[i] & (capacity - 1); index->names[pos] != DIR_INDEX_EMPTY; pos = (pos + 1) & (capacity - 1)) ;
+			index->names[pos] = oldNames[i];
+		}
+	}
+
+	if (oldNames != NULL) {
+		_FAT_mem_free (oldNames);
+	}
+	return true;
+}
+
+static bool _FAT_directory_indexAddName (DIR_INDEX* index, const char* name) {
+	u32 hash = _FAT_directory_indexHash (name);
+	u32 pos;
+
+	if ((index->nameSlotsUsed + 1) * 2 > index->nameCapacity) {
+		if (!_FAT_directory_indexResize (index)) {
+			return false;
+		}
+	}
+
+	for (pos = hash & (index->nameCapacity - 1); index->names[pos] > DIR_INDEX_DELETED; pos = (pos + 1) & (index->nameCapacity - 1)) ;
+	if (index->names[pos] == DIR_INDEX_EMPTY) {
+		++ index->nameSlotsUsed;
+	}
+	index->names[pos] = hash;
+	++ index->nameCount;
+	return true;
+}
+
+static u32* _FAT_directory_indexFindName (DIR_INDEX* index, const char* name) {
+	u32 hash = _FAT_directory_indexHash (name);
+	u32 pos;
+
+	for (pos = hash & (index->nameCapacity - 1); index->names[pos] != DIR_INDEX_EMPTY; pos = (pos + 1) & (index->nameCapacity - 1)) {
+		if (index->names[pos] == hash) {
+			return &index->names[pos];
+		}
+	}
+	return NULL;
+}
+
+static void _FAT_directory_indexRemoveName (DIR_INDEX* index, const char* name) {
+	u32* slot = _FAT_directory_indexFindName (index, name);
+
+	if (slot != NULL) {
+		*slot = DIR_INDEX_DELETED;
+		-- index->nameCount;
+	}
+}
+
+static bool _FAT_directory_indexAddEntryNames (DIR_INDEX* index, const char* name, const u8* entryData) {
+	char alias[MAX_ALIAS_LENGTH];
+
+	_FAT_directory_entryGetAlias (entryData, alias);
+	return _FAT_directory_indexAddName (index, name) && _FAT_directory_indexAddName (index, alias);
+}
+
+static bool _FAT_directory_indexAddCluster (DIR_INDEX* index, u32 cluster) {
+	u32* clusters;
+
+	if ((index->clusterCount > 0) && (index->clusters[index->clusterCount - 1] == cluster)) {
+		return true;
+	}
+
+	if (index->clusterCount == index->clusterCapacity) {
+		clusters = (u32*) _FAT_mem_reallocate (index->clusters, (index->clusterCapacity + 16) * sizeof(u32));
+		if (clusters == NULL) {
+			return false;
+		}
+		index->clusters = clusters;
+		index->clusterCapacity += 16;
+	}
+
+	index->clusters[index->clusterCount++] = cluster;
+	return true;
+}
+
+static bool _FAT_directory_indexOwnsCluster (const DIR_INDEX* index, u32 cluster) {
+	u32 i;
+
+	for (i = 0; i < index->clusterCount; i++) {
+		if (index->clusters[i] == cluster) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void _FAT_directory_indexAddGap (DIR_INDEX* index, const DIR_ENTRY_POSITION* start, u32 length) {
+	// If the list is full the entries are simply not reused until the index is rebuilt
+	if (index->gapCount < DIR_INDEX_MAX_GAPS) {
+		index->gaps[index->gapCount].start = *start;
+		index->gaps[index->gapCount].length = length;
+		++ index->gapCount;
+	}
+}
+
+static DIR_INDEX* _FAT_directory_indexFind (PARTITION* partition, u32 dirCluster) {
+	int i;
+
+	for (i = 0; i < DIR_INDEX_COUNT; i++) {
+		if ((_FAT_directory_index[i].partition == partition) && (_FAT_directory_index[i].dirCluster == dirCluster)) {
+			_FAT_directory_index[i].lastUse = ++_FAT_directory_indexUse;
+			return &_FAT_directory_index[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+Return the index of dirCluster, building it if needed in place of the least
+recently used one. Returns NULL if there isn't enough memory.
+*/
+static DIR_INDEX* _FAT_directory_indexGet (PARTITION* partition, u32 dirCluster) {
+	DIR_INDEX* index;
+	DIR_ENTRY tempEntry;
+	DIR_ENTRY_POSITION position;
+	DIR_ENTRY_POSITION runStart;
+	u32 runLength;
+	u8 entryData[DIR_ENTRY_DATA_SIZE];
+	bool foundFile;
+	int i;
+
+	index = _FAT_directory_indexFind (partition, dirCluster);
+	if (index != NULL) {
+		return index;
+	}
+
+	index = &_FAT_directory_index[0];
+	for (i = 1; i < DIR_INDEX_COUNT; i++) {
+		if (_FAT_directory_index[i].lastUse < index->lastUse) {
+			index = &_FAT_directory_index[i];
+		}
+	}
+	_FAT_directory_indexFree (index);
+
+	if (!_FAT_directory_indexResize (index)) {
+		return NULL;
+	}
+
+	// Record the clusters, runs of deleted entries and end of the directory
+	position.cluster = dirCluster;
+	position.sector = 0;
+	position.offset = 0;
+	runStart = position;
+	runLength = 0;
+
+	do {
+		if (!_FAT_directory_indexAddCluster (index, position.cluster)) {
+			_FAT_directory_indexFree (index);
+			return NULL;
+		}
+		_FAT_cache_readPartialSector (partition->cache, entryData, _FAT_fat_clusterToSector(partition, position.cluster) + position.sector, position.offset * DIR_ENTRY_DATA_SIZE, DIR_ENTRY_DATA_SIZE);
+		if (entryData[0] == DIR_ENTRY_LAST) {
+			// Deleted entries right before the end are used as part of the end
+			index->end = (runLength > 0) ? runStart : position;
+			index->endKnown = true;
+		} else if (entryData[0] == DIR_ENTRY_FREE) {
+			if (runLength == 0) {
+				runStart = position;
+			}
+			++ runLength;
+		} else if (runLength > 0) {
+			_FAT_directory_indexAddGap (index, &runStart, runLength);
+			runLength = 0;
+		}
+	} while (!index->endKnown && _FAT_directory_incrementDirEntryPosition (partition, &position, false));
+
+	// Record every name and alias
+	foundFile = _FAT_directory_getFirstEntry (partition, &tempEntry, dirCluster);
+	while (foundFile) {
+		if (!_FAT_directory_indexAddEntryNames (index, tempEntry.d_name, tempEntry.entryData)) {
+			_FAT_directory_indexFree (index);
+			return NULL;
+		}
+		foundFile = _FAT_directory_getNextEntry (partition, &tempEntry);
+	}
+
+	index->partition = partition;
+	index->dirCluster = dirCluster;
+	index->lastUse = ++_FAT_directory_indexUse;
+	return index;
+}
+
+/*
+Take room for size entries from the index instead of scanning the directory,
+filling in dataStart and dataEnd the same way _FAT_directory_findEntryGap does.
+*/
+static bool _FAT_directory_indexTakeGap (PARTITION* partition, DIR_INDEX* index, DIR_ENTRY* entry, u32 size) {
+	DIR_ENTRY_POSITION gapEnd;
+	u8 entryData[DIR_ENTRY_DATA_SIZE];
+	u32 i, remain;
+
+	for (i = 0; i < index->gapCount; i++) {
+		if (index->gaps[i].length >= size) {
+			gapEnd = index->gaps[i].start;
+			for (remain = size - 1; remain > 0; --remain) {
+				if (!_FAT_directory_incrementDirEntryPosition (partition, &gapEnd, false)) {
+					return false;
+				}
+			}
+			entry->dataStart = index->gaps[i].start;
+			entry->dataEnd = gapEnd;
+
+			if (index->gaps[i].length > size) {
+				if (!_FAT_directory_incrementDirEntryPosition (partition, &gapEnd, false)) {
+					return false;
+				}
+				index->gaps[i].start = gapEnd;
+				index->gaps[i].length -= size;
+			} else {
+				index->gaps[i] = index->gaps[--index->gapCount];
+			}
+			return true;
+		}
+	}
+
+	// Append at the end of the directory, moving the end marker along
+	memset (entryData, DIR_ENTRY_LAST, DIR_ENTRY_DATA_SIZE);
+	entry->dataStart = index->end;
+	gapEnd = index->end;
+	for (remain = size; remain > 0; --remain) {
+		entry->dataEnd = gapEnd;
+		if (!_FAT_directory_incrementDirEntryPosition (partition, &gapEnd, true)
+			|| !_FAT_directory_indexAddCluster (index, gapEnd.cluster))
+		{
+			return false;
+		}
+		_FAT_cache_writePartialSector (partition->cache, entryData, _FAT_fat_clusterToSector(partition, gapEnd.cluster) + gapEnd.sector, gapEnd.offset * DIR_ENTRY_DATA_SIZE, DIR_ENTRY_DATA_SIZE);
+	}
+	index->end = gapEnd;
+
+	return true;
+}
+
 bool _FAT_directory_removeEntry (PARTITION* partition, DIR_ENTRY* entry) {
 	DIR_ENTRY_POSITION entryStart;
 	DIR_ENTRY_POSITION entryEnd;
@@ -621,13 +1043,19 @@ bool _FAT_directory_removeEntry (PARTITION* partition, DIR_ENTRY* entry) {
 	entryEnd = entry->dataEnd;
 	bool entryStillValid;
 	bool finished;
+	u32 entryCount;
+	DIR_INDEX* index;
+	char alias[MAX_ALIAS_LENGTH];
+	int i;
 
 	u8 entryData[DIR_ENTRY_DATA_SIZE];
 
+	_FAT_directory_cacheRemove (partition, &entry->dataStart);
+
 	// Create an empty directory entry to overwrite the old ones with
-	for ( entryStillValid = true, finished = false;
+	for ( entryStillValid = true, finished = false, entryCount = 0;
 		entryStillValid && !finished;
-		entryStillValid = _FAT_directory_incrementDirEntryPosition (partition, &entryStart, false))
+		entryStillValid = _FAT_directory_incrementDirEntryPosition (partition, &entryStart, false), ++ entryCount)
 	{
 		_FAT_cache_readPartialSector (partition->cache, entryData, _FAT_fat_clusterToSector(partition, entryStart.cluster) + entryStart.sector, entryStart.offset * DIR_ENTRY_DATA_SIZE, DIR_ENTRY_DATA_SIZE);
 		entryData[0] = DIR_ENTRY_FREE;
@@ -637,6 +1065,26 @@ bool _FAT_directory_removeEntry (PARTITION* partition, DIR_ENTRY* entry) {
 		}
 	}
 
+	for (i = 0; i < DIR_INDEX_COUNT; i++) {
+		index = &_FAT_directory_index[i];
+		if (index->partition != partition) {
+			continue;
+		}
+		if ((entry->entryData[DIR_ENTRY_attributes] & ATTRIB_DIR)
+			&& (index->dirCluster == _FAT_directory_entryGetCluster (entry->entryData)))
+		{
+			// The directory itself is going away
+			_FAT_directory_indexFree (index);
+		} else if (_FAT_directory_indexOwnsCluster (index, entry->dataStart.cluster)) {
+			_FAT_directory_indexRemoveName (index, entry->d_name);
+			_FAT_directory_entryGetAlias (entry->entryData, alias);
+			_FAT_directory_indexRemoveName (index, alias);
+			if (entryStillValid) {
+				_FAT_directory_indexAddGap (index, &entry->dataStart, entryCount);
+			}
+		}
+	}
+
 	if (!entryStillValid) {
 		return false;
 	}
@@ -654,6 +1102,17 @@ static bool _FAT_directory_findEntryGap (PARTITION* partition, DIR_ENTRY* entry,
 
 	bool endOfDirectory, entryStillValid;
 
+	DIR_INDEX* index;
+
+	index = _FAT_directory_indexFind (partition, dirCluster);
+	if ((index != NULL) && index->endKnown) {
+		if (_FAT_directory_indexTakeGap (partition, index, entry, size)) {
+			return true;
+		}
+		// Something didn't add up, forget the index and do it the slow way
+		_FAT_directory_indexFree (index);
+	}
+
 	// Scan Dir for free entry
 	gapEnd.offset = 0;
 	gapEnd.sector = 0;
@@ -721,6 +1180,7 @@ static bool _FAT_directory_entryExists (PARTITION* partition, const char* name,
 	//char alias[MAX_ALIAS_LENGTH];
 	u32 dirnameLength;
 	//u16 unicodeName[MAX_FILENAME_LENGTH];
+	DIR_INDEX* index;
 
 	dirnameLength = strnlen(name, MAX_FILENAME_LENGTH);
 
@@ -728,6 +1188,12 @@ static bool _FAT_directory_entryExists (PARTITION* partition, const char* name,
 		return false;
 	}
 
+	// Names that aren't in the directory's index can't be in the directory
+	index = _FAT_directory_indexFind (partition, dirCluster);
+	if ((index != NULL) && (_FAT_directory_indexFindName (index, name) == NULL)) {
+		return false;
+	}
+
 	//_FAT_utf8_to_unicode16( name, unicodeName );
 
 	// Make sure the entry doesn't already exist
@@ -757,18 +1223,24 @@ static bool _FAT_directory_entryExists (PARTITION* partition, const char* name,
 }
 
 //a fix for checking if a short file name is already in use.
+//name is an alias, so it fits in MAX_ALIAS_LENGTH with its terminator.
 static bool _FAT_directory_entryExistsSFN (PARTITION* partition, const char* name, u32 dirCluster) {
 	DIR_ENTRY tempEntry;
 	bool foundFile;
 	char alias[MAX_ALIAS_LENGTH];
 	u32 dirnameLength;
+	DIR_INDEX* index;
 
-	dirnameLength = strnlen(name, MAX_FILENAME_LENGTH);
+	dirnameLength = strnlen(name, MAX_ALIAS_LENGTH);
 
-	if (dirnameLength >= MAX_FILENAME_LENGTH) {
+	if (dirnameLength >= MAX_ALIAS_LENGTH) {
 		return false;
 	}
 
+	index = _FAT_directory_indexFind (partition, dirCluster);
+	if ((index != NULL) && (_FAT_directory_indexFindName (index, name) == NULL)) {
+		return false;
+	}
 
 	// Make sure the entry doesn't already exist
 	foundFile = _FAT_directory_getFirstEntry (partition, &tempEntry, dirCluster);
@@ -798,6 +1270,7 @@ bool _FAT_directory_addEntry (PARTITION* partition, DIR_ENTRY* entry, u32 dirClu
 	u8 aliasCheckSum = 0;
 	char alias [MAX_ALIAS_LENGTH];
 	u16 unicodeFilename[256];
+	DIR_INDEX* index;
 
 	// Make sure the filename is not 0 length
 	if (strnlen (entry->d_name, MAX_FILENAME_LENGTH) < 1) {
@@ -822,6 +1295,9 @@ bool _FAT_directory_addEntry (PARTITION* partition, DIR_ENTRY* entry, u32 dirClu
 	i = strlen (entry->d_name);
 	memset (entry->d_name + i, '\0', MAX_FILENAME_LENGTH - i);
 
+	// Index the directory on the first insertion, so the scans below can be skipped
+	_FAT_directory_indexGet (partition, dirCluster);
+
 	// Make sure the entry doesn't already exist
 	if (_FAT_directory_entryExists (partition, entry->d_name, dirCluster)) {
 		return false;
@@ -863,7 +1339,7 @@ bool _FAT_directory_addEntry (PARTITION* partition, DIR_ENTRY* entry, u32 dirClu
 			++ j;
 		}
 		// Short filename
-		strupr (entry->entryData);
+		strupr ((char*)entry->entryData);
 	}else {
 		// Long filename needed
 		//memset( entry->unicodeFilename, 0, 512 );
@@ -894,7 +1370,7 @@ bool _FAT_directory_addEntry (PARTITION* partition, DIR_ENTRY* entry, u32 dirClu
 		if (tmpCharPtr != NULL) {
 			alias[8] = '.';
 			// Copy extension
-			while ((tmpCharPtr != '\0') && (j < 12)) {
+			while ((tmpCharPtr[0] != '\0') && (j < 12)) {
 				alias[j] = tmpCharPtr[0];
 				++ tmpCharPtr;
 				++ j;
@@ -980,6 +1456,14 @@ bool _FAT_directory_addEntry (PARTITION* partition, DIR_ENTRY* entry, u32 dirClu
 		}
 	}
 
+	index = _FAT_directory_indexFind (partition, dirCluster);
+	if ((index != NULL) && !_FAT_directory_indexAddEntryNames (index, entry->d_name, entry->entryData)) {
+		_FAT_directory_indexFree (index);
+	}
+
+	// A new file or directory is usually opened by name straight away
+	_FAT_directory_cacheStore (partition, entry, dirCluster, entry->d_name, strlen (entry->d_name));
+
 	return true;
 }
 
@@ -1028,7 +1512,7 @@ void _FAT_directory_entryStat (PARTITION* partition, DIR_ENTRY* entry, struct st
 		u8array_to_u16 (entry->entryData, DIR_ENTRY_cDate)
 	);
 	//st->st_spare3 = 0;
-	st->st_blksize = BYTES_PER_READ;				// Prefered file I/O block size
+	st->st_blksize = partition->bytesPerCluster;	// Prefered file I/O block size, whole clusters are transferred directly
 	st->st_blocks = (st->st_size + BYTES_PER_READ - 1) / BYTES_PER_READ;	// File size in blocks
 //	st->st_spare4[0] = 0;
 //	st->st_spare4[1] = 0;
@@ -1,48 +1,19 @@
 //fat_misc.c
 //v1.0
 
+#include <stdio.h>
+#include <string.h>
 #include "fat_misc.h"
 #include "fs_api.h"
+#include "file_allocation_table.h"
 
 static unsigned int _usedSecNums;
 
-static int strFindFromEnd( char *str,char strValue  )
-{
-	int pos = 0,i = 0,strNum = 0;
-	while(1)
-	{
-		if( (*str)!=0 )
-		{
-			strNum++;
-			str++;
-		}
-		else
-		{
-			break;
-		}
-	}
-	pos = strNum;
-	for( i=0;i<strNum;i++ )
-	{
-		str--;
-		pos--;
-		if( (*str) == strValue||(*str) == ':' )
-		{
-			return pos;
-		}
-		if( (*str)== 0 )
-		{
-			return -1;
-		}
-	}
-	return -1; 
-}
-
 int getDirSize( const char * path, int includeSubdirs, unsigned int * dirSize )
 {
     char dirPath[MAX_FILENAME_LENGTH];
 	unsigned int size = 0;
-    if( "" == path ){
+    if( path == NULL || *path == '\0' ){
         return false;
     }
 
@@ -80,10 +51,12 @@ int getDirSize( const char * path, int includeSubdirs, unsigned int * dirSize )
             unsigned int subDirSize = 0;
 			char dirPathBuffer[MAX_FILENAME_LENGTH];
 
+            if( strlen(dirPath) + strlen(filename) >= MAX_FILENAME_LENGTH )
+                continue;
             memset( dirPathBuffer,0,MAX_FILENAME_LENGTH );
             strcpy( dirPathBuffer,dirPath );
             memset( dirPath,0,MAX_FILENAME_LENGTH );
-            sprintf( dirPath,"%s%s",dirPathBuffer,filename );
+            snprintf( dirPath,MAX_FILENAME_LENGTH,"%s%s",dirPathBuffer,filename );
             int succ = getDirSize( dirPath, includeSubdirs, &subDirSize );
             if( succ ) {
                 size += (subDirSize+511)/512;
@@ -126,6 +99,19 @@ int fat_getDiskSpaceInfo( char * diskName, unsigned int * total, unsigned int *
 		return -1;
     if( !fat_getDiskTotalSpace(diskName, total) )
 		return -1;
+
+	// Count the free clusters in the FAT, which is much faster than adding up
+	// the size of every file on the disk
+	PARTITION * diskPartition = _FAT_partition_getPartitionFromPath( diskName );
+	unsigned int numberFree = _FAT_fat_freeClusterCount( diskPartition );
+	if( numberFree != CLUSTER_COUNT_UNKNOWN ){
+		*freeSpace = numberFree * diskPartition->sectorsPerCluster;
+		if( *freeSpace > *total )
+			*freeSpace = *total;
+		*used = *total - *freeSpace;
+		return 0;
+	}
+
 	if( !getDirSize(diskName, true, used) )
 		return -1;
 
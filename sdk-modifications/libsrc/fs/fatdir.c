@@ -103,7 +103,6 @@ int _FAT_stat_r (struct _reent *r, const char *path, struct stat *st) {
 int _FAT_getshortname_r (struct _reent *r, const char *name, char *outName) {
 	PARTITION* partition = NULL;
 	DIR_ENTRY DirEntry;
-	u32 dirCluster;
 
 	// Get the partition this directory is on
 	partition = _FAT_partition_getPartitionFromPath (name);
@@ -128,7 +127,7 @@ int _FAT_getshortname_r (struct _reent *r, const char *name, char *outName) {
 		return 1;
 	}
 
-	strcpy(outName, DirEntry.entryData);
+	strcpy(outName, (char*)DirEntry.entryData);
 	return 1;
 }
 
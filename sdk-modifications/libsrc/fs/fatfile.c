@@ -54,6 +54,263 @@
 #include "file_allocation_table.h"
 #include "bit_ops.h"
 #include "filetime.h"
+#include "mem_allocate.h"
+
+#define FILE_EXTENTS_INITIAL 8
+
+/*
+Forget the extents of a file, so that they are rebuilt when next needed
+*/
+static void _FAT_file_freeExtents (FILE_STRUCT* file) {
+	if (file->extents != NULL) {
+		_FAT_mem_free (file->extents);
+	}
+	file->extents = NULL;
+	file->extentCount = 0;
+	file->extentCapacity = 0;
+	file->extentCursor = 0;
+}
+
+/*
+Add length clusters starting at cluster to the end of the extents of a file,
+growing the last extent if they follow it on disc
+*/
+static bool _FAT_file_appendExtent (FILE_STRUCT* file, u32 cluster, u32 length) {
+	FILE_EXTENT* last;
+	FILE_EXTENT* extents;
+	u32 index = 0;
+
+	if (file->extentCount > 0) {
+		last = &file->extents[file->extentCount - 1];
+		if (cluster == last->cluster + last->length) {
+			last->length += length;
+			return true;
+		}
+		index = last->index + last->length;
+	}
+
+	if (file->extentCount >= file->extentCapacity) {
+		extents = (FILE_EXTENT*) _FAT_mem_reallocate (file->extents,
+			sizeof(FILE_EXTENT) * file->extentCapacity * 2);
+		if (extents == NULL) {
+			return false;
+		}
+		file->extents = extents;
+		file->extentCapacity *= 2;
+	}
+
+	file->extents[file->extentCount].cluster = cluster;
+	file->extents[file->extentCount].index = index;
+	file->extents[file->extentCount].length = length;
+	file->extentCount++;
+	return true;
+}
+
+/*
+Walk the cluster chain of a file once and record it as extents.
+Return false if the file has to do without them.
+*/
+static bool _FAT_file_buildExtents (FILE_STRUCT* file) {
+	u32 cluster;
+
+	if (file->extents != NULL) {
+		return true;
+	}
+	if (file->extentsFailed || (file->startCluster < CLUSTER_FIRST)) {
+		return false;
+	}
+
+	file->extents = (FILE_EXTENT*) _FAT_mem_allocate (sizeof(FILE_EXTENT) * FILE_EXTENTS_INITIAL);
+	if (file->extents == NULL) {
+		file->extentsFailed = true;
+		return false;
+	}
+	file->extentCapacity = FILE_EXTENTS_INITIAL;
+
+	cluster = file->startCluster;
+	while ((cluster != CLUSTER_FREE) && (cluster != CLUSTER_EOF)) {
+		if (!_FAT_file_appendExtent (file, cluster, 1)) {
+			_FAT_file_freeExtents (file);
+			file->extentsFailed = true;
+			return false;
+		}
+		cluster = _FAT_fat_nextCluster (file->partition, cluster);
+	}
+	return true;
+}
+
+/*
+Find the extent holding cluster, starting with the one used last, since
+files are mostly read and written in order.
+Return file->extentCount if the cluster is not part of the file.
+*/
+static u32 _FAT_file_findExtent (FILE_STRUCT* file, u32 cluster) {
+	FILE_EXTENT* extents = file->extents;
+	u32 i = file->extentCursor;
+
+	if (i >= file->extentCount) {
+		i = 0;
+	}
+	if ((cluster - extents[i].cluster) < extents[i].length) {
+		return i;
+	}
+	if ((i + 1 < file->extentCount) && ((cluster - extents[i + 1].cluster) < extents[i + 1].length)) {
+		file->extentCursor = i + 1;
+		return i + 1;
+	}
+
+	for (i = 0; i < file->extentCount; i++) {
+		if ((cluster - extents[i].cluster) < extents[i].length) {
+			file->extentCursor = i;
+			return i;
+		}
+	}
+	return file->extentCount;
+}
+
+/*
+Gets the cluster linked from cluster in the file, without going through
+the FAT when the extents are known
+*/
+static u32 _FAT_file_nextCluster (FILE_STRUCT* file, u32 cluster) {
+	FILE_EXTENT* extent;
+	u32 i;
+
+	if (!_FAT_file_buildExtents (file)) {
+		return _FAT_fat_nextCluster (file->partition, cluster);
+	}
+
+	i = _FAT_file_findExtent (file, cluster);
+	if (i >= file->extentCount) {
+		return _FAT_fat_nextCluster (file->partition, cluster);
+	}
+
+	extent = &file->extents[i];
+	if (cluster + 1 < extent->cluster + extent->length) {
+		return cluster + 1;
+	}
+	if (i + 1 < file->extentCount) {
+		return file->extents[i + 1].cluster;
+	}
+	return CLUSTER_EOF;
+}
+
+/*
+Count the clusters, starting with cluster and up to maxClusters, that follow
+each other both in the file and on disc, so that they can be transferred
+in one command. Return at least 1.
+*/
+static u32 _FAT_file_runLength (FILE_STRUCT* file, u32 cluster, u32 maxClusters) {
+	FILE_EXTENT* extent;
+	u32 i, length;
+
+	if ((maxClusters <= 1) || !_FAT_file_buildExtents (file)) {
+		return 1;
+	}
+
+	i = _FAT_file_findExtent (file, cluster);
+	if (i >= file->extentCount) {
+		return 1;
+	}
+
+	extent = &file->extents[i];
+	length = extent->cluster + extent->length - cluster;
+	return (length < maxClusters) ? length : maxClusters;
+}
+
+/*
+Get the last cluster of the file
+*/
+static u32 _FAT_file_lastCluster (FILE_STRUCT* file) {
+	FILE_EXTENT* last;
+
+	if (!_FAT_file_buildExtents (file) || (file->extentCount == 0)) {
+		return _FAT_fat_lastCluster (file->partition, file->startCluster);
+	}
+
+	last = &file->extents[file->extentCount - 1];
+	return last->cluster + last->length - 1;
+}
+
+/*
+Get the cluster at clusterIndex clusters from the start of the file. If the
+file is shorter, return its last cluster and set *missing to the number of
+clusters it lacks, otherwise set *missing to 0.
+*/
+static u32 _FAT_file_clusterAt (FILE_STRUCT* file, u32 clusterIndex, u32* missing) {
+	FILE_EXTENT* extents = file->extents;
+	FILE_EXTENT* last = &extents[file->extentCount - 1];
+	u32 low, high, middle;
+
+	if (clusterIndex >= last->index + last->length) {
+		*missing = clusterIndex - (last->index + last->length - 1);
+		return last->cluster + last->length - 1;
+	}
+
+	// Binary search for the last extent starting at or before clusterIndex
+	low = 0;
+	high = file->extentCount - 1;
+	while (low < high) {
+		middle = (low + high + 1) / 2;
+		if (extents[middle].index <= clusterIndex) {
+			low = middle;
+		} else {
+			high = middle - 1;
+		}
+	}
+
+	file->extentCursor = low;
+	*missing = 0;
+	return extents[low].cluster + (clusterIndex - extents[low].index);
+}
+
+/*
+Get the cluster holding the last byte of the file, or its first cluster if
+it is empty. It is the last cluster unless some were reserved past the end.
+*/
+static u32 _FAT_file_endCluster (FILE_STRUCT* file) {
+	u32 clusterIndex = 0;
+	u32 cluster, nextCluster, missing;
+
+	if (!file->preallocated) {
+		return _FAT_file_lastCluster (file);
+	}
+
+	if (file->filesize > 0) {
+		clusterIndex = (file->filesize - 1) / file->partition->bytesPerCluster;
+	}
+	if (_FAT_file_buildExtents (file)) {
+		return _FAT_file_clusterAt (file, clusterIndex, &missing);
+	}
+
+	cluster = file->startCluster;
+	while (clusterIndex > 0) {
+		nextCluster = _FAT_fat_nextCluster (file->partition, cluster);
+		if ((nextCluster == CLUSTER_FREE) || (nextCluster == CLUSTER_EOF)) {
+			break;
+		}
+		cluster = nextCluster;
+		clusterIndex--;
+	}
+	return cluster;
+}
+
+/*
+Link a free cluster to the end of the file, keeping its extents up to date
+*/
+static u32 _FAT_file_linkFreeCluster (FILE_STRUCT* file, u32 cluster) {
+	u32 newCluster = _FAT_fat_linkFreeCluster (file->partition, cluster);
+
+	if ((newCluster != CLUSTER_FREE) && (file->extents != NULL)) {
+		if ((file->extentCount == 0) || (cluster != _FAT_file_lastCluster (file))
+			|| !_FAT_file_appendExtent (file, newCluster, 1))
+		{
+			// The chain changed in a way the extents can't follow, start over
+			_FAT_file_freeExtents (file);
+		}
+	}
+	return newCluster;
+}
 
 
 int _FAT_open_r (struct _reent *r, void *fileStruct, const char *path, int flags) {
@@ -190,6 +447,14 @@ int _FAT_open_r (struct _reent *r, void *fileStruct, const char *path, int flags
 	file->partition = partition;
 	file->startCluster = _FAT_directory_entryGetCluster (dirEntry.entryData);
 
+	// The cluster chain is only walked once it is needed
+	file->extents = NULL;
+	file->extentCount = 0;
+	file->extentCapacity = 0;
+	file->extentCursor = 0;
+	file->extentsFailed = false;
+	file->preallocated = false;
+
 	// Truncate the file if requested
 	if ((flags & O_TRUNC) && file->write && (file->startCluster != 0)) {
 		_FAT_fat_clearLinks (partition, file->startCluster);
@@ -215,7 +480,7 @@ int _FAT_open_r (struct _reent *r, void *fileStruct, const char *path, int flags
 
 	if (flags & O_APPEND) {
 		file->append = true;
-		file->appendPosition.cluster = _FAT_fat_lastCluster (partition, file->startCluster);
+		file->appendPosition.cluster = _FAT_file_lastCluster (file);
 		file->appendPosition.sector = (file->filesize % partition->bytesPerCluster) / BYTES_PER_READ;
 		file->appendPosition.byte = file->filesize % BYTES_PER_READ;
 
@@ -246,6 +511,12 @@ int _FAT_close_r (struct _reent *r, int fd) {
 		return -1;
 	}
 	if (file->write) {
+		// Give back the clusters reserved past the end of the file
+		if (file->preallocated) {
+			_FAT_fat_trimLinks (file->partition, _FAT_file_endCluster (file));
+			file->preallocated = false;
+		}
+
 		// Load the old entry
 		_FAT_cache_readPartialSector (file->partition->cache, dirEntryData, 
 			_FAT_fat_clusterToSector(file->partition, file->dirEntryEnd.cluster) + file->dirEntryEnd.sector,
@@ -271,12 +542,17 @@ int _FAT_close_r (struct _reent *r, int fd) {
 			_FAT_fat_clusterToSector(file->partition, file->dirEntryEnd.cluster) + file->dirEntryEnd.sector,
 			file->dirEntryEnd.offset * DIR_ENTRY_DATA_SIZE, DIR_ENTRY_DATA_SIZE);
 
+		// Keep the free cluster count on disc up to date
+		_FAT_partition_writeFSInfo (file->partition);
+
 		// Flush any sectors in the disc cache
 		if (!_FAT_cache_flush(file->partition->cache)) {
 			r->_errno = EIO;
 			return -1;
 		}
 	}
+
+	_FAT_file_freeExtents (file);
 	
 	file->inUse = false;		
 	file->partition->openFileCount -= 1;
@@ -324,7 +600,7 @@ int _FAT_read_r (struct _reent *r, int fd, char *ptr, int len) {
 
 	// Move onto next cluster if needed
 	if (position.sector >= partition->sectorsPerCluster) {
-		tempNextCluster = _FAT_fat_nextCluster(partition, position.cluster);
+		tempNextCluster = _FAT_file_nextCluster(file, position.cluster);
 		if (tempNextCluster == CLUSTER_EOF) {
 			position.sector = partition->sectorsPerCluster;
 		} else if (tempNextCluster == CLUSTER_FREE) {
@@ -367,7 +643,7 @@ int _FAT_read_r (struct _reent *r, int fd, char *ptr, int len) {
 			tempVar = partition->sectorsPerCluster - position.sector;
 
 		// read several sectors from disk
-		_FAT_disc_readSectors (partition->disc, _FAT_fat_clusterToSector (partition, position.cluster) + position.sector,
+		_FAT_cache_readDirect (partition->cache, _FAT_fat_clusterToSector (partition, position.cluster) + position.sector,
 			tempVar, ptr);
 
 		ptr += tempVar * BYTES_PER_READ;
@@ -378,7 +654,7 @@ int _FAT_read_r (struct _reent *r, int fd, char *ptr, int len) {
 	// Move onto next cluster
 	// It should get to here without reading anything if a cluster is due to be allocated
 	if ((remain>0) && (position.sector >= partition->sectorsPerCluster)) {
-		tempNextCluster = _FAT_fat_nextCluster(partition, position.cluster);
+		tempNextCluster = _FAT_file_nextCluster(file, position.cluster);
 		if (tempNextCluster == CLUSTER_EOF) {
 			position.sector = partition->sectorsPerCluster;
 		} else if (tempNextCluster == CLUSTER_FREE) {
@@ -390,14 +666,17 @@ int _FAT_read_r (struct _reent *r, int fd, char *ptr, int len) {
 		}
 	}
 
-	// Read in whole clusters
+	// Read in whole clusters, as many at once as follow each other on disc
 	while ((remain >= partition->bytesPerCluster) && flagNoError) {
-		_FAT_disc_readSectors (partition->disc, _FAT_fat_clusterToSector (partition, position.cluster), partition->sectorsPerCluster, ptr);
-		ptr += partition->bytesPerCluster;
-		remain -= partition->bytesPerCluster;
+		tempVar = _FAT_file_runLength (file, position.cluster, remain / partition->bytesPerCluster);
+		_FAT_cache_readDirect (partition->cache, _FAT_fat_clusterToSector (partition, position.cluster),
+			tempVar * partition->sectorsPerCluster, ptr);
+		ptr += tempVar * partition->bytesPerCluster;
+		remain -= tempVar * partition->bytesPerCluster;
+		position.cluster += tempVar - 1;
 
 		// Advance to next cluster
-		tempNextCluster = _FAT_fat_nextCluster(partition, position.cluster);
+		tempNextCluster = _FAT_file_nextCluster(file, position.cluster);
 		if ((remain == 0) && (tempNextCluster == CLUSTER_EOF)) {
 			position.sector = partition->sectorsPerCluster;
 		} else if (tempNextCluster == CLUSTER_FREE) {
@@ -412,7 +691,7 @@ int _FAT_read_r (struct _reent *r, int fd, char *ptr, int len) {
 	// Read remaining sectors
 	tempVar = remain / BYTES_PER_READ; // Number of sectors left
 	if ((tempVar > 0) && flagNoError) {
-		_FAT_disc_readSectors (partition->disc, _FAT_fat_clusterToSector (partition, position.cluster),
+		_FAT_cache_readDirect (partition->cache, _FAT_fat_clusterToSector (partition, position.cluster),
 			tempVar, ptr);
 		ptr += tempVar * BYTES_PER_READ;
 		remain -= tempVar * BYTES_PER_READ;
@@ -462,7 +741,7 @@ static bool file_extend_r (struct _reent *r, FILE_STRUCT* file) {
 	position.sector = partCluster / BYTES_PER_READ;
 
 	//This function index the last Cluster currently used, when file size equal Cluster size, will cause problem
-	position.cluster = _FAT_fat_lastCluster (partition, file->startCluster);
+	position.cluster = _FAT_file_endCluster (file);
 
 	remain = file->currentPosition - file->filesize;
 
@@ -472,10 +751,10 @@ static bool file_extend_r (struct _reent *r, FILE_STRUCT* file) {
 		//position.sector == partition->sectorsPerCluster means, the last cluster all used
 		//move to next cluster
 		position.sector = 0;
-		tempNextCluster = _FAT_fat_nextCluster(partition, position.cluster);
+		tempNextCluster = _FAT_file_nextCluster(file, position.cluster);
 		if ((tempNextCluster == CLUSTER_EOF) || (tempNextCluster == CLUSTER_FREE)) {
 			// Ran out of clusters so get a new one
-			tempNextCluster = _FAT_fat_linkFreeCluster(partition, position.cluster);
+			tempNextCluster = _FAT_file_linkFreeCluster(file, position.cluster);
 		}
 		if (tempNextCluster == CLUSTER_FREE) {
 			// Couldn't get a cluster, so abort
@@ -504,10 +783,10 @@ static bool file_extend_r (struct _reent *r, FILE_STRUCT* file) {
 		while (remain >= BYTES_PER_READ) {
 			if (position.sector >= partition->sectorsPerCluster) {
 				position.sector = 0;
-				tempNextCluster = _FAT_fat_nextCluster(partition, position.cluster);
+				tempNextCluster = _FAT_file_nextCluster(file, position.cluster);
 				if ((tempNextCluster == CLUSTER_EOF) || (tempNextCluster == CLUSTER_FREE)) {
 					// Ran out of clusters so get a new one
-					tempNextCluster = _FAT_fat_linkFreeCluster(partition, position.cluster);
+					tempNextCluster = _FAT_file_linkFreeCluster(file, position.cluster);
 				} 
 				if (tempNextCluster == CLUSTER_FREE) {
 					// Couldn't get a cluster, so abort
@@ -518,11 +797,12 @@ static bool file_extend_r (struct _reent *r, FILE_STRUCT* file) {
 				}
 			}
 
-			_FAT_disc_writeSectors (partition->disc,  
+			_FAT_cache_writeDirect (partition->cache,  
+				_FAT_fat_clusterToSector (partition, position.cluster) + position.sector, 1, zeroBuffer);
+			//cancel the dirty state of cached sector. The sector was not allocated before, but
+			//it may share a multi-sector cache page with sectors that were
+			_FAT_cache_writePartialSector_check(cache,  
 				_FAT_fat_clusterToSector (partition, position.cluster) + position.sector, 1, zeroBuffer);
-			//cancel the dirty state of cahced sctor, not necessary here, the sector haven't allocated yet
-			//_FAT_cache_writePartialSector_check(cache,  
-			//	_FAT_fat_clusterToSector (partition, position.cluster) + position.sector, 1, zeroBuffer);
 
 			remain -= BYTES_PER_READ;
 			position.sector ++;
@@ -530,10 +810,10 @@ static bool file_extend_r (struct _reent *r, FILE_STRUCT* file) {
 
 		if (position.sector >= partition->sectorsPerCluster) {
 			position.sector = 0;
-			tempNextCluster = _FAT_fat_nextCluster(partition, position.cluster);
+			tempNextCluster = _FAT_file_nextCluster(file, position.cluster);
 			if ((tempNextCluster == CLUSTER_EOF) || (tempNextCluster == CLUSTER_FREE)) {
 				// Ran out of clusters so get a new one
-				tempNextCluster = _FAT_fat_linkFreeCluster(partition, position.cluster);
+				tempNextCluster = _FAT_file_linkFreeCluster(file, position.cluster);
 			} 
 			if (tempNextCluster == CLUSTER_FREE) {
 				// Couldn't get a cluster, so abort
@@ -607,10 +887,10 @@ int _FAT_write_r (struct _reent *r,int fd, const char *ptr, int len) {
 	// Move onto next cluster if needed
 	if (position.sector >= partition->sectorsPerCluster) {
 		position.sector = 0;
-		tempNextCluster = _FAT_fat_nextCluster(partition, position.cluster);
+		tempNextCluster = _FAT_file_nextCluster(file, position.cluster);
 		if ((tempNextCluster == CLUSTER_EOF) || (tempNextCluster == CLUSTER_FREE)) {
 			// Ran out of clusters so get a new one
-			tempNextCluster = _FAT_fat_linkFreeCluster(partition, position.cluster);
+			tempNextCluster = _FAT_file_linkFreeCluster(file, position.cluster);
 		} 
 		if (tempNextCluster == CLUSTER_FREE) {
 			// Couldn't get a cluster, so abort
@@ -654,7 +934,7 @@ int _FAT_write_r (struct _reent *r,int fd, const char *ptr, int len) {
 			tempVar = partition->sectorsPerCluster - position.sector;
 
 		// write several sectors to disk
-		_FAT_disc_writeSectors (partition->disc, 
+		_FAT_cache_writeDirect (partition->cache, 
 			_FAT_fat_clusterToSector (partition, position.cluster) + position.sector, tempVar, ptr);
 		//cancel the dirty state of cached sctor
 		_FAT_cache_writePartialSector_check(cache, 
@@ -668,10 +948,10 @@ int _FAT_write_r (struct _reent *r,int fd, const char *ptr, int len) {
 	// Move onto next cluster if needed
 	if (flagNoError && (position.sector >= partition->sectorsPerCluster) && (remain > 0)) {
 		position.sector = 0;
-		tempNextCluster = _FAT_fat_nextCluster(partition, position.cluster);
+		tempNextCluster = _FAT_file_nextCluster(file, position.cluster);
 		if ((tempNextCluster == CLUSTER_EOF) || (tempNextCluster == CLUSTER_FREE)) {
 			// Ran out of clusters so get a new one
-			tempNextCluster = _FAT_fat_linkFreeCluster(partition, position.cluster);
+			tempNextCluster = _FAT_file_linkFreeCluster(file, position.cluster);
 		}
 		if (tempNextCluster == CLUSTER_FREE) {
 			// Couldn't get a cluster, so abort
@@ -682,21 +962,23 @@ int _FAT_write_r (struct _reent *r,int fd, const char *ptr, int len) {
 		}
 	}
 
-	// Write whole clusters
+	// Write whole clusters, as many at once as are already allocated one after the other
 	while ((remain >= partition->bytesPerCluster) && flagNoError) {
-		_FAT_disc_writeSectors (partition->disc, _FAT_fat_clusterToSector(partition, position.cluster),
-			partition->sectorsPerCluster, ptr);
+		tempVar = _FAT_file_runLength (file, position.cluster, remain / partition->bytesPerCluster);
+		_FAT_cache_writeDirect (partition->cache, _FAT_fat_clusterToSector(partition, position.cluster),
+			tempVar * partition->sectorsPerCluster, ptr);
 		//cancel the dirty state of cahced sctor
 		_FAT_cache_writePartialSector_check(cache, _FAT_fat_clusterToSector(partition, position.cluster),
-			partition->sectorsPerCluster, ptr);
+			tempVar * partition->sectorsPerCluster, ptr);
 
-		ptr += partition->bytesPerCluster;
-		remain -= partition->bytesPerCluster;
+		ptr += tempVar * partition->bytesPerCluster;
+		remain -= tempVar * partition->bytesPerCluster;
+		position.cluster += tempVar - 1;
 		if (remain > 0) {
-			tempNextCluster = _FAT_fat_nextCluster(partition, position.cluster);
+			tempNextCluster = _FAT_file_nextCluster(file, position.cluster);
 			if ((tempNextCluster == CLUSTER_EOF) || (tempNextCluster == CLUSTER_FREE)) {
 				// Ran out of clusters so get a new one
-				tempNextCluster = _FAT_fat_linkFreeCluster(partition, position.cluster);
+				tempNextCluster = _FAT_file_linkFreeCluster(file, position.cluster);
 			} 
 			if (tempNextCluster == CLUSTER_FREE) {
 				// Couldn't get a cluster, so abort
@@ -715,7 +997,7 @@ int _FAT_write_r (struct _reent *r,int fd, const char *ptr, int len) {
 	// Number of sectors left
 	tempVar = remain / BYTES_PER_READ;
 	if ((tempVar > 0) && flagNoError) {
-		_FAT_disc_writeSectors (partition->disc, _FAT_fat_clusterToSector (partition, position.cluster), 
+		_FAT_cache_writeDirect (partition->cache, _FAT_fat_clusterToSector (partition, position.cluster), 
 			tempVar, ptr);
 		//cancel the dirty state of cahced sctor
 		_FAT_cache_writePartialSector_check(cache, _FAT_fat_clusterToSector (partition, position.cluster), 
@@ -764,13 +1046,72 @@ int _FAT_write_r (struct _reent *r,int fd, const char *ptr, int len) {
 	return len;
 }
 
+int _FAT_fallocate_r (struct _reent *r, int fd, u32 size) {
+	FILE_STRUCT* file = (FILE_STRUCT*)  fd;
+	PARTITION* partition;
+	FILE_EXTENT* last;
+	u32 clusters, haveClusters, lastCluster;
+	u32 first, length;
+
+	if ((file == NULL) || !file->inUse || !file->write) {
+		r->_errno = EBADF;
+		return -1;
+	}
+
+	partition = file->partition;
+
+	// The reserved clusters are only found again through the extents
+	if (!_FAT_file_buildExtents (file)) {
+		r->_errno = (file->startCluster < CLUSTER_FIRST) ? ENOSPC : ENOMEM;
+		return -1;
+	}
+
+	last = &file->extents[file->extentCount - 1];
+	haveClusters = last->index + last->length;
+	clusters = (size + partition->bytesPerCluster - 1) / partition->bytesPerCluster;
+	if (clusters <= haveClusters) {
+		return 0;
+	}
+
+	// Don't fragment the disc for a file that won't fit anyway
+	if (_FAT_fat_freeClusterCount (partition) < clusters - haveClusters) {
+		r->_errno = ENOSPC;
+		return -1;
+	}
+
+	file->preallocated = true;
+
+	while (haveClusters < clusters) {
+		// Prefer the clusters right after the file, then the smallest free run
+		// that holds the rest, then the largest one
+		lastCluster = _FAT_file_lastCluster (file);
+		first = _FAT_fat_findFreeRun (partition, lastCluster + 1, clusters - haveClusters, &length);
+		if (first == CLUSTER_FREE) {
+			r->_errno = ENOSPC;
+			return -1;
+		}
+		if (!_FAT_fat_linkClusterRun (partition, lastCluster, first, length)) {
+			r->_errno = EIO;
+			return -1;
+		}
+		if (!_FAT_file_appendExtent (file, first, length)) {
+			_FAT_file_freeExtents (file);
+			r->_errno = ENOMEM;
+			return -1;
+		}
+		haveClusters += length;
+	}
+
+	return 0;
+}
+
 #include "ds2io.h"
 int _FAT_seek_r (struct _reent *r, int fd, int pos, int dir) {
 	FILE_STRUCT* file = (FILE_STRUCT*)  fd;
 	
 	PARTITION* partition;
 
-	u32 cluster, nextCluster;
+	u32 cluster, nextCluster, missing;
 	int clusCount;
 	int position;
 
@@ -828,11 +1169,17 @@ int _FAT_seek_r (struct _reent *r, int fd, int pos, int dir) {
 		file->rwPosition.sector = (position % partition->bytesPerCluster) / BYTES_PER_READ;
 		file->rwPosition.byte = position % BYTES_PER_READ;
 
-		nextCluster = _FAT_fat_nextCluster (partition, cluster);
-		while ((clusCount > 0) && (nextCluster != CLUSTER_FREE) && (nextCluster != CLUSTER_EOF)) {
-			clusCount--;
-			cluster = nextCluster;
+		if (_FAT_file_buildExtents (file)) {
+			// Look the cluster up directly in the extents
+			cluster = _FAT_file_clusterAt (file, position / partition->bytesPerCluster, &missing);
+			clusCount = missing;
+		} else {
 			nextCluster = _FAT_fat_nextCluster (partition, cluster);
+			while ((clusCount > 0) && (nextCluster != CLUSTER_FREE) && (nextCluster != CLUSTER_EOF)) {
+				clusCount--;
+				cluster = nextCluster;
+				nextCluster = _FAT_fat_nextCluster (partition, cluster);
+			}
 		}
 
 		// Check if ran out of clusters, and the file is being written to
@@ -39,8 +39,11 @@
 
 #include "file_allocation_table.h"
 #include "partition.h"
+#include "bit_ops.h"
 #include <string.h>
 
+#include "mem_allocate.h"
+
 /*
 Gets the cluster linked from input cluster
 */
@@ -50,6 +53,8 @@ u32 _FAT_fat_nextCluster(PARTITION* partition, u32 cluster)
 	u32 sector;
 	int offset;
 
+	partition->stats.fatLookups++;
+
 	switch (partition->filesysType)
 	{
 		case FS_UNKNOWN:
@@ -117,6 +122,148 @@ u32 _FAT_fat_nextCluster(PARTITION* partition, u32 cluster)
 	return nextCluster;
 }
 
+/*
+Go through the whole FAT once, setting a bit for each cluster in use and
+counting the free ones, so that free clusters can be found without reading
+the FAT again. FAT16 and FAT32 tables are read a sector at a time.
+*/
+static bool _FAT_fat_buildUsedBitmap (PARTITION* partition) {
+	u32 lastCluster = partition->fat.lastCluster;
+	u32* usedBitmap;
+	u32 numberFree = 0;
+	u32 cluster, i, entriesPerSector, entry;
+	u8 sectorBuffer[BYTES_PER_READ];
+
+	if (partition->fat.usedBitmap != NULL) {
+		return true;
+	}
+
+	usedBitmap = (u32*) _FAT_mem_allocate (sizeof(u32) * ((lastCluster >> 5) + 1));
+	if (usedBitmap == NULL) {
+		return false;
+	}
+	memset (usedBitmap, 0, sizeof(u32) * ((lastCluster >> 5) + 1));
+
+	switch (partition->filesysType)
+	{
+		case FS_FAT16:
+		case FS_FAT32:
+			entriesPerSector = (partition->filesysType == FS_FAT16) ? (BYTES_PER_READ >> 1) : (BYTES_PER_READ >> 2);
+			for (cluster = 0; cluster <= lastCluster; cluster += entriesPerSector) {
+				if (!_FAT_cache_readSector (partition->cache, sectorBuffer,
+					partition->fat.fatStart + cluster / entriesPerSector))
+				{
+					_FAT_mem_free (usedBitmap);
+					return false;
+				}
+				for (i = 0; (i < entriesPerSector) && (cluster + i <= lastCluster); i++) {
+					if (partition->filesysType == FS_FAT16) {
+						entry = u8array_to_u16 (sectorBuffer, i << 1);
+					} else {
+						entry = u8array_to_u32 (sectorBuffer, i << 2) & 0x0FFFFFFF;
+					}
+					if (entry != CLUSTER_FREE) {
+						usedBitmap[(cluster + i) >> 5] |= 1u << ((cluster + i) & 31);
+					} else if (cluster + i >= CLUSTER_FIRST) {
+						numberFree++;
+					}
+				}
+			}
+			break;
+
+		case FS_FAT12:
+			for (cluster = CLUSTER_FIRST; cluster <= lastCluster; cluster++) {
+				if (_FAT_fat_nextCluster (partition, cluster) != CLUSTER_FREE) {
+					usedBitmap[cluster >> 5] |= 1u << (cluster & 31);
+				} else {
+					numberFree++;
+				}
+			}
+			break;
+
+		default:
+			_FAT_mem_free (usedBitmap);
+			return false;
+	}
+
+	// The reserved entries are never free
+	usedBitmap[0] |= 0x03;
+
+	partition->fat.usedBitmap = usedBitmap;
+	partition->fat.numberFree = numberFree;
+	return true;
+}
+
+void _FAT_fat_freeUsedBitmap (PARTITION* partition) {
+	if (partition->fat.usedBitmap != NULL) {
+		_FAT_mem_free (partition->fat.usedBitmap);
+		partition->fat.usedBitmap = NULL;
+	}
+}
+
+u32 _FAT_fat_freeClusterCount (PARTITION* partition) {
+	if ((partition->fat.usedBitmap == NULL) && (partition->fat.numberFree == CLUSTER_COUNT_UNKNOWN)) {
+		_FAT_fat_buildUsedBitmap (partition);
+	}
+	return partition->fat.numberFree;
+}
+
+/*
+Keep the bitmap and free cluster count in step with a FAT entry that is
+about to change. Without the bitmap, the count can no longer be trusted.
+*/
+static void _FAT_fat_markCluster (PARTITION* partition, u32 cluster, bool used) {
+	u32* word;
+	u32 bit = 1u << (cluster & 31);
+
+	if (!_FAT_fat_buildUsedBitmap (partition)) {
+		partition->fat.numberFree = CLUSTER_COUNT_UNKNOWN;
+		return;
+	}
+
+	word = &partition->fat.usedBitmap[cluster >> 5];
+	if (used && !(*word & bit)) {
+		*word |= bit;
+		partition->fat.numberFree--;
+	} else if (!used && (*word & bit)) {
+		*word &= ~bit;
+		partition->fat.numberFree++;
+	}
+}
+
+/*
+Find the first free cluster from start onwards, going back to the start of
+the FAT if needed. Skips 32 clusters at a time where they are all in use.
+Return CLUSTER_FREE if the partition is full.
+*/
+static u32 _FAT_fat_findFreeCluster (PARTITION* partition, u32 start) {
+	u32* usedBitmap = partition->fat.usedBitmap;
+	u32 lastCluster = partition->fat.lastCluster;
+	u32 cluster = start;
+	bool loopedAroundFAT = false;
+
+	if (partition->fat.numberFree == 0) {
+		return CLUSTER_FREE;
+	}
+
+	for (;;) {
+		if (cluster > lastCluster) {
+			if (loopedAroundFAT) {
+				return CLUSTER_FREE;
+			}
+			cluster = CLUSTER_FIRST;
+			loopedAroundFAT = true;
+		}
+		if (((cluster & 31) == 0) && (usedBitmap[cluster >> 5] == 0xFFFFFFFF)) {
+			cluster += 32;
+		} else if (usedBitmap[cluster >> 5] & (1u << (cluster & 31))) {
+			cluster++;
+		} else {
+			return cluster;
+		}
+	}
+}
+
 /*
 writes value into the correct offset within a partition's FAT, based
 on the cluster number.
@@ -131,6 +278,12 @@ static bool _FAT_fat_writeFatEntry (PARTITION* partition, u32 cluster, u32 value
 		return false;
 	}
 
+	partition->stats.fatUpdates++;
+
+	if (partition->filesysType != FS_UNKNOWN) {
+		_FAT_fat_markCluster (partition, cluster, value != CLUSTER_FREE);
+	}
+
 	switch (partition->filesysType)
 	{
 		case FS_UNKNOWN:
@@ -231,19 +384,28 @@ u32 _FAT_fat_linkFreeCluster(PARTITION* partition, u32 cluster) {
 		firstFree = CLUSTER_FIRST;
 	}
 
-	// Search until a free cluster is found
-	while (_FAT_fat_nextCluster(partition, firstFree) != CLUSTER_FREE) {
-		firstFree++;
-		if (firstFree > lastCluster) {
-			if (loopedAroundFAT) {
-				// If couldn't get a free cluster then return, saying this fact
-				partition->fat.firstFree = firstFree;
-				return CLUSTER_FREE;
-			} else {
-				// Try looping back to the beginning of the FAT
-				// This was suggested by loopy
-				firstFree = CLUSTER_FIRST;
-				loopedAroundFAT = true;
+	if (_FAT_fat_buildUsedBitmap (partition)) {
+		// Look the free cluster up in the bitmap
+		firstFree = _FAT_fat_findFreeCluster (partition, firstFree);
+		if (firstFree == CLUSTER_FREE) {
+			return CLUSTER_FREE;
+		}
+	} else {
+		// Not enough memory for the bitmap
+		// Search until a free cluster is found
+		while (_FAT_fat_nextCluster(partition, firstFree) != CLUSTER_FREE) {
+			firstFree++;
+			if (firstFree > lastCluster) {
+				if (loopedAroundFAT) {
+					// If couldn't get a free cluster then return, saying this fact
+					partition->fat.firstFree = firstFree;
+					return CLUSTER_FREE;
+				} else {
+					// Try looping back to the beginning of the FAT
+					// This was suggested by loopy
+					firstFree = CLUSTER_FIRST;
+					loopedAroundFAT = true;
+				}
 			}
 		}
 	}
@@ -280,7 +442,11 @@ u32 _FAT_fat_linkFreeClusterCleared (PARTITION* partition, u32 cluster) {
 	// Clear all the sectors within the cluster
 	memset (emptySector, 0, BYTES_PER_READ);
 	for (i = 0; i < partition->sectorsPerCluster; i++) {
-		_FAT_disc_writeSectors (partition->disc,
+		_FAT_cache_writeDirect (partition->cache,
+			_FAT_fat_clusterToSector (partition, newCluster) + i,
+			1, emptySector);
+		// Don't leave a stale copy of the old contents in the cache
+		_FAT_cache_writePartialSector_check (partition->cache,
 			_FAT_fat_clusterToSector (partition, newCluster) + i,
 			1, emptySector);
 	}
@@ -318,6 +484,135 @@ bool _FAT_fat_clearLinks (PARTITION* partition, u32 cluster) {
 	return true;
 }
 
+/*-----------------------------------------------------------------
+_FAT_fat_trimLinks
+frees the clusters of a chain following cluster
+-----------------------------------------------------------------*/
+bool _FAT_fat_trimLinks (PARTITION* partition, u32 cluster) {
+	u32 nextCluster;
+
+	if ((cluster < 0x0002) || (cluster > partition->fat.lastCluster))
+		return false;
+
+	nextCluster = _FAT_fat_nextCluster (partition, cluster);
+	if (!_FAT_fat_writeFatEntry (partition, cluster, CLUSTER_EOF)) {
+		return false;
+	}
+
+	if ((nextCluster != CLUSTER_EOF) && (nextCluster != CLUSTER_FREE)) {
+		return _FAT_fat_clearLinks (partition, nextCluster);
+	}
+	return true;
+}
+
+/*-----------------------------------------------------------------
+_FAT_fat_findFreeRun
+searches the free cluster bitmap for a run of free clusters
+-----------------------------------------------------------------*/
+u32 _FAT_fat_findFreeRun (PARTITION* partition, u32 hint, u32 maxLength, u32* length) {
+	u32* usedBitmap;
+	u32 lastCluster = partition->fat.lastCluster;
+	u32 cluster, runStart, runLength;
+	u32 fitStart = CLUSTER_FREE, fitLength = 0;
+	u32 bestStart = CLUSTER_FREE, bestLength = 0;
+	u32 searched = 0;
+
+	if (!_FAT_fat_buildUsedBitmap (partition) || (partition->fat.numberFree == 0)) {
+		return CLUSTER_FREE;
+	}
+	usedBitmap = partition->fat.usedBitmap;
+
+	if ((hint < CLUSTER_FIRST) || (hint > lastCluster)) {
+		hint = CLUSTER_FIRST;
+	}
+
+	// Go once around the FAT. A run is broken where the search wraps around.
+	cluster = hint;
+	for (;;) {
+		// Measure the run starting at cluster, if it is free
+		runStart = cluster;
+		runLength = 0;
+		while ((searched <= lastCluster - CLUSTER_FIRST) && (cluster <= lastCluster)
+			&& !(usedBitmap[cluster >> 5] & (1u << (cluster & 31))))
+		{
+			runLength++;
+			cluster++;
+			searched++;
+		}
+
+		if (runLength >= maxLength) {
+			// Nothing beats a run that continues the file or fits exactly
+			if ((runStart == hint) || (runLength == maxLength)) {
+				fitStart = runStart;
+				fitLength = runLength;
+				break;
+			}
+			if ((fitStart == CLUSTER_FREE) || (runLength < fitLength)) {
+				fitStart = runStart;
+				fitLength = runLength;
+			}
+		} else if (runLength > bestLength) {
+			bestStart = runStart;
+			bestLength = runLength;
+		}
+
+		if (searched > lastCluster - CLUSTER_FIRST) {
+			break;
+		}
+		if (cluster > lastCluster) {
+			cluster = CLUSTER_FIRST;
+			continue;
+		}
+
+		// Step over the cluster in use, or 32 of them at once
+		if (((cluster & 31) == 0) && (usedBitmap[cluster >> 5] == 0xFFFFFFFF)) {
+			cluster += 32;
+			searched += 32;
+		} else {
+			cluster++;
+			searched++;
+		}
+	}
+
+	if (fitStart != CLUSTER_FREE) {
+		*length = maxLength;
+		return fitStart;
+	}
+	*length = bestLength;
+	return bestStart;
+}
+
+/*-----------------------------------------------------------------
+_FAT_fat_linkClusterRun
+links a run of consecutive free clusters to the end of a chain
+-----------------------------------------------------------------*/
+bool _FAT_fat_linkClusterRun (PARTITION* partition, u32 cluster, u32 first, u32 length) {
+	u32 i;
+
+	if ((length == 0) || (first < CLUSTER_FIRST) || (first + length - 1 > partition->fat.lastCluster)) {
+		return false;
+	}
+
+	// Chain the run together, then attach it
+	for (i = 0; i < length - 1; i++) {
+		if (!_FAT_fat_writeFatEntry (partition, first + i, first + i + 1)) {
+			return false;
+		}
+	}
+	if (!_FAT_fat_writeFatEntry (partition, first + length - 1, CLUSTER_EOF)) {
+		return false;
+	}
+	if ((cluster >= CLUSTER_FIRST) && !_FAT_fat_writeFatEntry (partition, cluster, first)) {
+		return false;
+	}
+
+	// Don't look for free clusters inside the run
+	if ((partition->fat.firstFree >= first) && (partition->fat.firstFree < first + length)) {
+		partition->fat.firstFree = first + length;
+	}
+	return true;
+}
+
 /*-----------------------------------------------------------------
 _FAT_fat_lastCluster
 Trace the cluster links until the last one is found
@@ -10,7 +10,8 @@
 #include "fatfile.h"
 #include "fatdir.h"
 
-typedef unsigned int size_t;
+extern bool _FAT_Init(void);
+
 typedef unsigned int mode_t;
 
 typedef struct {
@@ -172,6 +173,39 @@ int fat_fflush(FILE_STRUCT *fp)
 	return(_FAT_cache_flush(fp->partition->cache));
 }
 
+int fat_fallocate(FILE_STRUCT *fp, unsigned int size)
+{
+	return( _FAT_fallocate_r(&__REENT, fp->fd, size) );
+}
+
+int fat_getStats(FAT_STATS *stats)
+{
+	PARTITION *partition;
+
+	partition = _FAT_partition_getPartitionFromPath("fat:/");
+	if(partition == NULL)
+	{
+		__REENT._errno = ENODEV;
+		return -1;
+	}
+
+	stats->cache = partition->cache->stats;
+	stats->partition = partition->stats;
+	return 0;
+}
+
+void fat_resetStats(void)
+{
+	PARTITION *partition;
+
+	partition = _FAT_partition_getPartitionFromPath("fat:/");
+	if(partition == NULL)
+		return;
+
+	memset(&partition->cache->stats, 0, sizeof(CACHE_STATS));
+	memset(&partition->stats, 0, sizeof(PARTITION_STATS));
+}
+
 int fat_fgetc(FILE_STRUCT *fp)
 {
 	char ch;
@@ -2,6 +2,7 @@
 #define __FS_API_H__
 //v1.0
 
+#include <stddef.h>
 #include "sys/stat.h"
 #include "fatfile.h"
 #include "fatdir.h"
@@ -31,6 +32,13 @@ extern void fat_clearerr(FILE_STRUCT *fp);
 
 extern int fat_fflush(FILE_STRUCT *fp);
 
+extern int fat_fallocate(FILE_STRUCT *fp, unsigned int size);
+
+/* Disc commands, cache and FAT activity on the default card since mount or the last reset */
+extern int fat_getStats(FAT_STATS *stats);
+
+extern void fat_resetStats(void);
+
 extern int fat_fgetc(FILE_STRUCT *fp);
 
 extern char* fat_fgets(char *buf, int n, FILE_STRUCT *fp);
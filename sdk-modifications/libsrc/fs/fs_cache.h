@@ -3,11 +3,18 @@
  The cache is not visible to the user. It should be flushed 
  when any file is closed or changes are made to the filesystem.
  
- This cache implements a least-used-page replacement policy. This will 
- distribute sectors evenly over the pages, so if less than the maximum 
- pages are used at once, they should all eventually remain in the cache.
- This also has the benefit of throwing out old sectors, so as not to keep
- too many stale pages around.
+ This cache implements a segmented least-recently-used page replacement
+ policy. Pages are found through a hash table indexed by sector number, so
+ a lookup costs the same no matter how many pages the cache holds. A page
+ that has just been loaded goes into the probation segment, and moves to
+ the protected segment once it is used again. New sectors replace the page
+ that has gone unused for the longest time in the probation segment, so
+ sectors used once, such as those of a directory being scanned, don't push
+ out the FAT and directory sectors that keep being used.
+
+ A page may hold several consecutive sectors, such as a whole cluster, so
+ that a miss costs one command to the card instead of one per sector. When
+ pages are missed in order, the following pages are read in the same command.
 
  Copyright (c) 2006 Michael "Chishm" Chisholm
 	
@@ -42,22 +49,73 @@
 #include "fs_common.h"
 #include "disc_io/disc_io.h"
 
-#define CACHE_PAGE_SIZE BYTES_PER_READ
+#define CACHE_FREE 0xFFFFFFFF
+
+// Page size values for _FAT_cache_constructor and the partition mount functions
+#define CACHE_PAGE_SECTOR	1	// One sector per page
+#define CACHE_PAGE_CLUSTER	0	// One cluster per page
 
 typedef struct {
-	u32 sector;
-	u32 count;
+	u32 sector;		// First sector held by the page
+	u32 count;		// Number of sectors held by the page
 	bool dirty;
+	u32 dirtyStart;	// First modified sector, relative to the start of the page
+	u32 dirtyEnd;	// One past the last modified sector, relative to the start of the page
+	bool reused;	// Used again since it was loaded, so in the protected segment
+	u32 prev;		// Next more recently used page, CACHE_FREE for the head
+	u32 next;		// Next less recently used page, CACHE_FREE for the tail
+	u32 hashNext;	// Next page in the same hash bucket
 } CACHE_ENTRY;
 
+typedef struct {
+	u32 readCommands;		// Read commands sent to the disc
+	u32 sectorsRead;		// Sectors read by those commands
+	u32 writeCommands;		// Write commands sent to the disc
+	u32 sectorsWritten;		// Sectors written by those commands
+	u32 hits;				// Sector lookups answered from the cache
+	u32 misses;				// Sector lookups that had to go to the disc
+	u32 readAheadSectors;	// Sectors read ahead of a sequential miss
+	u32 writeBacks;			// Dirty pages written back to make room
+} CACHE_STATS;
+
 typedef struct {
 	const IO_INTERFACE* disc;
 	u32 numberOfPages;
+	u32 sectorsPerPage;		// Always a power of 2
+	u32 bytesPerPage;
+	u32 pageAlignment;		// Pages start on sectors equal to this, modulo sectorsPerPage
+	u32 endOfPartition;		// First sector past the end of the partition
+	u32 readAheadPages;		// Extra pages read after a sequential miss
+	u32 nextSequential;		// Sector following the last one read from disc
 	CACHE_ENTRY* cacheEntries;
 	u8* pages;
+	u8* stagingBuffer;		// Holds runs of pages read ahead or written back together
+	u32 stagingSectors;		// Size of stagingBuffer, 0 if it could not be allocated
+	u32* writeOrder;		// Dirty pages sorted by sector, while flushing
+	u32* hashTable;		// First page in each bucket, CACHE_FREE if empty
+	u32 hashShift;		// 32 - log2(number of buckets)
+	u32 lruHead;		// Most recently used page
+	u32 lruTail;		// Least recently used page, the next to be replaced
+	u32 probationHead;	// Most recently used page not in the protected segment, CACHE_FREE if none
+	u32 reusedPages;	// Pages in the protected segment
+	u32 maxReusedPages;	// Most pages the protected segment may hold
+	u32 lastPage;		// Page found by the last lookup, CACHE_FREE if none
+	CACHE_STATS stats;	// Everything sent to the disc, whether it went through the cache or not
 } CACHE;
 
 
+/*
+Read sectors straight from the disc into buffer, bypassing the cache
+Returns true on success, false on failure
+*/
+bool _FAT_cache_readDirect (CACHE* cache, u32 sector, u32 numSectors, void* buffer);
+
+/*
+Write sectors from buffer straight to the disc, bypassing the cache
+Returns true on success, false on failure
+*/
+bool _FAT_cache_writeDirect (CACHE* cache, u32 sector, u32 numSectors, const void* buffer);
+
 /*
 Read data from a sector in the cache
 If the sector is not in the cache, it will be swapped in
@@ -109,7 +167,8 @@ static inline bool _FAT_cache_writeSector (CACHE* cache, const void* buffer, u32
 }
 
 /*
-Write any dirty sectors back to disc and clear out the contents of the cache
+Write any dirty sectors back to disc and clear out the contents of the cache.
+Dirty sectors that follow each other on disc are written in a single command.
 */
 bool _FAT_cache_flush (CACHE* cache);
 
@@ -118,7 +177,16 @@ Clear out the contents of the cache without writing any dirty sectors first
 */
 void _FAT_cache_invalidate (CACHE* cache);
 
-CACHE* _FAT_cache_constructor (u32 numberOfPages, const IO_INTERFACE* discInterface);
+/*
+numberOfPages pages of sectorsPerPage sectors each are allocated. sectorsPerPage
+is rounded down to a power of 2. Pages start on sectors equal to pageAlignment,
+modulo sectorsPerPage, so that a page never straddles two clusters if
+pageAlignment is the first data sector. No page extends past endOfPartition.
+When a page is missing and the previous read from disc ended just before it,
+up to readAheadPages more pages are read in the same command.
+*/
+CACHE* _FAT_cache_constructor (u32 numberOfPages, u32 sectorsPerPage, u32 readAheadPages,
+	u32 pageAlignment, u32 endOfPartition, const IO_INTERFACE* discInterface);
 
 void _FAT_cache_destructor (CACHE* cache);
 
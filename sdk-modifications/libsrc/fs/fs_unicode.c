@@ -1,6 +1,7 @@
 //fs_unicode.c
 
 #include <string.h>
+#include <ctype.h>
 #include "fs_common.h"
 
 //void _FAT_unicode_init_default() // ANSI CODE PAGE
@@ -0,0 +1,77 @@
+/*
+ cache_trace.c
+
+ Records the requests libfat makes of its cache. See cache_trace.h for
+ details.
+*/
+
+#include <stdio.h>
+
+#include "cache_trace.h"
+#include "fs_cache.h"
+
+// The real functions, renamed by --wrap
+extern bool __real__FAT_cache_readPartialSector (CACHE* cache, void* buffer, u32 sector, u32 offset, u32 size);
+extern bool __real__FAT_cache_writePartialSector (CACHE* cache, const void* buffer, u32 sector, u32 offset, u32 size);
+extern bool __real__FAT_cache_eraseWritePartialSector (CACHE* cache, const void* buffer, u32 sector, u32 offset, u32 size);
+extern void __real__FAT_cache_writePartialSector_check (CACHE* cache, u32 sector, u32 num, const void* buffer);
+extern bool __real__FAT_cache_flush (CACHE* cache);
+extern void __real__FAT_cache_invalidate (CACHE* cache);
+
+static FILE* _TRACE_file = NULL;
+
+bool _TRACE_Open (const char* path) {
+	_TRACE_Close ();
+
+	_TRACE_file = fopen (path, "w");
+	return (_TRACE_file != NULL);
+}
+
+void _TRACE_Close (void) {
+	if (_TRACE_file != NULL) {
+		fclose (_TRACE_file);
+		_TRACE_file = NULL;
+	}
+}
+
+bool __wrap__FAT_cache_readPartialSector (CACHE* cache, void* buffer, u32 sector, u32 offset, u32 size) {
+	if (_TRACE_file != NULL) {
+		fprintf (_TRACE_file, "r %u\n", sector);
+	}
+	return __real__FAT_cache_readPartialSector (cache, buffer, sector, offset, size);
+}
+
+bool __wrap__FAT_cache_writePartialSector (CACHE* cache, const void* buffer, u32 sector, u32 offset, u32 size) {
+	if (_TRACE_file != NULL) {
+		fprintf (_TRACE_file, "w %u\n", sector);
+	}
+	return __real__FAT_cache_writePartialSector (cache, buffer, sector, offset, size);
+}
+
+bool __wrap__FAT_cache_eraseWritePartialSector (CACHE* cache, const void* buffer, u32 sector, u32 offset, u32 size) {
+	if (_TRACE_file != NULL) {
+		fprintf (_TRACE_file, "e %u\n", sector);
+	}
+	return __real__FAT_cache_eraseWritePartialSector (cache, buffer, sector, offset, size);
+}
+
+void __wrap__FAT_cache_writePartialSector_check (CACHE* cache, u32 sector, u32 num, const void* buffer) {
+	if (_TRACE_file != NULL) {
+		fprintf (_TRACE_file, "c %u %u\n", sector, num);
+	}
+	__real__FAT_cache_writePartialSector_check (cache, sector, num, buffer);
+}
+
+bool __wrap__FAT_cache_flush (CACHE* cache) {
+	if (_TRACE_file != NULL) {
+		fprintf (_TRACE_file, "f\n");
+	}
+	return __real__FAT_cache_flush (cache);
+}
+
+void __wrap__FAT_cache_invalidate (CACHE* cache) {
+	if (_TRACE_file != NULL) {
+		fprintf (_TRACE_file, "i\n");
+	}
+	__real__FAT_cache_invalidate (cache);
+}
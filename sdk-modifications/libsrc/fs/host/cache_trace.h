@@ -0,0 +1,35 @@
+/*
+ cache_trace.h
+
+ Records every sector request libfat makes of its cache, so the same
+ accesses can be replayed against other cache policies by cachereplay.
+
+ The cache functions are intercepted with the linker's --wrap option, see
+ TRACE_WRAP in the Makefile, so the library itself is built unchanged.
+ Each request is one line of text:
+	r sector		_FAT_cache_readPartialSector
+	w sector		_FAT_cache_writePartialSector
+	e sector		_FAT_cache_eraseWritePartialSector
+	c sector count	_FAT_cache_writePartialSector_check
+	f				_FAT_cache_flush
+	i				_FAT_cache_invalidate
+*/
+
+#ifndef _CACHE_TRACE_H
+#define _CACHE_TRACE_H
+
+#include "fs_common.h"
+
+/*
+Start writing the requests made of the cache to the file at path,
+replacing its contents
+Returns true on success, false on failure
+*/
+bool _TRACE_Open (const char* path);
+
+/*
+Stop recording and close the file opened with _TRACE_Open
+*/
+void _TRACE_Close (void);
+
+#endif // _CACHE_TRACE_H
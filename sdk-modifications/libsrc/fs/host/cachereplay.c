@@ -0,0 +1,389 @@
+/*
+ cachereplay.c
+
+ Replays a trace of cache requests, recorded with fatbench -r, against the
+ cache policy libfat used to have and the one in cache.c, for a range of
+ cache sizes. For each it prints the requests answered from the cache and
+ those that missed, the sectors written back to make room or by a flush,
+ and the host time taken per request, which shows the cost of looking
+ pages up.
+
+ The old policy is kept here as a reference: every lookup scans all of the
+ pages, also looking for the one with the lowest use count, which is only
+ reset by a flush. The new policy is the segmented LRU of the real cache.c,
+ built with one sector per page and no read ahead so only the replacement
+ policy differs, on a disc that does nothing. Each miss reads one sector,
+ so the misses are also the sectors read.
+
+ Usage: cachereplay [options] trace
+	-p pages,...	Cache sizes to replay with (default 8,64,256,1024)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fs_cache.h"
+
+#define REPLAY_MAX_SIZES 16
+#define REPLAY_READ_SIZE 4	// Bytes copied by each request, as for a FAT entry
+
+#define REF_DIRTY 0xC33CA55A
+
+typedef struct {
+	char type;
+	u32 sector;
+	u32 count;
+} TRACE_REQUEST;
+
+typedef struct {
+	u32 hits;
+	u32 misses;
+	u64 sectorsWritten;
+	u64 pagesScanned;
+	double hostMs;
+} REPLAY_RESULT;
+
+// The old cache, without the disc
+
+typedef struct {
+	u32 sector;
+	u32 count;
+	u32 dirty;
+} REF_ENTRY;
+
+typedef struct {
+	u32 numberOfPages;
+	REF_ENTRY* cacheEntries;
+	u8* pages;
+	REPLAY_RESULT* result;
+} REF_CACHE;
+
+static u32 _ref_getSector (REF_CACHE* cache, u32 sector) {
+	u32 i;
+	REF_ENTRY* cacheEntries = cache->cacheEntries;
+	u32 numberOfPages = cache->numberOfPages;
+
+	u32 leastUsed = 0;
+	u32 lowestCount = 0xFFFFFFFF;
+
+	for (i = 0; (i < numberOfPages) && (cacheEntries[i].sector != sector); i++) {
+		// While searching for the desired sector, also search for the leased used page
+		if ( (cacheEntries[i].sector == CACHE_FREE) || (cacheEntries[i].count < lowestCount) ) {
+			leastUsed = i;
+			lowestCount = cacheEntries[i].count;
+		}
+	}
+
+	// If it found the sector in the cache, return it
+	if ((i < numberOfPages) && (cacheEntries[i].sector == sector)) {
+		cache->result->pagesScanned += i + 1;
+		cache->result->hits++;
+		// Increment usage counter
+		cacheEntries[i].count += 1;
+		return i;
+	}
+	cache->result->pagesScanned += numberOfPages;
+	cache->result->misses++;
+
+	// If it didn't, replace the least used cache page with the desired sector
+	if ((cacheEntries[leastUsed].sector != CACHE_FREE) && (REF_DIRTY == cacheEntries[leastUsed].dirty)) {
+		cache->result->sectorsWritten++;
+		cacheEntries[leastUsed].dirty = 0;
+	}
+
+	// Load the new sector into the cache
+	memset (cache->pages + BYTES_PER_READ * leastUsed, 0, BYTES_PER_READ);
+	cacheEntries[leastUsed].sector = sector;
+	// Increment the usage count, don't reset it
+	// This creates a paging policy of least used PAGE, not sector
+	cacheEntries[leastUsed].count += 1;
+	return leastUsed;
+}
+
+static void _ref_check (REF_CACHE* cache, u32 sector, u32 num) {
+	u32 i, m;
+
+	// Like the old code, this stops at the first sector that isn't cached
+	for (m = 0; m < num; m++, sector++) {
+		for (i = 0; (i < cache->numberOfPages) && (cache->cacheEntries[i].sector != sector); i++) ;
+		cache->result->pagesScanned += (i < cache->numberOfPages) ? i + 1 : i;
+		if (i >= cache->numberOfPages) {
+			return;
+		}
+		cache->cacheEntries[i].dirty = 0;
+	}
+}
+
+static void _ref_flush (REF_CACHE* cache) {
+	u32 i;
+
+	for (i = 0; i < cache->numberOfPages; i++) {
+		if (REF_DIRTY == cache->cacheEntries[i].dirty) {
+			cache->result->sectorsWritten++;
+		}
+		cache->cacheEntries[i].count = 0;
+		cache->cacheEntries[i].dirty = 0;
+	}
+}
+
+static void _ref_invalidate (REF_CACHE* cache) {
+	u32 i;
+
+	for (i = 0; i < cache->numberOfPages; i++) {
+		cache->cacheEntries[i].sector = CACHE_FREE;
+		cache->cacheEntries[i].count = 0;
+		cache->cacheEntries[i].dirty = 0;
+	}
+}
+
+static bool _replay_reference (const TRACE_REQUEST* trace, u32 length, u32 numberOfPages, REPLAY_RESULT* result) {
+	REF_CACHE cache;
+	u8 data[REPLAY_READ_SIZE] = {0};
+	u32 i, page;
+
+	cache.numberOfPages = numberOfPages;
+	cache.cacheEntries = (REF_ENTRY*) malloc (sizeof(REF_ENTRY) * numberOfPages);
+	cache.pages = (u8*) malloc (BYTES_PER_READ * numberOfPages);
+	cache.result = result;
+	if ((cache.cacheEntries == NULL) || (cache.pages == NULL)) {
+		free (cache.pages);
+		free (cache.cacheEntries);
+		return false;
+	}
+	_ref_invalidate (&cache);
+
+	for (i = 0; i < length; i++) {
+		switch (trace[i].type) {
+			case 'r':
+				page = _ref_getSector (&cache, trace[i].sector);
+				memcpy (data, cache.pages + BYTES_PER_READ * page, REPLAY_READ_SIZE);
+				break;
+			case 'w':
+			case 'e':
+				page = _ref_getSector (&cache, trace[i].sector);
+				memcpy (cache.pages + BYTES_PER_READ * page, data, REPLAY_READ_SIZE);
+				cache.cacheEntries[page].dirty = REF_DIRTY;
+				break;
+			case 'c':
+				_ref_check (&cache, trace[i].sector, trace[i].count);
+				break;
+			case 'f':
+				_ref_flush (&cache);
+				break;
+			case 'i':
+				_ref_invalidate (&cache);
+				break;
+		}
+	}
+	_ref_flush (&cache);
+
+	free (cache.pages);
+	free (cache.cacheEntries);
+	return true;
+}
+
+// The new cache, on a disc that does nothing
+
+static bool _null_startUp (void) {
+	return true;
+}
+
+static bool _null_readSectors (unsigned long sector, unsigned long numSectors, void* buffer) {
+	memset (buffer, 0, numSectors * BYTES_PER_READ);
+	return true;
+}
+
+static bool _null_writeSectors (unsigned long sector, unsigned long numSectors, const void* buffer) {
+	return true;
+}
+
+static const IO_INTERFACE _io_null = {
+	0,
+	FEATURE_MEDIUM_CANREAD | FEATURE_MEDIUM_CANWRITE,
+	(FN_MEDIUM_STARTUP)&_null_startUp,
+	(FN_MEDIUM_ISINSERTED)&_null_startUp,
+	(FN_MEDIUM_READSECTORS)&_null_readSectors,
+	(FN_MEDIUM_WRITESECTORS)&_null_writeSectors,
+	(FN_MEDIUM_CLEARSTATUS)&_null_startUp,
+	(FN_MEDIUM_SHUTDOWN)&_null_startUp
+};
+
+static bool _replay_cache (const TRACE_REQUEST* trace, u32 length, u32 numberOfPages, REPLAY_RESULT* result) {
+	CACHE* cache;
+	u8 data[BYTES_PER_READ] = {0};
+	u32 i, m;
+
+	cache = _FAT_cache_constructor (numberOfPages, CACHE_PAGE_SECTOR, 0, 0, CACHE_FREE, &_io_null);
+	if (cache == NULL) {
+		return false;
+	}
+
+	for (i = 0; i < length; i++) {
+		switch (trace[i].type) {
+			case 'r':
+				_FAT_cache_readPartialSector (cache, data, trace[i].sector, 0, REPLAY_READ_SIZE);
+				break;
+			case 'w':
+				_FAT_cache_writePartialSector (cache, data, trace[i].sector, 0, REPLAY_READ_SIZE);
+				break;
+			case 'e':
+				_FAT_cache_eraseWritePartialSector (cache, data, trace[i].sector, 0, REPLAY_READ_SIZE);
+				break;
+			case 'c':
+				// One sector at a time, since the trace doesn't hold the data
+				for (m = 0; m < trace[i].count; m++) {
+					_FAT_cache_writePartialSector_check (cache, trace[i].sector + m, 1, data);
+				}
+				break;
+			case 'f':
+				_FAT_cache_flush (cache);
+				break;
+			case 'i':
+				_FAT_cache_invalidate (cache);
+				break;
+		}
+	}
+	_FAT_cache_flush (cache);
+
+	result->hits = cache->stats.hits;
+	result->misses = cache->stats.misses;
+	result->sectorsWritten = cache->stats.sectorsWritten;
+	_FAT_cache_destructor (cache);
+	return true;
+}
+
+static TRACE_REQUEST* _replay_load (const char* path, u32* length) {
+	TRACE_REQUEST* trace = NULL;
+	TRACE_REQUEST request;
+	u32 space = 0;
+	char line[64];
+	FILE* file;
+
+	file = fopen (path, "r");
+	if (file == NULL) {
+		return NULL;
+	}
+
+	*length = 0;
+	while (fgets (line, sizeof(line), file) != NULL) {
+		request.type = line[0];
+		request.sector = 0;
+		request.count = 0;
+		if ((sscanf (line + 1, "%u %u", &request.sector, &request.count) < 1)
+			&& (request.type != 'f') && (request.type != 'i'))
+		{
+			continue;
+		}
+		if (*length == space) {
+			TRACE_REQUEST* grown;
+
+			space = (space == 0) ? 65536 : space * 2;
+			grown = (TRACE_REQUEST*) realloc (trace, sizeof(TRACE_REQUEST) * space);
+			if (grown == NULL) {
+				free (trace);
+				fclose (file);
+				return NULL;
+			}
+			trace = grown;
+		}
+		trace[(*length)++] = request;
+	}
+
+	fclose (file);
+	if (trace == NULL) {
+		trace = (TRACE_REQUEST*) malloc (sizeof(TRACE_REQUEST));
+	}
+	return trace;
+}
+
+static double _replay_elapsed (const struct timespec* start) {
+	struct timespec end;
+
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static void _replay_print (const char* policy, u32 numberOfPages, u32 requests, const REPLAY_RESULT* result) {
+	u32 lookups = result->hits + result->misses;
+
+	printf ("%-11s %6u %10u %10u %7.2f %10llu ", policy, numberOfPages, result->hits, result->misses,
+		lookups ? result->hits * 100.0 / lookups : 0.0, (unsigned long long)result->sectorsWritten);
+	if (result->pagesScanned != 0) {
+		printf ("%10.1f", (double)result->pagesScanned / lookups);
+	} else {
+		printf ("%10s", "-");
+	}
+	printf (" %10.1f\n", requests ? result->hostMs * 1000000.0 / requests : 0.0);
+}
+
+int main (int argc, char* argv[]) {
+	u32 sizes[REPLAY_MAX_SIZES] = {8, 64, 256, 1024};
+	u32 numberOfSizes = 4;
+	TRACE_REQUEST* trace;
+	REPLAY_RESULT result;
+	struct timespec start;
+	u32 length, i;
+	char* next;
+	int option;
+
+	while ((option = getopt (argc, argv, "p:")) != -1) {
+		switch (option) {
+			case 'p':
+				numberOfSizes = 0;
+				for (next = optarg; (*next != '\0') && (numberOfSizes < REPLAY_MAX_SIZES); ) {
+					sizes[numberOfSizes] = strtoul (next, &next, 10);
+					if (sizes[numberOfSizes] >= 2) {
+						numberOfSizes++;
+					}
+					if (*next == ',') {
+						next++;
+					} else if (*next != '\0') {
+						break;
+					}
+				}
+				break;
+			default:
+				fprintf (stderr, "usage: %s [-p pages,...] trace\n", argv[0]);
+				return 2;
+		}
+	}
+	if ((optind >= argc) || (numberOfSizes == 0)) {
+		fprintf (stderr, "usage: %s [-p pages,...] trace\n", argv[0]);
+		return 2;
+	}
+
+	trace = _replay_load (argv[optind], &length);
+	if (trace == NULL) {
+		fprintf (stderr, "cachereplay: can't read %s\n", argv[optind]);
+		return 1;
+	}
+	printf ("%u requests from %s\n", length, argv[optind]);
+	printf ("%-11s %6s %10s %10s %7s %10s %10s %10s\n", "policy", "pages", "hits", "misses",
+		"hit %", "wr sect", "scan/req", "host ns");
+
+	for (i = 0; i < numberOfSizes; i++) {
+		memset (&result, 0, sizeof(REPLAY_RESULT));
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		if (!_replay_reference (trace, length, sizes[i], &result)) {
+			fprintf (stderr, "cachereplay: out of memory for %u pages\n", sizes[i]);
+			return 1;
+		}
+		result.hostMs = _replay_elapsed (&start);
+		_replay_print ("least used", sizes[i], length, &result);
+
+		memset (&result, 0, sizeof(REPLAY_RESULT));
+		clock_gettime (CLOCK_MONOTONIC, &start);
+		if (!_replay_cache (trace, length, sizes[i], &result)) {
+			fprintf (stderr, "cachereplay: out of memory for %u pages\n", sizes[i]);
+			return 1;
+		}
+		result.hostMs = _replay_elapsed (&start);
+		_replay_print ("segmented", sizes[i], length, &result);
+	}
+
+	free (trace);
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ ds2_host.c
+
+ Stand-ins for the parts of the DS2 SDK that libfat links against, so the
+ library can be built and run on a host PC against a disc image.
+ The SD card driver is always absent; use _io_image with
+ fatMountCustomInterface instead.
+*/
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "ds2io.h"
+#include "ds2_mmc_api.h"
+
+// ds2_malloc.h renames these to the libc functions in everything else
+void* Drv_alloc (unsigned int nbytes) {
+	return malloc (nbytes);
+}
+
+void Drv_deAlloc (void* address) {
+	free (address);
+}
+
+void* Drv_realloc (void* address, unsigned int nbytes) {
+	return realloc (address, nbytes);
+}
+
+void* Drv_calloc (unsigned int nmem, unsigned int size) {
+	return calloc (nmem, size);
+}
+
+void ds2_getTime (struct rtc* rtcTime) {
+	time_t now = time (NULL);
+	struct tm* local = localtime (&now);
+
+	rtcTime->year = local->tm_year - 100;
+	rtcTime->month = local->tm_mon + 1;
+	rtcTime->day = local->tm_mday;
+	rtcTime->weekday = local->tm_wday;
+	// The DS RTC adds 40 to afternoon hours
+	rtcTime->hours = (local->tm_hour >= 12) ? local->tm_hour + 40 : local->tm_hour;
+	rtcTime->minutes = local->tm_min;
+	rtcTime->seconds = local->tm_sec;
+}
+
+int MMC_Initialize (void) {
+	return -1;
+}
+
+int MMC_ReadBlock (unsigned int blockaddr, unsigned char* recbuf) {
+	return -1;
+}
+
+int MMC_ReadMultiBlock (unsigned int blockaddr, unsigned int blocknum, unsigned char* recbuf) {
+	return -1;
+}
+
+int MMC_WriteBlock (unsigned int blockaddr, unsigned char* recbuf) {
+	return -1;
+}
+
+int MMC_WriteMultiBlock (unsigned int blockaddr, unsigned int blocknum, unsigned char* recbuf) {
+	return -1;
+}
@@ -0,0 +1,447 @@
+/*
+ fatbench.c
+
+ Times common file system workloads against a disc image through the same
+ fat_* calls the DS2 programs use. For each workload it prints the host
+ time and the card commands, sectors and simulated card time it caused,
+ the last being the number to compare between builds, followed by the
+ cache hits and misses and FAT entry lookups reported by fat_getStats.
+
+ Usage: fatbench [options] [image]
+	-t 16|32	File system type of the formatted image (default 32)
+	-m MB		Size of the formatted image (default 256)
+	-k			Keep the existing image instead of formatting it
+	-n count	Number of small files (default 500)
+	-s KB		Size of each small file (default 16)
+	-b MB		Size of the large file (default 16)
+	-p pages	Number of cache pages (default 64)
+	-l us		Simulated latency of each card command (default 500)
+	-c us		Simulated cost of each sector (default 100)
+	-r file		Record the requests made of the cache to file, for cachereplay
+
+ After the timed workloads, a "churn" pass remounts the image with a small
+ cache that reads ahead, then creates, rewrites, removes and reads back
+ files in a few directories in a random but repeatable order, checking
+ every file and directory listing as it goes and after a remount. With so
+ few pages, pages read ahead keep pushing out dirty pages next to each
+ other, so this catches the cache mixing up the two. fatbench exits with
+ an error if anything read back is wrong.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fs_api.h"
+#include "partition.h"
+#include "fs_cache.h"
+#include "io_image.h"
+#include "cache_trace.h"
+
+// fs_api.h sends fprintf to the FAT files, keep the C library's for messages
+#undef fprintf
+
+// fat.h needs NDS headers, so declare the parts of libfat.c used here
+extern bool fatMountCustomInterfaceEx (const IO_INTERFACE* device, u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead);
+extern bool fatUnmount (PARTITION_INTERFACE partitionNumber);
+extern bool fatSetDefaultInterface (PARTITION_INTERFACE partitionNumber);
+
+#define BENCH_READ_AHEAD 8
+#define BENCH_SMALL_CHUNK 4096
+#define BENCH_LARGE_CHUNK 65536
+#define BENCH_DIRECTORIES 64
+#define BENCH_READDIR_PASSES 4
+
+#define CHURN_PAGES 8
+#define CHURN_SEEDS 4
+#define CHURN_DIRECTORIES 8
+#define CHURN_FILES 96
+#define CHURN_OPS 2000
+#define CHURN_CHECK_EVERY 250
+#define CHURN_MAX_SIZE (40 * 1024)
+
+static struct timespec _bench_start;
+static u8 _bench_buffer[BENCH_LARGE_CHUNK];
+static u8 _bench_expected[BENCH_LARGE_CHUNK];
+
+static void _bench_begin (void) {
+	IMAGE_STATS stats;
+
+	_IMAGE_GetStats (&stats, true);
+	fat_resetStats ();
+	clock_gettime (CLOCK_MONOTONIC, &_bench_start);
+}
+
+static void _bench_end (const char* name, u32 ops) {
+	struct timespec end;
+	IMAGE_STATS stats;
+	FAT_STATS fatStats;
+	double hostMs;
+
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	_IMAGE_GetStats (&stats, true);
+	if (fat_getStats (&fatStats) != 0) {
+		// Not mounted any more after unmount
+		memset (&fatStats, 0, sizeof(FAT_STATS));
+	}
+	hostMs = (end.tv_sec - _bench_start.tv_sec) * 1000.0 + (end.tv_nsec - _bench_start.tv_nsec) / 1000000.0;
+
+	printf ("%-10s %7u %10.2f %8u %10llu %8u %10llu %12.2f %8u %8u %8u\n", name, ops, hostMs,
+		stats.readCommands, stats.sectorsRead, stats.writeCommands, stats.sectorsWritten,
+		stats.simulatedMicroseconds / 1000.0,
+		fatStats.cache.hits, fatStats.cache.misses, fatStats.partition.fatLookups);
+}
+
+static void _bench_fill (u8* buffer, u32 size, u32 seed) {
+	u32 i;
+
+	for (i = 0; i < size; i++) {
+		buffer[i] = (u8)(seed * 31 + i * 7 + (i >> 8));
+	}
+}
+
+static bool _bench_writeFile (const char* path, u32 size, u32 chunk, u32 seed) {
+	FILE_STRUCT* fp;
+	u32 done, length;
+
+	fp = fat_fopen (path, "wb");
+	if (fp == NULL) {
+		return false;
+	}
+	for (done = 0; done < size; done += length) {
+		length = (size - done < chunk) ? size - done : chunk;
+		_bench_fill (_bench_buffer, length, seed + done);
+		if (fat_fwrite (_bench_buffer, 1, length, fp) != length) {
+			fat_fclose (fp);
+			return false;
+		}
+	}
+	return (fat_fclose (fp) == 0);
+}
+
+static bool _bench_readFile (const char* path, u32 size, u32 chunk, u32 seed) {
+	FILE_STRUCT* fp;
+	u32 done, length;
+
+	fp = fat_fopen (path, "rb");
+	if (fp == NULL) {
+		return false;
+	}
+	for (done = 0; done < size; done += length) {
+		length = (size - done < chunk) ? size - done : chunk;
+		_bench_fill (_bench_expected, length, seed + done);
+		if ((fat_fread (_bench_buffer, 1, length, fp) != length)
+			|| (memcmp (_bench_buffer, _bench_expected, length) != 0))
+		{
+			fat_fclose (fp);
+			return false;
+		}
+	}
+	fat_fclose (fp);
+	return true;
+}
+
+static void _bench_smallName (char* path, u32 i) {
+	// Lead with the number, since only 99 long names can share an alias prefix
+	sprintf (path, "fat:/bench/flat/%05u is a small file.bin", i);
+}
+
+static int _bench_fail (const char* what, const char* path) {
+	fprintf (stderr, "fatbench: %s failed on %s\n", what, path);
+	return 1;
+}
+
+typedef struct {
+	bool exists;
+	u32 size;
+	u32 chunk;
+	u32 seed;
+} CHURN_FILE;
+
+static CHURN_FILE _churn_files[CHURN_FILES];
+
+static u32 _churn_random (u32* state) {
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+static void _churn_name (char* path, u32 seed, u32 i) {
+	sprintf (path, "fat:/churn %u/directory %u/churn file %03u.bin", seed, i % CHURN_DIRECTORIES, i);
+}
+
+/*
+Read back every file that should exist, and check that each directory
+lists exactly those files, with the right sizes
+*/
+static bool _churn_check (u32 seed, char* path) {
+	DIR_STATE_STRUCT* dir;
+	DIR_ENTRY* entry;
+	struct stat st;
+	u32 i, d, listed, expected;
+
+	for (i = 0; i < CHURN_FILES; i++) {
+		_churn_name (path, seed, i);
+		if (_churn_files[i].exists
+			&& !_bench_readFile (path, _churn_files[i].size, _churn_files[i].chunk, _churn_files[i].seed))
+		{
+			return false;
+		}
+	}
+
+	for (d = 0; d < CHURN_DIRECTORIES; d++) {
+		sprintf (path, "fat:/churn %u/directory %u", seed, d);
+		dir = fat_opendir (path);
+		if (dir == NULL) {
+			return false;
+		}
+		listed = 0;
+		while ((entry = fat_readdir_ex (dir, &st)) != NULL) {
+			if ((strcmp (entry->d_name, ".") == 0) || (strcmp (entry->d_name, "..") == 0)) {
+				continue;
+			}
+			if ((sscanf (entry->d_name, "churn file %u.bin", &i) != 1) || (i >= CHURN_FILES)
+				|| (i % CHURN_DIRECTORIES != d) || !_churn_files[i].exists
+				|| ((u32)st.st_size != _churn_files[i].size))
+			{
+				fat_closedir (dir);
+				return false;
+			}
+			listed++;
+		}
+		fat_closedir (dir);
+		for (expected = 0, i = d; i < CHURN_FILES; i += CHURN_DIRECTORIES) {
+			expected += _churn_files[i].exists;
+		}
+		if (listed != expected) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int _churn_run (const char* image, u32 seed) {
+	char path[256];
+	u32 state = seed;
+	u32 op, i, d;
+
+	if (!fatMountCustomInterfaceEx (&_io_image, CHURN_PAGES, CACHE_PAGE_SECTOR, BENCH_READ_AHEAD)
+		|| !fatSetDefaultInterface (PI_CUSTOM))
+	{
+		return _bench_fail ("churn mount", image);
+	}
+
+	memset (_churn_files, 0, sizeof(_churn_files));
+	sprintf (path, "fat:/churn %u", seed);
+	if (fat_mkdir (path, 0777) != 0) {
+		return _bench_fail ("churn mkdir", path);
+	}
+	for (d = 0; d < CHURN_DIRECTORIES; d++) {
+		sprintf (path, "fat:/churn %u/directory %u", seed, d);
+		if (fat_mkdir (path, 0777) != 0) {
+			return _bench_fail ("churn mkdir", path);
+		}
+	}
+
+	for (op = 1; op <= CHURN_OPS; op++) {
+		i = _churn_random (&state) % CHURN_FILES;
+		_churn_name (path, seed, i);
+		switch (_churn_files[i].exists ? _churn_random (&state) % 3 : 0) {
+			case 0:
+				// Create, or write over with a new size
+				_churn_files[i].size = _churn_random (&state) % (CHURN_MAX_SIZE + 1);
+				_churn_files[i].chunk = 512 << (_churn_random (&state) % 5);
+				_churn_files[i].seed = _churn_random (&state);
+				_churn_files[i].exists = true;
+				if (!_bench_writeFile (path, _churn_files[i].size, _churn_files[i].chunk, _churn_files[i].seed)) {
+					return _bench_fail ("churn write", path);
+				}
+				break;
+			case 1:
+				if (!_bench_readFile (path, _churn_files[i].size, _churn_files[i].chunk, _churn_files[i].seed)) {
+					return _bench_fail ("churn read", path);
+				}
+				break;
+			case 2:
+				_churn_files[i].exists = false;
+				if (fat_remove (path) != 0) {
+					return _bench_fail ("churn remove", path);
+				}
+				break;
+		}
+		if ((op % CHURN_CHECK_EVERY == 0) && !_churn_check (seed, path)) {
+			return _bench_fail ("churn check", path);
+		}
+	}
+
+	// Everything must also have reached the disc
+	if (!fatUnmount (PI_CUSTOM)) {
+		return _bench_fail ("churn unmount", image);
+	}
+	if (!fatMountCustomInterfaceEx (&_io_image, CHURN_PAGES, CACHE_PAGE_SECTOR, BENCH_READ_AHEAD)
+		|| !fatSetDefaultInterface (PI_CUSTOM))
+	{
+		return _bench_fail ("churn mount", image);
+	}
+	if (!_churn_check (seed, path)) {
+		return _bench_fail ("churn check after remount", path);
+	}
+	if (!fatUnmount (PI_CUSTOM)) {
+		return _bench_fail ("churn unmount", image);
+	}
+	return 0;
+}
+
+int main (int argc, char* argv[]) {
+	const char* image = "fatbench.img";
+	const char* trace = NULL;
+	u32 fatType = 32, sizeMB = 256, smallFiles = 500, smallKB = 16, largeMB = 16;
+	u32 cachePages = 64, latency = 500, sectorCost = 100;
+	bool keep = false;
+	char path[256];
+	DIR_STATE_STRUCT* dir;
+	u32 i, pass, entries;
+	int option;
+
+	while ((option = getopt (argc, argv, "t:m:kn:s:b:p:l:c:r:")) != -1) {
+		switch (option) {
+			case 't': fatType = atoi (optarg); break;
+			case 'm': sizeMB = atoi (optarg); break;
+			case 'k': keep = true; break;
+			case 'n': smallFiles = atoi (optarg); break;
+			case 's': smallKB = atoi (optarg); break;
+			case 'b': largeMB = atoi (optarg); break;
+			case 'p': cachePages = atoi (optarg); break;
+			case 'l': latency = atoi (optarg); break;
+			case 'c': sectorCost = atoi (optarg); break;
+			case 'r': trace = optarg; break;
+			default:
+				fprintf (stderr, "usage: %s [-t 16|32] [-m MB] [-k] [-n count] [-s KB] [-b MB] [-p pages] [-l us] [-c us] [-r file] [image]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (optind < argc) {
+		image = argv[optind];
+	}
+
+	if (!keep && !_IMAGE_Format (image, sizeMB, fatType == 32)) {
+		fprintf (stderr, "fatbench: can't make a %u MB FAT%u image in %s\n", sizeMB, fatType, image);
+		return 1;
+	}
+	if (!_IMAGE_Open (image, latency, sectorCost)) {
+		fprintf (stderr, "fatbench: can't open %s\n", image);
+		return 1;
+	}
+	if ((trace != NULL) && !_TRACE_Open (trace)) {
+		fprintf (stderr, "fatbench: can't write %s\n", trace);
+		return 1;
+	}
+
+	printf ("%-10s %7s %10s %8s %10s %8s %10s %12s %8s %8s %8s\n", "workload", "ops", "host ms",
+		"rd cmds", "rd sect", "wr cmds", "wr sect", "device ms", "hits", "misses", "fat rd");
+
+	_bench_begin ();
+	if (!fatMountCustomInterfaceEx (&_io_image, cachePages, CACHE_PAGE_SECTOR, BENCH_READ_AHEAD)
+		|| !fatSetDefaultInterface (PI_CUSTOM))
+	{
+		return _bench_fail ("mount", image);
+	}
+	_bench_end ("mount", 1);
+
+	_bench_begin ();
+	fat_mkdir ("fat:/bench", 0777);
+	fat_mkdir ("fat:/bench/flat", 0777);
+	for (i = 0; i < BENCH_DIRECTORIES; i++) {
+		sprintf (path, "fat:/bench/directory %03u", i);
+		if (fat_mkdir (path, 0777) != 0) {
+			return _bench_fail ("mkdir", path);
+		}
+	}
+	_bench_end ("mkdir", BENCH_DIRECTORIES);
+
+	_bench_begin ();
+	for (i = 0; i < smallFiles; i++) {
+		_bench_smallName (path, i);
+		if (!_bench_writeFile (path, smallKB * 1024, BENCH_SMALL_CHUNK, i)) {
+			return _bench_fail ("write", path);
+		}
+	}
+	_bench_end ("create", smallFiles);
+
+	_bench_begin ();
+	for (i = 0; i < smallFiles; i++) {
+		FILE_STRUCT* fp;
+
+		_bench_smallName (path, i);
+		fp = fat_fopen (path, "rb");
+		if (fp == NULL) {
+			return _bench_fail ("open", path);
+		}
+		fat_fclose (fp);
+	}
+	_bench_end ("open", smallFiles);
+
+	_bench_begin ();
+	for (i = 0; i < smallFiles; i++) {
+		_bench_smallName (path, i);
+		if (!_bench_readFile (path, smallKB * 1024, BENCH_SMALL_CHUNK, i)) {
+			return _bench_fail ("read", path);
+		}
+	}
+	_bench_end ("read", smallFiles);
+
+	_bench_begin ();
+	for (pass = 0; pass < BENCH_READDIR_PASSES; pass++) {
+		dir = fat_opendir ("fat:/bench/flat");
+		if (dir == NULL) {
+			return _bench_fail ("opendir", "fat:/bench/flat");
+		}
+		for (entries = 0; fat_readdir (dir) != NULL; entries++) ;
+		fat_closedir (dir);
+		if (entries < smallFiles) {
+			return _bench_fail ("readdir", "fat:/bench/flat");
+		}
+	}
+	_bench_end ("readdir", BENCH_READDIR_PASSES);
+
+	_bench_begin ();
+	if (!_bench_writeFile ("fat:/bench/large.bin", largeMB * 1024 * 1024, BENCH_LARGE_CHUNK, 0)) {
+		return _bench_fail ("write", "fat:/bench/large.bin");
+	}
+	_bench_end ("seq write", 1);
+
+	_bench_begin ();
+	if (!_bench_readFile ("fat:/bench/large.bin", largeMB * 1024 * 1024, BENCH_LARGE_CHUNK, 0)) {
+		return _bench_fail ("read", "fat:/bench/large.bin");
+	}
+	_bench_end ("seq read", 1);
+
+	_bench_begin ();
+	for (i = 0; i < smallFiles; i++) {
+		_bench_smallName (path, i);
+		if (fat_remove (path) != 0) {
+			return _bench_fail ("remove", path);
+		}
+	}
+	_bench_end ("remove", smallFiles);
+
+	_bench_begin ();
+	if (!fatUnmount (PI_CUSTOM)) {
+		return _bench_fail ("unmount", image);
+	}
+	_bench_end ("unmount", 1);
+
+	_bench_begin ();
+	for (i = 1; i <= CHURN_SEEDS; i++) {
+		if (_churn_run (image, i) != 0) {
+			fprintf (stderr, "fatbench: churn seed %u found the disc in a bad state\n", i);
+			return 1;
+		}
+	}
+	_bench_end ("churn", CHURN_SEEDS * CHURN_OPS);
+
+	_TRACE_Close ();
+	_IMAGE_Close ();
+	return 0;
+}
@@ -0,0 +1,270 @@
+/*
+ io_image.c
+
+ Disc image IO_INTERFACE for building and measuring libfat on a host PC.
+ See io_image.h for details.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "io_image.h"
+#include "bit_ops.h"
+
+#define IMAGE_MEDIA_DESCRIPTOR 0xF8
+#define IMAGE_FAT16_ROOT_ENTRIES 512
+#define IMAGE_FAT16_RESERVED_SECTORS 1
+#define IMAGE_FAT32_RESERVED_SECTORS 32
+#define IMAGE_FAT32_FSINFO_SECTOR 1
+#define IMAGE_FAT32_BACKUP_BOOT_SECTOR 6
+#define IMAGE_NUM_FATS 2
+#define IMAGE_DIR_ENTRY_SIZE 32
+#define IMAGE_FAT32_ROOT_CLUSTER 2
+
+// Cluster count limits, the same ones the partition code uses to tell the types apart
+#define IMAGE_MIN_FAT16_CLUSTERS 4085
+#define IMAGE_MIN_FAT32_CLUSTERS 65525
+
+static int _IMAGE_fd = -1;
+static u32 _IMAGE_commandLatency;
+static u32 _IMAGE_sectorCost;
+static IMAGE_STATS _IMAGE_stats;
+
+static bool _IMAGE_WriteAt (int fd, u32 sector, const u8* buffer, u32 numSectors) {
+	size_t remain = numSectors * BYTES_PER_READ;
+	off_t offset = (off_t)sector * BYTES_PER_READ;
+	ssize_t done;
+
+	while (remain > 0) {
+		done = pwrite (fd, buffer, remain, offset);
+		if (done <= 0) {
+			return false;
+		}
+		buffer += done;
+		offset += done;
+		remain -= done;
+	}
+	return true;
+}
+
+static bool _IMAGE_ReadAt (int fd, u32 sector, u8* buffer, u32 numSectors) {
+	size_t remain = numSectors * BYTES_PER_READ;
+	off_t offset = (off_t)sector * BYTES_PER_READ;
+	ssize_t done;
+
+	while (remain > 0) {
+		done = pread (fd, buffer, remain, offset);
+		if (done < 0) {
+			return false;
+		}
+		if (done == 0) {
+			// Past the end of a short image reads as blank
+			memset (buffer, 0, remain);
+			break;
+		}
+		buffer += done;
+		offset += done;
+		remain -= done;
+	}
+	return true;
+}
+
+bool _IMAGE_Format (const char* path, u32 sizeMB, bool fat32) {
+	u8 sector[BYTES_PER_READ];
+	u32 totalSectors = sizeMB * (1024 * 1024 / BYTES_PER_READ);
+	u32 reservedSectors, rootSectors, sectorsPerCluster, fatSectors, clusters, needed;
+	u32 entryBytes = fat32 ? 4 : 2;
+	int fd;
+	int i;
+	bool ok;
+
+	if (fat32) {
+		reservedSectors = IMAGE_FAT32_RESERVED_SECTORS;
+		rootSectors = 0;
+		if (sizeMB <= 260) {
+			sectorsPerCluster = 1;
+		} else if (sizeMB <= 8 * 1024) {
+			sectorsPerCluster = 8;
+		} else if (sizeMB <= 16 * 1024) {
+			sectorsPerCluster = 16;
+		} else {
+			sectorsPerCluster = 32;
+		}
+	} else {
+		reservedSectors = IMAGE_FAT16_RESERVED_SECTORS;
+		rootSectors = IMAGE_FAT16_ROOT_ENTRIES * IMAGE_DIR_ENTRY_SIZE / BYTES_PER_READ;
+		// Use the smallest clusters that keep the count in range for FAT16
+		for (sectorsPerCluster = 1;
+			(sectorsPerCluster < 128) && (totalSectors / sectorsPerCluster >= IMAGE_MIN_FAT32_CLUSTERS);
+			sectorsPerCluster *= 2) ;
+	}
+
+	// The FAT's size depends on the number of clusters, which depends on the FAT's size
+	fatSectors = 1;
+	for (;;) {
+		if (totalSectors <= reservedSectors + IMAGE_NUM_FATS * fatSectors + rootSectors) {
+			return false;
+		}
+		clusters = (totalSectors - reservedSectors - IMAGE_NUM_FATS * fatSectors - rootSectors) / sectorsPerCluster;
+		needed = ((clusters + 2) * entryBytes + BYTES_PER_READ - 1) / BYTES_PER_READ;
+		if (needed <= fatSectors) {
+			break;
+		}
+		fatSectors = needed;
+	}
+
+	if (fat32 ? (clusters < IMAGE_MIN_FAT32_CLUSTERS)
+		: ((clusters < IMAGE_MIN_FAT16_CLUSTERS) || (clusters >= IMAGE_MIN_FAT32_CLUSTERS)))
+	{
+		// Wrong size for the requested type
+		return false;
+	}
+
+	fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	ok = (ftruncate (fd, (off_t)totalSectors * BYTES_PER_READ) == 0);
+
+	// Boot sector
+	memset (sector, 0, BYTES_PER_READ);
+	sector[0x00] = 0xEB;
+	sector[0x01] = fat32 ? 0x58 : 0x3C;
+	sector[0x02] = 0x90;
+	memcpy (sector + 0x03, "LIBFAT  ", 8);
+	u16_to_u8array (sector, 0x0B, BYTES_PER_READ);
+	sector[0x0D] = sectorsPerCluster;
+	u16_to_u8array (sector, 0x0E, reservedSectors);
+	sector[0x10] = IMAGE_NUM_FATS;
+	u16_to_u8array (sector, 0x11, fat32 ? 0 : IMAGE_FAT16_ROOT_ENTRIES);
+	if (totalSectors < 0x10000) {
+		u16_to_u8array (sector, 0x13, totalSectors);
+	} else {
+		u32_to_u8array (sector, 0x20, totalSectors);
+	}
+	sector[0x15] = IMAGE_MEDIA_DESCRIPTOR;
+	u16_to_u8array (sector, 0x18, 63);
+	u16_to_u8array (sector, 0x1A, 255);
+	if (fat32) {
+		u32_to_u8array (sector, 0x24, fatSectors);
+		u32_to_u8array (sector, 0x2C, IMAGE_FAT32_ROOT_CLUSTER);
+		u16_to_u8array (sector, 0x30, IMAGE_FAT32_FSINFO_SECTOR);
+		u16_to_u8array (sector, 0x32, IMAGE_FAT32_BACKUP_BOOT_SECTOR);
+		sector[0x40] = 0x80;
+		sector[0x42] = 0x29;
+		u32_to_u8array (sector, 0x43, (u32)time (NULL));
+		memcpy (sector + 0x47, "NO NAME    FAT32   ", 19);
+	} else {
+		u16_to_u8array (sector, 0x16, fatSectors);
+		sector[0x24] = 0x80;
+		sector[0x26] = 0x29;
+		u32_to_u8array (sector, 0x27, (u32)time (NULL));
+		memcpy (sector + 0x2B, "NO NAME    FAT16   ", 19);
+	}
+	sector[0x1FE] = 0x55;
+	sector[0x1FF] = 0xAA;
+	ok = ok && _IMAGE_WriteAt (fd, 0, sector, 1);
+	if (fat32) {
+		ok = ok && _IMAGE_WriteAt (fd, IMAGE_FAT32_BACKUP_BOOT_SECTOR, sector, 1);
+
+		// FSInfo sector, with the root directory's cluster already taken
+		memset (sector, 0, BYTES_PER_READ);
+		u32_to_u8array (sector, 0x000, 0x41615252);
+		u32_to_u8array (sector, 0x1E4, 0x61417272);
+		u32_to_u8array (sector, 0x1E8, clusters - 1);
+		u32_to_u8array (sector, 0x1EC, IMAGE_FAT32_ROOT_CLUSTER + 1);
+		u32_to_u8array (sector, 0x1FC, 0xAA550000);
+		ok = ok && _IMAGE_WriteAt (fd, IMAGE_FAT32_FSINFO_SECTOR, sector, 1);
+		ok = ok && _IMAGE_WriteAt (fd, IMAGE_FAT32_BACKUP_BOOT_SECTOR + IMAGE_FAT32_FSINFO_SECTOR, sector, 1);
+	}
+
+	// First sector of each FAT: the media descriptor, end of chain marker
+	// and for FAT32 the root directory's cluster
+	memset (sector, 0, BYTES_PER_READ);
+	if (fat32) {
+		u32_to_u8array (sector, 0, 0x0FFFFF00 | IMAGE_MEDIA_DESCRIPTOR);
+		u32_to_u8array (sector, 4, 0x0FFFFFFF);
+		u32_to_u8array (sector, 8, 0x0FFFFFFF);
+	} else {
+		u16_to_u8array (sector, 0, 0xFF00 | IMAGE_MEDIA_DESCRIPTOR);
+		u16_to_u8array (sector, 2, 0xFFFF);
+	}
+	for (i = 0; i < IMAGE_NUM_FATS; i++) {
+		ok = ok && _IMAGE_WriteAt (fd, reservedSectors + i * fatSectors, sector, 1);
+	}
+
+	// The rest of the FATs and the root directory are left as the zeros ftruncate gave us
+	ok = (close (fd) == 0) && ok;
+	return ok;
+}
+
+bool _IMAGE_Open (const char* path, u32 commandLatency, u32 sectorCost) {
+	_IMAGE_Close ();
+
+	_IMAGE_fd = open (path, O_RDWR);
+	if (_IMAGE_fd < 0) {
+		return false;
+	}
+	_IMAGE_commandLatency = commandLatency;
+	_IMAGE_sectorCost = sectorCost;
+	memset (&_IMAGE_stats, 0, sizeof(IMAGE_STATS));
+	return true;
+}
+
+void _IMAGE_Close (void) {
+	if (_IMAGE_fd >= 0) {
+		close (_IMAGE_fd);
+		_IMAGE_fd = -1;
+	}
+}
+
+void _IMAGE_GetStats (IMAGE_STATS* stats, bool reset) {
+	*stats = _IMAGE_stats;
+	if (reset) {
+		memset (&_IMAGE_stats, 0, sizeof(IMAGE_STATS));
+	}
+}
+
+static bool _IMAGE_StartUp (void) {
+	return (_IMAGE_fd >= 0);
+}
+
+static bool _IMAGE_IsInserted (void) {
+	return (_IMAGE_fd >= 0);
+}
+
+static bool _IMAGE_ReadSectors (unsigned long sector, unsigned long numSectors, void* buffer) {
+	++ _IMAGE_stats.readCommands;
+	_IMAGE_stats.sectorsRead += numSectors;
+	_IMAGE_stats.simulatedMicroseconds += _IMAGE_commandLatency + (u64)numSectors * _IMAGE_sectorCost;
+	return (_IMAGE_fd >= 0) && _IMAGE_ReadAt (_IMAGE_fd, sector, (u8*)buffer, numSectors);
+}
+
+static bool _IMAGE_WriteSectors (unsigned long sector, unsigned long numSectors, const void* buffer) {
+	++ _IMAGE_stats.writeCommands;
+	_IMAGE_stats.sectorsWritten += numSectors;
+	_IMAGE_stats.simulatedMicroseconds += _IMAGE_commandLatency + (u64)numSectors * _IMAGE_sectorCost;
+	return (_IMAGE_fd >= 0) && _IMAGE_WriteAt (_IMAGE_fd, sector, (const u8*)buffer, numSectors);
+}
+
+static bool _IMAGE_ClearStatus (void) {
+	return true;
+}
+
+static bool _IMAGE_ShutDown (void) {
+	return true;
+}
+
+const IO_INTERFACE _io_image = {
+	DEVICE_TYPE_IMAGE,
+	FEATURE_MEDIUM_CANREAD | FEATURE_MEDIUM_CANWRITE,
+	(FN_MEDIUM_STARTUP)&_IMAGE_StartUp,
+	(FN_MEDIUM_ISINSERTED)&_IMAGE_IsInserted,
+	(FN_MEDIUM_READSECTORS)&_IMAGE_ReadSectors,
+	(FN_MEDIUM_WRITESECTORS)&_IMAGE_WriteSectors,
+	(FN_MEDIUM_CLEARSTATUS)&_IMAGE_ClearStatus,
+	(FN_MEDIUM_SHUTDOWN)&_IMAGE_ShutDown
+};
@@ -0,0 +1,55 @@
+/*
+ io_image.h
+
+ Disc image IO_INTERFACE for building and measuring libfat on a host PC.
+
+ Sectors are read from and written to a plain file holding a FAT16 or
+ FAT32 volume. Each command is charged a fixed latency plus a cost per
+ sector, which adds up to the time the same accesses would have taken on
+ the card, so changes to the library can be compared without hardware.
+*/
+
+#ifndef _IO_IMAGE_H
+#define _IO_IMAGE_H
+
+// 'IMGF'
+#define DEVICE_TYPE_IMAGE 0x46474D49
+
+#include "disc_io.h"
+
+typedef struct {
+	u32 readCommands;
+	u32 writeCommands;
+	u64 sectorsRead;
+	u64 sectorsWritten;
+	u64 simulatedMicroseconds;	// Command latency plus per sector cost of every access
+} IMAGE_STATS;
+
+// export interface
+extern const IO_INTERFACE _io_image ;
+
+/*
+Create a blank, unpartitioned volume of sizeMB megabytes in the file at path.
+fat32 selects FAT32, otherwise FAT16 is used.
+Returns true on success, false on failure
+*/
+bool _IMAGE_Format (const char* path, u32 sizeMB, bool fat32);
+
+/*
+Select the image that _io_image reads and writes, and the simulated
+latency of each command and cost of each sector, both in microseconds.
+Returns true on success, false on failure
+*/
+bool _IMAGE_Open (const char* path, u32 commandLatency, u32 sectorCost);
+
+/*
+Close the image opened with _IMAGE_Open
+*/
+void _IMAGE_Close (void);
+
+/*
+Copy the access counters into stats, and optionally reset them
+*/
+void _IMAGE_GetStats (IMAGE_STATS* stats, bool reset);
+
+#endif // _IO_IMAGE_H
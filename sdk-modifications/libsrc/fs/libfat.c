@@ -53,9 +53,15 @@
 #include "fatdir.h"
 #include "fs_unicode.h"
 #include "io_ds2_mmcf.h"
+#include "fs_api.h"
 
 #define GBA_DEFAULT_CACHE_PAGES 2
-#define NDS_DEFAULT_CACHE_PAGES 8
+#define NDS_DEFAULT_CACHE_PAGES 64
+
+// One sector per page, reading 8 more sectors at a time when walking the FAT
+// or a directory in order
+#define DEFAULT_CACHE_PAGE_SECTORS CACHE_PAGE_SECTOR
+#define DEFAULT_CACHE_READ_AHEAD 8
 
 #if 0
 const devoptab_t dotab_fat = {
@@ -82,7 +88,11 @@ const devoptab_t dotab_fat = {
 #endif
 
 #if 0
-bool fatInit (u32 cacheSize, bool setAsDefaultDevice) 
+bool fatInit (u32 cacheSize, bool setAsDefaultDevice) {
+	return fatInitEx (cacheSize, CACHE_PAGE_SECTOR, 0, setAsDefaultDevice);
+}
+
+bool fatInitEx (u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead, bool setAsDefaultDevice) 
 {
 #ifdef NDS
 	bool slot1Device, slot2Device;
@@ -92,8 +102,8 @@ bool fatInit (u32 cacheSize, bool setAsDefaultDevice)
 	//_FAT_unicode_init_default();
 
 	// Try mounting both slots
-	slot1Device = _FAT_partition_mount (PI_SLOT_1, cacheSize);
-	slot2Device = _FAT_partition_mount (PI_SLOT_2, cacheSize);
+	slot1Device = _FAT_partition_mount (PI_SLOT_1, cacheSize, cachePageSectors, cacheReadAhead);
+	slot2Device = _FAT_partition_mount (PI_SLOT_2, cacheSize, cachePageSectors, cacheReadAhead);
 	
 	// Choose the default device
 	if (slot1Device) {
@@ -107,7 +117,7 @@ bool fatInit (u32 cacheSize, bool setAsDefaultDevice)
 #else	// not defined NDS
 	bool cartSlotDevice;
 
-	cartSlotDevice = _FAT_partition_mount (PI_CART_SLOT, cacheSize);
+	cartSlotDevice = _FAT_partition_mount (PI_CART_SLOT, cacheSize, cachePageSectors, cacheReadAhead);
 	
 	if (cartSlotDevice) {
 		_FAT_partition_setDefaultInterface (PI_CART_SLOT);
@@ -130,9 +140,9 @@ bool fatInit (u32 cacheSize, bool setAsDefaultDevice)
 #if 0
 bool fatInitDefault (void) {
 #ifdef NDS
-	return fatInit (NDS_DEFAULT_CACHE_PAGES, true);
+	return fatInitEx (NDS_DEFAULT_CACHE_PAGES, DEFAULT_CACHE_PAGE_SECTORS, DEFAULT_CACHE_READ_AHEAD, true);
 #else
-	return fatInit (GBA_DEFAULT_CACHE_PAGES, true);
+	return fatInitEx (GBA_DEFAULT_CACHE_PAGES, DEFAULT_CACHE_PAGE_SECTORS, 0, true);
 #endif
 }
 #endif
@@ -142,7 +152,8 @@ bool _FAT_Init(void)
 	// Try mounting sd/mmc
 	bool sdOK = false;
 	if( _io_ds2_mmcf.fn_startup() == 0)	//NO ERROR
-		sdOK = _FAT_partition_freeMount( PI_DEFAULT, &_io_ds2_mmcf, 8);
+		sdOK = _FAT_partition_freeMount( PI_DEFAULT, &_io_ds2_mmcf, NDS_DEFAULT_CACHE_PAGES,
+			DEFAULT_CACHE_PAGE_SECTORS, DEFAULT_CACHE_READ_AHEAD);
 	else
 		return false;
 
@@ -153,11 +164,19 @@ bool _FAT_Init(void)
 }
 
 bool fatMountNormalInterface (PARTITION_INTERFACE partitionNumber, u32 cacheSize) {
-	return _FAT_partition_mount (partitionNumber, cacheSize);
+	return _FAT_partition_mount (partitionNumber, cacheSize, CACHE_PAGE_SECTOR, 0);
+}
+
+bool fatMountNormalInterfaceEx (PARTITION_INTERFACE partitionNumber, u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead) {
+	return _FAT_partition_mount (partitionNumber, cacheSize, cachePageSectors, cacheReadAhead);
 }
 
 bool fatMountCustomInterface (const IO_INTERFACE* device, u32 cacheSize) {
-	return _FAT_partition_mountCustomInterface (device, cacheSize);
+	return _FAT_partition_mountCustomInterface (device, cacheSize, CACHE_PAGE_SECTOR, 0);
+}
+
+bool fatMountCustomInterfaceEx (const IO_INTERFACE* device, u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead) {
+	return _FAT_partition_mountCustomInterface (device, cacheSize, cachePageSectors, cacheReadAhead);
 }
 
 bool fatUnmount (PARTITION_INTERFACE partitionNumber) {
@@ -40,6 +40,10 @@ static inline void* _FAT_mem_allocate (size_t size) {
 	return ((void*)malloc (size));
 }
 
+static inline void* _FAT_mem_reallocate (void* mem, size_t size) {
+	return ((void*)realloc (mem, size));
+}
+
 static inline void _FAT_mem_free (void* mem) {
 	return (free ((void*)mem));
 }
@@ -103,6 +103,19 @@ enum BPB {
 	BPB_bootSig_AA = 0x1FF
 };
 
+// FAT32 FSInfo sector offsets
+enum FSIB {
+	FSIB_SIG1 = 0x00,
+	FSIB_SIG2 = 0x1E4,
+	FSIB_numberOfFreeCluster = 0x1E8,
+	FSIB_numberLastAllocCluster = 0x1EC,
+	FSIB_bootSig = 0x1FC
+};
+
+#define FSIB_SIG1_VALUE 0x41615252
+#define FSIB_SIG2_VALUE 0x61417272
+#define FSIB_bootSig_VALUE 0xAA550000
+
 
 #ifdef NDS
 #define MAXIMUM_PARTITIONS 4
@@ -115,7 +128,7 @@ PARTITION* _FAT_partitions[MAXIMUM_PARTITIONS] = {NULL};
 // Use a single static buffer for the partitions
 
 
-static PARTITION* _FAT_partition_constructor ( const IO_INTERFACE* disc, u32 cacheSize) {
+static PARTITION* _FAT_partition_constructor ( const IO_INTERFACE* disc, u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead) {
 	PARTITION* partition;
 	int i;
 	u32 bootSector;
@@ -193,6 +206,11 @@ static PARTITION* _FAT_partition_constructor ( const IO_INTERFACE* disc, u32 cac
 	// Store info about FAT
 	partition->fat.lastCluster = (partition->numberOfSectors - partition->dataStart) / partition->sectorsPerCluster;
 	partition->fat.firstFree = CLUSTER_FIRST;
+	partition->fat.numberFree = CLUSTER_COUNT_UNKNOWN;
+	partition->fat.usedBitmap = NULL;
+	partition->fat.fsInfoSector = 0;
+	partition->fat.fsInfoFree = CLUSTER_COUNT_UNKNOWN;
+	partition->fat.fsInfoNextFree = CLUSTER_COUNT_UNKNOWN;
 
 	if (partition->fat.lastCluster < CLUSTERS_PER_FAT12) {
 		partition->filesysType = FS_FAT12;	// FAT12 volume
@@ -212,10 +230,41 @@ static PARTITION* _FAT_partition_constructor ( const IO_INTERFACE* disc, u32 cac
 			// Use the active FAT
 			partition->fat.fatStart = partition->fat.fatStart + ( partition->fat.sectorsPerFat * (sectorBuffer[BPB_FAT32_extFlags] & 0x0F));
 		}
+
+		// Use the free cluster count and next free cluster left in the FSInfo sector.
+		// Both are only hints: old cards can carry stale values, so counts that
+		// can't be right are ignored, and the count is replaced by an exact one as
+		// soon as the FAT is read to allocate a cluster.
+		i = u8array_to_u16(sectorBuffer, BPB_FAT32_fsInfo);
+		if ((i > 0) && (i < u8array_to_u16(sectorBuffer, BPB_reservedSectors))
+			&& _FAT_disc_readSectors (disc, bootSector + i, 1, sectorBuffer)
+			&& (u8array_to_u32(sectorBuffer, FSIB_SIG1) == FSIB_SIG1_VALUE)
+			&& (u8array_to_u32(sectorBuffer, FSIB_SIG2) == FSIB_SIG2_VALUE)
+			&& (u8array_to_u32(sectorBuffer, FSIB_bootSig) == FSIB_bootSig_VALUE))
+		{
+			partition->fat.fsInfoSector = bootSector + i;
+			partition->fat.fsInfoFree = u8array_to_u32(sectorBuffer, FSIB_numberOfFreeCluster);
+			partition->fat.fsInfoNextFree = u8array_to_u32(sectorBuffer, FSIB_numberLastAllocCluster);
+			if (partition->fat.fsInfoFree <= partition->fat.lastCluster - CLUSTER_FIRST + 1) {
+				partition->fat.numberFree = partition->fat.fsInfoFree;
+			}
+			if ((partition->fat.fsInfoNextFree >= CLUSTER_FIRST) && (partition->fat.fsInfoNextFree <= partition->fat.lastCluster)) {
+				partition->fat.firstFree = partition->fat.fsInfoNextFree;
+			}
+		}
 	}
 
-	// Create a cache to use
-	partition->cache = _FAT_cache_constructor (cacheSize, partition->disc);
+	// Create a cache to use, with cluster-sized pages if asked for.
+	// Align the pages on clusters so that none of them straddles two clusters.
+	if (cachePageSectors == CACHE_PAGE_CLUSTER) {
+		cachePageSectors = partition->sectorsPerCluster;
+	}
+	partition->cache = _FAT_cache_constructor (cacheSize, cachePageSectors, cacheReadAhead,
+		partition->dataStart, bootSector + partition->numberOfSectors, partition->disc);
+	if (partition->cache == NULL) {
+		_FAT_mem_free (partition);
+		return NULL;
+	}
 
 	// Set current directory to the root
 	partition->cwdCluster = partition->rootDirCluster;
@@ -226,16 +275,20 @@ static PARTITION* _FAT_partition_constructor ( const IO_INTERFACE* disc, u32 cac
 	// There are currently no open files on this partition
 	partition->openFileCount = 0;
 
+	memset (&partition->stats, 0, sizeof(PARTITION_STATS));
+
 	return partition;
 }
 
 static void _FAT_partition_destructor (PARTITION* partition) {
+	_FAT_directory_invalidateCache (partition);
 	_FAT_cache_destructor (partition->cache);
+	_FAT_fat_freeUsedBitmap (partition);
 	_FAT_disc_shutdown (partition->disc);
 	_FAT_mem_free (partition);
 }
 
-bool _FAT_partition_mount (PARTITION_INTERFACE partitionNumber, u32 cacheSize) 
+bool _FAT_partition_mount (PARTITION_INTERFACE partitionNumber, u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead) 
 {
 #ifdef NDS
 	int i;
@@ -274,7 +327,7 @@ bool _FAT_partition_mount (PARTITION_INTERFACE partitionNumber, u32 cacheSize)
 		}
 	}
 
-	_FAT_partitions[partitionNumber] = _FAT_partition_constructor (disc, cacheSize);
+	_FAT_partitions[partitionNumber] = _FAT_partition_constructor (disc, cacheSize, cachePageSectors, cacheReadAhead);
 
 	if (_FAT_partitions[partitionNumber] == NULL) {
 		return false;
@@ -289,14 +342,14 @@ bool _FAT_partition_mount (PARTITION_INTERFACE partitionNumber, u32 cacheSize)
 
 	// Only ever one partition on GBA
 	disc = _FAT_disc_gbaSlotFindInterface ();
-	_FAT_partitions[partitionNumber] = _FAT_partition_constructor (disc, cacheSize);
+	_FAT_partitions[partitionNumber] = _FAT_partition_constructor (disc, cacheSize, cachePageSectors, cacheReadAhead);
 	
 #endif // defined NDS
 
 	return true;
 }
 
-bool _FAT_partition_mountCustomInterface (const IO_INTERFACE* device, u32 cacheSize) {
+bool _FAT_partition_mountCustomInterface (const IO_INTERFACE* device, u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead) {
 #ifdef NDS	
 	int i;
 	
@@ -316,7 +369,7 @@ bool _FAT_partition_mountCustomInterface (const IO_INTERFACE* device, u32 cacheS
 		}
 	}
 
-	_FAT_partitions[PI_CUSTOM] = _FAT_partition_constructor (device, cacheSize);
+	_FAT_partitions[PI_CUSTOM] = _FAT_partition_constructor (device, cacheSize, cachePageSectors, cacheReadAhead);
 
 	if (_FAT_partitions[PI_CUSTOM] == NULL) {
 		return false;
@@ -332,7 +385,7 @@ bool _FAT_partition_mountCustomInterface (const IO_INTERFACE* device, u32 cacheS
 	}
 
 	// Only ever one partition on GBA
-	_FAT_partitions[PI_CART_SLOT] = _FAT_partition_constructor (device, cacheSize);
+	_FAT_partitions[PI_CART_SLOT] = _FAT_partition_constructor (device, cacheSize, cachePageSectors, cacheReadAhead);
 	
 #endif // defined NDS
 
@@ -405,6 +458,7 @@ bool _FAT_partition_unmount (PARTITION_INTERFACE partitionNumber) {
 		}
 	}
 	
+	_FAT_partition_writeFSInfo (partition);
 	_FAT_partition_destructor (partition);
 	return true;
 }
@@ -429,6 +483,29 @@ bool _FAT_partition_unsafeUnmount (PARTITION_INTERFACE partitionNumber) {
 	return true;
 }
 
+void _FAT_partition_writeFSInfo (PARTITION* partition) {
+	u8 fsInfo[sizeof(u32) * 2];
+
+	if ((partition->fat.fsInfoSector == 0) || partition->readOnly) {
+		return;
+	}
+	if ((partition->fat.numberFree == partition->fat.fsInfoFree)
+		&& (partition->fat.firstFree == partition->fat.fsInfoNextFree))
+	{
+		return;
+	}
+
+	// The two fields are next to each other
+	u32_to_u8array (fsInfo, 0, partition->fat.numberFree);
+	u32_to_u8array (fsInfo, sizeof(u32), partition->fat.firstFree);
+	if (_FAT_cache_writePartialSector (partition->cache, fsInfo, partition->fat.fsInfoSector,
+		FSIB_numberOfFreeCluster, sizeof(fsInfo)))
+	{
+		partition->fat.fsInfoFree = partition->fat.numberFree;
+		partition->fat.fsInfoNextFree = partition->fat.firstFree;
+	}
+}
+
 PARTITION* _FAT_partition_getPartitionFromPath (const char* path) {
 #ifdef NDS
 	int namelen;
@@ -466,7 +543,7 @@ PARTITION* _FAT_partition_getPartitionFromPath (const char* path) {
 #endif // defined NDS
 }
 
-bool _FAT_partition_freeMount( int partitionNumber, const IO_INTERFACE* device, u32 cacheSize) {
+bool _FAT_partition_freeMount( int partitionNumber, const IO_INTERFACE* device, u32 cacheSize, u32 cachePageSectors, u32 cacheReadAhead) {
 	
 	if( partitionNumber < 0 || partitionNumber > 3 )
 		return false;
@@ -491,7 +568,7 @@ bool _FAT_partition_freeMount( int partitionNumber, const IO_INTERFACE* device,
 		}
 	}
 
-	_FAT_partitions[partitionNumber] = _FAT_partition_constructor (device, cacheSize);
+	_FAT_partitions[partitionNumber] = _FAT_partition_constructor (device, cacheSize, cachePageSectors, cacheReadAhead);
 
 	if (_FAT_partitions[partitionNumber] == NULL) {
 		return false;
@@ -7,6 +7,10 @@
  * tables for updating the shift register in one step with three exclusive-ors
  * instead of four steps with four exclusive-ors.  This results in about a
  * factor of two increase in speed on a Power PC G4 (PPC7455) using gcc -O3.
+ *
+ * On little-endian machines eight bytes are done at a time, with four more
+ * tables, which takes half as many loads per byte from the data as four at a
+ * time did.  crc32_copy() computes the CRC of data while copying it.
  */
 
 /* @(#) $Id$ */
@@ -53,6 +57,12 @@
 #  endif /* STDC */
 #endif /* !NOBYFOUR */
 
+/* Eight data bytes at a time in crc32() on little-endian machines, unless
+   NOBYEIGHT is defined. */
+#if defined(BYFOUR) && !defined(NOBYEIGHT)
+#  define BYEIGHT
+#endif
+
 /* Definitions for doing the crc four data bytes at a time. */
 #ifdef BYFOUR
    typedef u4 crc_table_t;
@@ -62,7 +72,10 @@
                         const unsigned char FAR *, unsigned));
    local unsigned long crc32_big OF((unsigned long,
                         const unsigned char FAR *, unsigned));
-#  define TBLS 8
+   local unsigned long crc32_copy_little OF((unsigned long,
+                        unsigned char FAR *, const unsigned char FAR *,
+                        unsigned));
+#  define TBLS 12
 #else
    typedef unsigned long crc_table_t;
 #  define TBLS 1
@@ -107,7 +120,9 @@ local void make_crc_table OF((void));
   all the information needed to generate CRCs on data a byte at a time for all
   combinations of CRC register values and incoming bytes.  The remaining tables
   allow for word-at-a-time CRC calculation for both big-endian and little-
-  endian machines, where a word is four bytes.
+  endian machines, where a word is four bytes.  Tables 0..3 and 8..11 are for
+  little-endian machines, the CRC of each value followed by zero to seven
+  zeros, and allow for two words at a time; tables 4..7 are for big-endian.
 */
 local void make_crc_table()
 {
@@ -148,6 +163,11 @@ local void make_crc_table()
                 crc_table[k][n] = c;
                 crc_table[k + 4][n] = REV(c);
             }
+            /* and followed by four to seven zeros */
+            for (k = 8; k < 12; k++) {
+                c = crc_table[0][c & 0xff] ^ (c >> 8);
+                crc_table[k][n] = c;
+            }
         }
 #endif /* BYFOUR */
 
@@ -173,7 +193,7 @@ local void make_crc_table()
         write_table(out, crc_table[0]);
 #  ifdef BYFOUR
         fprintf(out, "#ifdef BYFOUR\n");
-        for (k = 1; k < 8; k++) {
+        for (k = 1; k < TBLS; k++) {
             fprintf(out, "  },\n  {\n");
             write_table(out, crc_table[k]);
         }
@@ -257,13 +277,50 @@ unsigned long ZEXPORT crc32(crc, buf, len)
     return crc ^ 0xffffffffUL;
 }
 
+/* ========================================================================= */
+unsigned long ZEXPORT crc32_copy(crc, dst, src, len)
+    unsigned long crc;
+    unsigned char FAR *dst;
+    const unsigned char FAR *src;
+    uInt len;
+{
+    if (src == Z_NULL) return 0UL;
+
+#ifdef DYNAMIC_CRC_TABLE
+    if (crc_table_empty)
+        make_crc_table();
+#endif /* DYNAMIC_CRC_TABLE */
+
+#ifdef BYFOUR
+    if (sizeof(void *) == sizeof(ptrdiff_t)) {
+        u4 endian;
+
+        endian = 1;
+        if (*((unsigned char *)(&endian)))
+            return crc32_copy_little(crc, dst, src, len);
+    }
+#endif /* BYFOUR */
+    zmemcpy(dst, src, len);
+    return crc32(crc, dst, len);
+}
+
 #ifdef BYFOUR
 
 /* ========================================================================= */
 #define DOLIT4 c ^= *buf4++; \
         c = crc_table[3][c & 0xff] ^ crc_table[2][(c >> 8) & 0xff] ^ \
             crc_table[1][(c >> 16) & 0xff] ^ crc_table[0][c >> 24]
-#define DOLIT32 DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4
+#define SLICE8(lo, hi) c ^= (lo); \
+        c = crc_table[11][c & 0xff] ^ crc_table[10][(c >> 8) & 0xff] ^ \
+            crc_table[9][(c >> 16) & 0xff] ^ crc_table[8][c >> 24] ^ \
+            crc_table[3][(hi) & 0xff] ^ crc_table[2][((hi) >> 8) & 0xff] ^ \
+            crc_table[1][((hi) >> 16) & 0xff] ^ crc_table[0][(hi) >> 24]
+#define DOLIT8 lo = *buf4++; hi = *buf4++; SLICE8(lo, hi)
+#ifdef BYEIGHT
+#  define DOLIT32 DOLIT8; DOLIT8; DOLIT8; DOLIT8
+#else
+#  define DOLIT32 DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4; DOLIT4
+#endif
 
 /* ========================================================================= */
 local unsigned long crc32_little(crc, buf, len)
@@ -272,6 +329,9 @@ local unsigned long crc32_little(crc, buf, len)
     unsigned len;
 {
     register u4 c;
+#ifdef BYEIGHT
+    register u4 lo, hi;
+#endif
     register const u4 FAR *buf4;
 
     c = (u4)crc;
@@ -286,6 +346,12 @@ local unsigned long crc32_little(crc, buf, len)
         DOLIT32;
         len -= 32;
     }
+#ifdef BYEIGHT
+    while (len >= 8) {
+        DOLIT8;
+        len -= 8;
+    }
+#endif
     while (len >= 4) {
         DOLIT4;
         len -= 4;
@@ -299,6 +365,69 @@ local unsigned long crc32_little(crc, buf, len)
     return (unsigned long)c;
 }
 
+/* ========================================================================= */
+#define COPYLIT8 lo = *src4++; hi = *src4++; *dst4++ = lo; *dst4++ = hi; \
+        SLICE8(lo, hi)
+#define COPYLIT32 COPYLIT8; COPYLIT8; COPYLIT8; COPYLIT8
+
+/* Bytes copied then summed at a time when dst and src are misaligned */
+#define COPY_BLOCK 1024
+
+/* ========================================================================= */
+local unsigned long crc32_copy_little(crc, dst, src, len)
+    unsigned long crc;
+    unsigned char FAR *dst;
+    const unsigned char FAR *src;
+    unsigned len;
+{
+    register u4 c, lo, hi;
+    register const u4 FAR *src4;
+    register u4 FAR *dst4;
+    unsigned block;
+
+    if (((ptrdiff_t)dst & 3) != ((ptrdiff_t)src & 3)) {
+        /* Words can't be stored where they were loaded from.  Copy a block
+           at a time and compute its CRC while it is still in the cache. */
+        while (len) {
+            block = len < COPY_BLOCK ? len : COPY_BLOCK;
+            zmemcpy(dst, src, block);
+            crc = crc32_little(crc, dst, block);
+            dst += block;
+            src += block;
+            len -= block;
+        }
+        return crc;
+    }
+
+    c = (u4)crc;
+    c = ~c;
+    while (len && ((ptrdiff_t)src & 3)) {
+        *dst = *src++;
+        c = crc_table[0][(c ^ *dst++) & 0xff] ^ (c >> 8);
+        len--;
+    }
+
+    src4 = (const u4 FAR *)(const void FAR *)src;
+    dst4 = (u4 FAR *)(void FAR *)dst;
+    while (len >= 32) {
+        COPYLIT32;
+        len -= 32;
+    }
+    while (len >= 8) {
+        COPYLIT8;
+        len -= 8;
+    }
+    src = (const unsigned char FAR *)src4;
+    dst = (unsigned char FAR *)dst4;
+
+    if (len) do {
+        *dst = *src++;
+        c = crc_table[0][(c ^ *dst++) & 0xff] ^ (c >> 8);
+    } while (--len);
+    c = ~c;
+    return (unsigned long)c;
+}
+
 /* ========================================================================= */
 #define DOBIG4 c ^= *++buf4; \
         c = crc_table[4][c & 0xff] ^ crc_table[5][(c >> 8) & 0xff] ^ \
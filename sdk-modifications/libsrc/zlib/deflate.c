@@ -79,6 +79,16 @@ local block_state deflate_fast   OF((deflate_state *s, int flush));
 #ifndef FASTEST
 local block_state deflate_slow   OF((deflate_state *s, int flush));
 #endif
+#if !defined(FASTEST) && !defined(NO_DEFLATE_QUICK)
+#  define DEFLATE_QUICK
+local block_state deflate_quick  OF((deflate_state *s, int flush));
+#endif
+#if !defined(FASTEST) && !defined(NO_DEFLATE_MEDIUM)
+#  define DEFLATE_MEDIUM
+local block_state deflate_medium OF((deflate_state *s, int flush));
+local uInt medium_match   OF((deflate_state *s, IPos hash_head));
+local void medium_insert  OF((deflate_state *s, uInt str, uInt length));
+#endif
 local block_state deflate_rle    OF((deflate_state *s, int flush));
 local block_state deflate_huff   OF((deflate_state *s, int flush));
 local void lm_init        OF((deflate_state *s));
@@ -135,17 +145,42 @@ local const config configuration_table[10] = {
 /* 2 */ {4,    5, 16,    8, deflate_fast},
 /* 3 */ {4,    6, 32,   32, deflate_fast},
 
+#ifdef DEFLATE_MEDIUM
+/* 4 */ {8,   16, 32,   32, deflate_medium},  /* match moved back */
+/* 5 */ {8,   32, 64,   64, deflate_medium},
+/* 6 */ {8,   32, 128, 128, deflate_medium},
+#else
 /* 4 */ {4,    4, 16,   16, deflate_slow},  /* lazy matches */
 /* 5 */ {8,   16, 32,   32, deflate_slow},
 /* 6 */ {8,   16, 128, 128, deflate_slow},
+#endif
 /* 7 */ {8,   32, 128, 256, deflate_slow},
 /* 8 */ {32, 128, 258, 1024, deflate_slow},
 /* 9 */ {32, 258, 258, 4096, deflate_slow}}; /* max compression */
 #endif
 
+#ifdef DEFLATE_QUICK
+/* Level 1 with the Z_FIXED strategy: one probe, fixed codes, no buffering.
+ * Compile with -DNO_DEFLATE_QUICK to use deflate_fast() for it again.
+ */
+local const config quick_config =
+/*      good lazy nice chain */
+/* 1 */ {4,    4,  8,    1, deflate_quick};
+
+#  define QUICK(level, strategy) ((level) == 1 && (strategy) == Z_FIXED)
+#  define CONFIG(level, strategy) \
+     (QUICK(level, strategy) ? &quick_config : &configuration_table[level])
+#else
+#  define QUICK(level, strategy) 0
+#  define CONFIG(level, strategy) (&configuration_table[level])
+#endif
+/* Parameters and compression function for the given level and strategy */
+
 /* Note: the deflate() code requires max_lazy >= MIN_MATCH and max_chain >= 4
  * For deflate_fast() (levels <= 3) good is ignored and lazy has a different
- * meaning.
+ * meaning. For deflate_medium() (levels 4 to 6) good is ignored as well, and
+ * the next match is looked for right away after matches shorter than lazy.
+ * Compile with -DNO_DEFLATE_MEDIUM to use deflate_slow() for them again.
  */
 
 #define EQUAL 0
@@ -166,6 +201,21 @@ struct static_tree_desc_s {int dummy;}; /* for buggy compilers */
  */
 #define UPDATE_HASH(s,h,c) (h = (((h)<<s->hash_shift) ^ (c)) & s->hash_mask)
 
+/* ===========================================================================
+ * Set ins_h to the hash key of the string starting at str. One byte at a
+ * time, the key is rolled on from that of the previous string, so the same
+ * IN assertion as for UPDATE_HASH holds. With WORD_MATCH, the four bytes at
+ * str are hashed directly by multiplying them by a large odd constant.
+ */
+#ifdef WORD_MATCH
+#define HASH_STRING(s, str) \
+   (s->ins_h = (LOAD_WRD(s->window + (str)) * 2654435761U) >> \
+               (32 - s->hash_bits))
+#else
+#define HASH_STRING(s, str) \
+   UPDATE_HASH(s, s->ins_h, s->window[(str) + (MIN_MATCH-1)])
+#endif
+
 
 /* ===========================================================================
  * Insert string str in the dictionary and set match_head to the previous head
@@ -179,12 +229,12 @@ struct static_tree_desc_s {int dummy;}; /* for buggy compilers */
  */
 #ifdef FASTEST
 #define INSERT_STRING(s, str, match_head) \
-   (UPDATE_HASH(s, s->ins_h, s->window[(str) + (MIN_MATCH-1)]), \
+   (HASH_STRING(s, str), \
     match_head = s->head[s->ins_h], \
     s->head[s->ins_h] = (Pos)(str))
 #else
 #define INSERT_STRING(s, str, match_head) \
-   (UPDATE_HASH(s, s->ins_h, s->window[(str) + (MIN_MATCH-1)]), \
+   (HASH_STRING(s, str), \
     match_head = s->prev[(str) & s->w_mask] = s->head[s->ins_h], \
     s->head[s->ins_h] = (Pos)(str))
 #endif
@@ -365,7 +415,7 @@ int ZEXPORT deflateSetDictionary (strm, dictionary, dictLength)
         str = s->strstart;
         n = s->lookahead - (MIN_MATCH-1);
         do {
-            UPDATE_HASH(s, s->ins_h, s->window[str + MIN_MATCH-1]);
+            HASH_STRING(s, str);
 #ifndef FASTEST
             s->prev[str & s->w_mask] = s->head[s->ins_h];
 #endif
@@ -477,7 +527,7 @@ int ZEXPORT deflatePrime (strm, bits, value)
         put = Buf_size - s->bi_valid;
         if (put > bits)
             put = bits;
-        s->bi_buf |= (ush)((value & ((1 << put) - 1)) << s->bi_valid);
+        s->bi_buf |= (bitbuf)(value & ((1 << put) - 1)) << s->bi_valid;
         s->bi_valid += put;
         _tr_flush_bits(s);
         value >>= put;
@@ -507,19 +557,20 @@ int ZEXPORT deflateParams(strm, level, strategy)
     if (level < 0 || level > 9 || strategy < 0 || strategy > Z_FIXED) {
         return Z_STREAM_ERROR;
     }
-    func = configuration_table[s->level].func;
+    func = CONFIG(s->level, s->strategy)->func;
 
-    if ((strategy != s->strategy || func != configuration_table[level].func) &&
+    if ((strategy != s->strategy || func != CONFIG(level, strategy)->func) &&
         strm->total_in != 0) {
         /* Flush the last buffer: */
         err = deflate(strm, Z_BLOCK);
     }
-    if (s->level != level) {
+    if (s->level != level ||
+        QUICK(s->level, s->strategy) != QUICK(level, strategy)) {
         s->level = level;
-        s->max_lazy_match   = configuration_table[level].max_lazy;
-        s->good_match       = configuration_table[level].good_length;
-        s->nice_match       = configuration_table[level].nice_length;
-        s->max_chain_length = configuration_table[level].max_chain;
+        s->max_lazy_match   = CONFIG(level, strategy)->max_lazy;
+        s->good_match       = CONFIG(level, strategy)->good_length;
+        s->nice_match       = CONFIG(level, strategy)->nice_length;
+        s->max_chain_length = CONFIG(level, strategy)->max_chain;
     }
     s->strategy = strategy;
     return err;
@@ -609,8 +660,10 @@ uLong ZEXPORT deflateBound(strm, sourceLen)
         wraplen = 6;
     }
 
-    /* if not default parameters, return conservative bound */
-    if (s->w_bits != 15 || s->hash_bits != 8 + 7)
+    /* if not default parameters, or if deflate_quick() never stores blocks,
+     * return conservative bound */
+    if (s->w_bits != 15 || s->hash_bits != 8 + 7 ||
+        QUICK(s->level, s->strategy))
         return complen + wraplen;
 
     /* default settings: return tight bound for that case */
@@ -900,7 +953,7 @@ int ZEXPORT deflate (strm, flush)
 
         bstate = s->strategy == Z_HUFFMAN_ONLY ? deflate_huff(s, flush) :
                     (s->strategy == Z_RLE ? deflate_rle(s, flush) :
-                        (*(configuration_table[s->level].func))(s, flush));
+                        (*(CONFIG(s->level, s->strategy)->func))(s, flush));
 
         if (bstate == finish_started || bstate == finish_done) {
             s->status = FINISH_STATE;
@@ -1083,15 +1136,18 @@ local int read_buf(strm, buf, size)
 
     strm->avail_in  -= len;
 
-    zmemcpy(buf, strm->next_in, len);
-    if (strm->state->wrap == 1) {
-        strm->adler = adler32(strm->adler, buf, len);
-    }
 #ifdef GZIP
-    else if (strm->state->wrap == 2) {
-        strm->adler = crc32(strm->adler, buf, len);
+    if (strm->state->wrap == 2) {
+        strm->adler = crc32_copy(strm->adler, buf, strm->next_in, len);
     }
+    else
 #endif
+    {
+        zmemcpy(buf, strm->next_in, len);
+        if (strm->state->wrap == 1) {
+            strm->adler = adler32(strm->adler, buf, len);
+        }
+    }
     strm->next_in  += len;
     strm->total_in += len;
 
@@ -1110,10 +1166,10 @@ local void lm_init (s)
 
     /* Set the default configuration parameters:
      */
-    s->max_lazy_match   = configuration_table[s->level].max_lazy;
-    s->good_match       = configuration_table[s->level].good_length;
-    s->nice_match       = configuration_table[s->level].nice_length;
-    s->max_chain_length = configuration_table[s->level].max_chain;
+    s->max_lazy_match   = CONFIG(s->level, s->strategy)->max_lazy;
+    s->good_match       = CONFIG(s->level, s->strategy)->good_length;
+    s->nice_match       = CONFIG(s->level, s->strategy)->nice_length;
+    s->max_chain_length = CONFIG(s->level, s->strategy)->max_chain;
 
     s->strstart = 0;
     s->block_start = 0L;
@@ -1121,6 +1177,7 @@ local void lm_init (s)
     s->insert = 0;
     s->match_length = s->prev_length = MIN_MATCH-1;
     s->match_available = 0;
+    s->block_open = 0;
     s->ins_h = 0;
 #ifndef FASTEST
 #ifdef ASMV
@@ -1161,7 +1218,12 @@ local uInt longest_match(s, cur_match)
     Posf *prev = s->prev;
     uInt wmask = s->w_mask;
 
-#ifdef UNALIGNED_OK
+#ifdef WORD_MATCH
+    register Bytef *strend = s->window + s->strstart + MAX_MATCH;
+    register wrd scan_start = LOAD_WRD(scan);
+    register ush scan_end   = LOAD_USH(scan+best_len-1);
+    register wrd diff;
+#elif defined(UNALIGNED_OK)
     /* Compare two bytes at a time. Note: this is not always beneficial.
      * Try with and without -DUNALIGNED_OK to check.
      */
@@ -1202,7 +1264,33 @@ local uInt longest_match(s, cur_match)
          * However the length of the match is limited to the lookahead, so
          * the output of deflate is not affected by the uninitialized values.
          */
-#if (defined(UNALIGNED_OK) && MAX_MATCH == 258)
+#ifdef WORD_MATCH
+        if (LOAD_USH(match+best_len-1) != scan_end ||
+            LOAD_WRD(match) != scan_start) continue;
+
+        /* Strings with the same hash key need not share any bytes, so all
+         * of the first four were compared. Compare four at a time from
+         * strstart+4 up to strstart+259, then find the first byte that
+         * differs in the last words compared. The match may come out one
+         * byte too long, or longer than the lookahead; both are cut below.
+         */
+        scan += 4, match += 4;
+        do {
+            diff = LOAD_WRD(scan) ^ LOAD_WRD(match);
+            if (diff != 0) {
+                scan += WRD_FIRST_DIFF(diff);
+                break;
+            }
+            scan += 4, match += 4;
+        } while (scan < strend);
+
+        Assert(scan <= s->window+(unsigned)(s->window_size-1), "wild scan");
+
+        len = MAX_MATCH - (int)(strend - scan);
+        if (len > MAX_MATCH) len = MAX_MATCH;
+        scan = strend - MAX_MATCH;
+
+#elif (defined(UNALIGNED_OK) && MAX_MATCH == 258)
         /* This code assumes sizeof(unsigned short) == 2. Do not use
          * UNALIGNED_OK if your compiler uses a different size.
          */
@@ -1272,7 +1360,9 @@ local uInt longest_match(s, cur_match)
             s->match_start = cur_match;
             best_len = len;
             if (len >= nice_match) break;
-#ifdef UNALIGNED_OK
+#ifdef WORD_MATCH
+            scan_end = LOAD_USH(scan+best_len-1);
+#elif defined(UNALIGNED_OK)
             scan_end = *(ushf*)(scan+best_len-1);
 #else
             scan_end1  = scan[best_len-1];
@@ -1468,13 +1558,15 @@ local void fill_window(s)
         /* Initialize the hash value now that we have some input: */
         if (s->lookahead + s->insert >= MIN_MATCH) {
             uInt str = s->strstart - s->insert;
+#ifndef WORD_MATCH
             s->ins_h = s->window[str];
             UPDATE_HASH(s, s->ins_h, s->window[str + 1]);
 #if MIN_MATCH != 3
             Call UPDATE_HASH() MIN_MATCH-3 more times
+#endif
 #endif
             while (s->insert) {
-                UPDATE_HASH(s, s->ins_h, s->window[str + MIN_MATCH-1]);
+                HASH_STRING(s, str);
 #ifndef FASTEST
                 s->prev[str & s->w_mask] = s->head[s->ins_h];
 #endif
@@ -1691,10 +1783,12 @@ local block_state deflate_fast(s, flush)
             {
                 s->strstart += s->match_length;
                 s->match_length = 0;
+#ifndef WORD_MATCH
                 s->ins_h = s->window[s->strstart];
                 UPDATE_HASH(s, s->ins_h, s->window[s->strstart+1]);
 #if MIN_MATCH != 3
                 Call UPDATE_HASH() MIN_MATCH-3 more times
+#endif
 #endif
                 /* If lookahead < MIN_MATCH, ins_h is garbage, but it does not
                  * matter since it will be recomputed at next deflate call.
@@ -1849,6 +1943,289 @@ local block_state deflate_slow(s, flush)
         FLUSH_BLOCK(s, 0);
     return block_done;
 }
+
+#ifdef DEFLATE_MEDIUM
+/* ===========================================================================
+ * Look for a match for the string at strstart, whose hash chain starts at
+ * hash_head. Returns its length, or MIN_MATCH-1 if there is none worth taking
+ * by the same rules as in deflate_slow.
+ */
+local uInt medium_match(s, hash_head)
+    deflate_state *s;
+    IPos hash_head;
+{
+    uInt len;
+
+    if (hash_head == NIL || s->strstart - hash_head > MAX_DIST(s))
+        return MIN_MATCH-1;
+    len = longest_match (s, hash_head);
+    if (len <= 5 && (s->strategy == Z_FILTERED
+#if TOO_FAR <= 32767
+        || (len == MIN_MATCH && s->strstart - s->match_start > TOO_FAR)
+#endif
+        ))
+        return MIN_MATCH-1;
+    return len;
+}
+
+/* ===========================================================================
+ * Insert in the hash table the strings from str up to the end of a match of
+ * the given length at strstart, if the match is no longer than nice_match,
+ * and move strstart past it. The strings without MIN_MATCH bytes of lookahead
+ * are left out.
+ */
+local void medium_insert(s, str, length)
+    deflate_state *s;
+    uInt str;
+    uInt length;
+{
+    IPos hash_head;          /* set by INSERT_STRING, not needed here */
+    uInt end = s->strstart + length;
+
+    if (length <= (uInt)s->nice_match) {
+        uInt max_insert = s->strstart + s->lookahead - MIN_MATCH;
+        /* Do not insert strings in hash table beyond this. */
+
+        for (; str < end && str <= max_insert; str++) {
+            INSERT_STRING(s, str, hash_head);
+        }
+        (void)hash_head;
+    }
+    s->strstart = end;
+    s->lookahead -= length;
+#ifndef WORD_MATCH
+    if (str != end) {
+        s->ins_h = s->window[end];
+        UPDATE_HASH(s, s->ins_h, s->window[end+1]);
+#if MIN_MATCH != 3
+        Call UPDATE_HASH() MIN_MATCH-3 more times
+#endif
+    }
+#endif
+}
+
+/* ===========================================================================
+ * Between deflate_fast and deflate_slow: like deflate_fast, strings are looked
+ * up once, where the last match or literal ends. When a match shorter than
+ * max_lazy is found, the next one is looked for right away where it ends; if
+ * that one also matches the bytes before it, it is moved back over the first
+ * match, which is dropped if at most two literals are left of it. This gets
+ * some of what lazy matching gains, without a second search per match.
+ */
+local block_state deflate_medium(s, flush)
+    deflate_state *s;
+    int flush;
+{
+    IPos hash_head;          /* head of hash chain */
+    int bflush;              /* set if current block must be flushed */
+    uInt length;             /* length of the first match */
+    IPos start;              /* where the first match copies from */
+    uInt next;               /* length of the next match */
+    uInt back;               /* how far the next match is moved back */
+
+    for (;;) {
+        /* Make sure that we always have enough lookahead, except
+         * at the end of the input file. We need MAX_MATCH bytes
+         * for the next match, plus MIN_MATCH bytes to insert the
+         * string following the next match.
+         */
+        if (s->lookahead < MIN_LOOKAHEAD) {
+            fill_window(s);
+            if (s->lookahead < MIN_LOOKAHEAD && flush == Z_NO_FLUSH) {
+                return need_more;
+            }
+            if (s->lookahead == 0) break; /* flush the current block */
+        }
+
+        /* Insert the string window[strstart .. strstart+2] in the
+         * dictionary, and look for a match:
+         */
+        hash_head = NIL;
+        if (s->lookahead >= MIN_MATCH) {
+            INSERT_STRING(s, s->strstart, hash_head);
+        }
+        length = medium_match(s, hash_head);
+
+        if (length < MIN_MATCH) {
+            /* No match, output a literal byte */
+            Tracevv((stderr,"%c", s->window[s->strstart]));
+            _tr_tally_lit (s, s->window[s->strstart], bflush);
+            s->lookahead--;
+            s->strstart++;
+        } else if (length >= s->max_lazy_match ||
+                   s->lookahead - length < MIN_LOOKAHEAD ||
+                   s->last_lit + 3 >= s->lit_bufsize) {
+            /* Long enough, or no room to look further: take it as it is */
+            check_match(s, s->strstart, s->match_start, length);
+
+            _tr_tally_dist(s, s->strstart - s->match_start,
+                           length - MIN_MATCH, bflush);
+
+            medium_insert(s, s->strstart + 1, length);
+        } else {
+            /* Look for the next match where this one ends. Up to three
+             * symbols are tallied below, which the test above left room for.
+             */
+            start = s->match_start;
+            medium_insert(s, s->strstart + 1, length);
+            INSERT_STRING(s, s->strstart, hash_head);
+            next = medium_match(s, hash_head);
+
+            back = 0;
+            if (next >= MIN_MATCH) {
+                while (back < length && back < s->match_start &&
+                       next + back < MAX_MATCH &&
+                       s->window[s->strstart-1 - back] ==
+                       s->window[s->match_start-1 - back]) {
+                    back++;
+                }
+                if (back + 2 < length) back = 0;
+            }
+
+            /* Output what is left of the first match */
+            if (length - back >= MIN_MATCH) {
+                check_match(s, s->strstart - length, start, length);
+
+                _tr_tally_dist(s, s->strstart - length - start,
+                               length - MIN_MATCH, bflush);
+            } else {
+                for (; length > back; length--) {
+                    Tracevv((stderr,"%c", s->window[s->strstart - length]));
+                    _tr_tally_lit (s, s->window[s->strstart - length], bflush);
+                }
+            }
+
+            if (next < MIN_MATCH) {
+                Tracevv((stderr,"%c", s->window[s->strstart]));
+                _tr_tally_lit (s, s->window[s->strstart], bflush);
+                s->lookahead--;
+                s->strstart++;
+            } else {
+                check_match(s, s->strstart - back, s->match_start - back,
+                            next + back);
+
+                _tr_tally_dist(s, s->strstart - s->match_start,
+                               next + back - MIN_MATCH, bflush);
+
+                medium_insert(s, s->strstart + 1, next);
+            }
+        }
+        if (bflush) FLUSH_BLOCK(s, 0);
+    }
+    s->insert = s->strstart < MIN_MATCH-1 ? s->strstart : MIN_MATCH-1;
+    if (flush == Z_FINISH) {
+        FLUSH_BLOCK(s, 1);
+        return finish_done;
+    }
+    if (s->last_lit)
+        FLUSH_BLOCK(s, 0);
+    return block_done;
+}
+#endif /* DEFLATE_MEDIUM */
+
+#ifdef DEFLATE_QUICK
+/* ===========================================================================
+ * Room to leave in pending_buf for one more symbol and the end of a block
+ */
+#define QUICK_ROOM 16
+
+/* ===========================================================================
+ * Same as deflate_fast, but each string is looked up once in the hash
+ * table, the strings inside a match are not inserted, and each literal or
+ * match goes straight to the bit buffer with the fixed Huffman codes, so
+ * nothing is tallied, counted or scanned again when a block ends. Blocks end
+ * when a flush has used up the input, or when pending_buf is almost full.
+ * This is used for level 1 with the Z_FIXED strategy.
+ */
+local block_state deflate_quick(s, flush)
+    deflate_state *s;
+    int flush;
+{
+    IPos hash_head;       /* head of the hash chain */
+    int last = flush == Z_FINISH;
+
+    if (last && s->block_open != 2) {
+        /* End the current block and start the last one */
+        if (s->block_open) _tr_quick_end(s, 0);
+        _tr_quick_start(s, 1);
+        s->block_open = 2;
+    }
+
+    for (;;) {
+        if (s->pending + QUICK_ROOM > s->pending_buf_size) {
+            flush_pending(s->strm);
+            if (s->strm->avail_out == 0) return need_more;
+        }
+
+        /* Make sure that we always have enough lookahead, except
+         * at the end of the input file. We need MAX_MATCH bytes
+         * for the next match, plus MIN_MATCH bytes to insert the
+         * string following the next match.
+         */
+        if (s->lookahead < MIN_LOOKAHEAD) {
+            fill_window(s);
+            if (s->lookahead < MIN_LOOKAHEAD && flush == Z_NO_FLUSH) {
+                /* Leave at most 7 bits in bi_buf, as deflatePending() says */
+                _tr_flush_bits(s);
+                return need_more;
+            }
+            if (s->lookahead == 0) break; /* end the current block */
+        }
+
+        /* Only start a block once there is something to put in it */
+        if (!s->block_open) {
+            _tr_quick_start(s, 0);
+            s->block_open = 1;
+        }
+
+        /* Insert the string window[strstart .. strstart+2] in the
+         * dictionary and try the most recent string with the same hash key,
+         * which is the only one longest_match() looks at with a
+         * max_chain_length of 1.
+         */
+        s->match_length = 0;
+        if (s->lookahead >= MIN_MATCH) {
+            INSERT_STRING(s, s->strstart, hash_head);
+            if (hash_head != NIL && s->strstart - hash_head <= MAX_DIST(s)) {
+                s->match_length = longest_match (s, hash_head);
+            }
+        }
+        if (s->match_length >= MIN_MATCH) {
+            check_match(s, s->strstart, s->match_start, s->match_length);
+
+            _tr_quick_match(s, s->strstart - s->match_start,
+                            s->match_length);
+            s->lookahead -= s->match_length;
+            s->strstart += s->match_length;
+#ifndef WORD_MATCH
+            s->ins_h = s->window[s->strstart];
+            UPDATE_HASH(s, s->ins_h, s->window[s->strstart+1]);
+#if MIN_MATCH != 3
+            Call UPDATE_HASH() MIN_MATCH-3 more times
+#endif
+#endif
+        } else {
+            /* No match, output a literal byte */
+            Tracevv((stderr,"%c", s->window[s->strstart]));
+            _tr_quick_lit(s, s->window[s->strstart]);
+            s->lookahead--;
+            s->strstart++;
+        }
+    }
+    s->match_length = 0;
+    s->insert = s->strstart < MIN_MATCH-1 ? s->strstart : MIN_MATCH-1;
+    s->block_start = (long)s->strstart;
+    if (s->block_open) {
+        _tr_quick_end(s, last);
+        s->block_open = 0;
+    }
+    if (last) {
+        flush_pending(s->strm);
+        return s->strm->avail_out == 0 ? finish_started : finish_done;
+    }
+    return block_done;
+}
+#endif /* DEFLATE_QUICK */
 #endif /* FASTEST */
 
 /* ===========================================================================
@@ -48,7 +48,21 @@
 #define MAX_BITS 15
 /* All codes must not exceed MAX_BITS bits */
 
-#define Buf_size 16
+#ifndef NO_WIDE_BI_BUF
+#  define WIDE_BI_BUF
+#endif
+/* With WIDE_BI_BUF, bits are gathered 32 at a time in bi_buf and written to
+ * pending_buf four bytes at once, and a code can be sent together with its
+ * extra bits. Compile with -DNO_WIDE_BI_BUF for the 16-bit buffer.
+ */
+
+#ifdef WIDE_BI_BUF
+#  define Buf_size 32
+typedef unsigned int bitbuf;
+#else
+#  define Buf_size 16
+typedef ush bitbuf;
+#endif
 /* size of bit buffer in bi_buf */
 
 #define INIT_STATE    42
@@ -94,6 +108,27 @@ typedef unsigned IPos;
  * save space in the various tables. IPos is used only for parameter passing.
  */
 
+#if !defined(NO_WORD_MATCH) && !defined(FASTEST) && !defined(ASMV) && \
+    defined(__GNUC__)
+#  define WORD_MATCH
+#endif
+/* With WORD_MATCH, longest_match() compares four bytes at a time and the
+ * hash covers the first four bytes of each string instead of MIN_MATCH.
+ * The output is valid deflate data, but not the same bytes zlib would give.
+ * Compile with -DNO_WORD_MATCH to compare one byte at a time again.
+ */
+
+#ifdef WORD_MATCH
+/* Index of the first byte that differs in two words loaded from memory,
+ * given their exclusive or, which must not be 0
+ */
+#  ifdef WRD_BIG_ENDIAN
+#    define WRD_FIRST_DIFF(x) (__builtin_clz(x) >> 3)
+#  else
+#    define WRD_FIRST_DIFF(x) (__builtin_ctz(x) >> 3)
+#  endif
+#endif
+
 typedef struct internal_state {
     z_streamp strm;      /* pointer back to this zlib stream */
     int   status;        /* as the name implies */
@@ -156,6 +191,10 @@ typedef struct internal_state {
     uInt match_length;           /* length of best match */
     IPos prev_match;             /* previous match */
     int match_available;         /* set if previous match exists */
+    int block_open;
+    /* For deflate_quick(): 1 while a fixed code block is being written,
+     * 2 if it is the last block, 0 between blocks.
+     */
     uInt strstart;               /* start of string to insert */
     uInt match_start;            /* start of matching string */
     uInt lookahead;              /* number of valid bytes ahead in window */
@@ -254,7 +293,7 @@ typedef struct internal_state {
     ulg bits_sent;      /* bit length of compressed data sent mod 2^32 */
 #endif
 
-    ush bi_buf;
+    bitbuf bi_buf;
     /* Output buffer. bits are inserted starting at the bottom (least
      * significant bits).
      */
@@ -298,6 +337,11 @@ int ZLIB_INTERNAL _tr_tally OF((deflate_state *s, unsigned dist, unsigned lc));
 void ZLIB_INTERNAL _tr_flush_block OF((deflate_state *s, charf *buf,
                         ulg stored_len, int last));
 void ZLIB_INTERNAL _tr_flush_bits OF((deflate_state *s));
+void ZLIB_INTERNAL _tr_quick_start OF((deflate_state *s, int last));
+void ZLIB_INTERNAL _tr_quick_lit OF((deflate_state *s, unsigned c));
+void ZLIB_INTERNAL _tr_quick_match OF((deflate_state *s, unsigned dist,
+                        unsigned lc));
+void ZLIB_INTERNAL _tr_quick_end OF((deflate_state *s, int last));
 void ZLIB_INTERNAL _tr_align OF((deflate_state *s));
 void ZLIB_INTERNAL _tr_stored_block OF((deflate_state *s, charf *buf,
                         ulg stored_len, int last));
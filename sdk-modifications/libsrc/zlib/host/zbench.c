@@ -0,0 +1,775 @@
+/*
+ zbench.c
+
+ Measures the throughput of zlib's inner loops on the host, next to the
+ versions they replaced, so that changes can be compared between builds.
+ The DS2's MIPS core is much slower than the host, but which version is
+ faster, and roughly by how much, carries over.
+
+ Usage: zbench [options] [file]
+	-s MB		Amount of data for each checksum measurement (default 256)
+	-b KB		Size of the buffer it is processed in (default 128)
+	-d MB		Amount of generated text to compress (default 16)
+
+ Compression uses the file given, or else generated text, and reports the
+ compressed size as a percentage of the original next to the speed. Before
+ that, short, random, empty and repetitive inputs are compressed at each
+ level, fed and drained in pieces of several sizes, and checked to inflate
+ back to the original. Then streams made at random settings, some of them
+ damaged and some plain noise, are inflated by both versions in random
+ pieces, and whole by both versions of inflateBack, which must give the
+ same bytes, result and message as their counterpart.
+ Last, the output of two levels is inflated in buffers of the size above,
+ also giving the dynamic blocks met and how many reused cached code tables.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zlib.h"
+
+// For reading the table cache counts from the inflate state; zutil.h would
+// bring in the DS2 file system headers, so only what these two need
+#define ZLIB_INTERNAL
+#include "inftrees.h"
+#include "inflate.h"
+
+// The same functions in libz_ref.a, built without the changes
+extern uLong z_crc32 (uLong crc, const Bytef* buf, uInt len);
+extern int z_deflateInit2_ (z_streamp strm, int level, int method, int windowBits,
+	int memLevel, int strategy, const char* version, int stream_size);
+extern int z_deflate (z_streamp strm, int flush);
+extern int z_deflateEnd (z_streamp strm);
+extern int z_inflateInit2_ (z_streamp strm, int windowBits, const char* version, int stream_size);
+extern int z_inflate (z_streamp strm, int flush);
+extern int z_inflateEnd (z_streamp strm);
+extern int z_inflateBackInit_ (z_streamp strm, int windowBits, unsigned char* window,
+	const char* version, int stream_size);
+extern int z_inflateBack (z_streamp strm, in_func in, void* in_desc, out_func out, void* out_desc);
+extern int z_inflateBackEnd (z_streamp strm);
+
+#define BENCH_ALIGN 32
+
+
+typedef struct {
+	const char* variant;
+	int (*init) (z_streamp strm, int level, int method, int windowBits,
+		int memLevel, int strategy, const char* version, int stream_size);
+	int (*deflate) (z_streamp strm, int flush);
+	int (*end) (z_streamp strm);
+} DEFLATE_VERSION;
+
+static const DEFLATE_VERSION _bench_deflates[] = {
+	{ "before", z_deflateInit2_, z_deflate, z_deflateEnd },
+	{ "after", deflateInit2_, deflate, deflateEnd }
+};
+
+typedef struct {
+	const char* name;
+	int level;
+	int strategy;
+} DEFLATE_LEVEL;
+
+// The levels minigzip is mostly used at, starting with its ultra fast level 0
+static const DEFLATE_LEVEL _bench_levels[] = {
+	{ "deflate quick", 1, Z_FIXED },
+	{ "deflate -1", 1, Z_DEFAULT_STRATEGY },
+	{ "deflate -3", 3, Z_DEFAULT_STRATEGY },
+	{ "deflate -4", 4, Z_DEFAULT_STRATEGY },
+	{ "deflate -5", 5, Z_DEFAULT_STRATEGY },
+	{ "deflate -6", 6, Z_DEFAULT_STRATEGY }
+};
+
+#define BENCH_LEVELS (sizeof(_bench_levels) / sizeof(_bench_levels[0]))
+
+typedef struct {
+	const char* variant;
+	int (*init) (z_streamp strm, int windowBits, const char* version, int stream_size);
+	int (*inflate) (z_streamp strm, int flush);
+	int (*end) (z_streamp strm);
+	int (*backInit) (z_streamp strm, int windowBits, unsigned char* window,
+		const char* version, int stream_size);
+	int (*back) (z_streamp strm, in_func in, void* in_desc, out_func out, void* out_desc);
+	int (*backEnd) (z_streamp strm);
+} INFLATE_VERSION;
+
+static const INFLATE_VERSION _bench_inflates[] = {
+	{ "before", z_inflateInit2_, z_inflate, z_inflateEnd,
+		z_inflateBackInit_, z_inflateBack, z_inflateBackEnd },
+	{ "after", inflateInit2_, inflate, inflateEnd,
+		inflateBackInit_, inflateBack, inflateBackEnd }
+};
+
+// The levels whose output is timed inflating, quick and the default
+static const int _bench_inflate_levels[] = { 0, 5 };
+
+#define BENCH_FUZZ_STREAMS 3000
+#define BENCH_FUZZ_MAX 100000
+
+#define BENCH_TRIP_MAX 300000
+
+// Input lengths around the matching limits, and for the longer ones pieces
+// of input and output fed to deflate at a time
+static const u_long _bench_trip_lengths[] = { 0, 1, 2, 3, 4, 5, 257, 258, 259, 262, 1000, 70000, BENCH_TRIP_MAX };
+static const u_long _bench_trip_pieces[] = { 1, 7, 4093, 0 };
+
+#define BENCH_TRIP_KINDS 4
+
+static const char* const _bench_words[] = {
+	"the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "with",
+	"file", "data", "archive", "compress", "level", "window", "buffer",
+	"match", "length", "distance", "block", "stream", "output", "input",
+	"return", "while", "if", "else", "int", "unsigned", "char", "struct",
+	"{", "}", "(", ")", ";", "=", "==", "+", "0", "1", "NULL", "size"
+};
+
+static struct timespec _bench_start;
+static u_long _bench_bytes;
+static u_long _bench_blocks, _bench_reused;
+
+static void _bench_begin (void) {
+	clock_gettime (CLOCK_MONOTONIC, &_bench_start);
+}
+
+static void _bench_end (const char* name, const char* variant, double bytes, double ratio) {
+	struct timespec end;
+	double seconds;
+
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	seconds = (end.tv_sec - _bench_start.tv_sec) + (end.tv_nsec - _bench_start.tv_nsec) / 1e9;
+	printf ("%-14s %-12s %10.1f", name, variant, bytes / seconds / (1024 * 1024));
+	if (ratio > 0) {
+		printf (" %9.1f%%", ratio * 100);
+	}
+	printf ("\n");
+}
+
+// Words, numbers and line breaks, compressing about as well as source code
+static void _bench_text (unsigned char* text, u_long size) {
+	u_long i = 0;
+	const char* word;
+
+	while (i < size) {
+		if (rand () % 16 == 0) {
+			word = (rand () % 4 == 0) ? "\n\t" : "\n";
+		} else if (rand () % 12 == 0) {
+			static char number[12];
+			sprintf (number, "%d", rand () % 100000);
+			word = number;
+		} else {
+			word = _bench_words[rand () % (sizeof(_bench_words) / sizeof(_bench_words[0]))];
+		}
+		for (; *word != '\0' && i < size; word++) {
+			text[i++] = *word;
+		}
+		if (i < size) {
+			text[i++] = ' ';
+		}
+	}
+}
+
+// Compresses in to a raw deflate stream in out, feeding it chunk bytes at a
+// time as minigzip does; returns the compressed size, or 0 on an error
+static u_long _bench_deflate (const DEFLATE_VERSION* version, const DEFLATE_LEVEL* level,
+	const unsigned char* in, u_long inSize, unsigned char* out, u_long outSize, u_long chunk)
+{
+	z_stream strm;
+	u_long done = 0;
+	int flush, ret;
+
+	memset (&strm, 0, sizeof(z_stream));
+	if (version->init (&strm, level->level, Z_DEFLATED, -MAX_WBITS, 8, level->strategy,
+		ZLIB_VERSION, sizeof(z_stream)) != Z_OK)
+	{
+		return 0;
+	}
+	strm.next_out = out;
+	strm.avail_out = outSize;
+	do {
+		strm.next_in = (Bytef*)in + done;
+		strm.avail_in = (inSize - done < chunk) ? inSize - done : chunk;
+		done += strm.avail_in;
+		flush = (done == inSize) ? Z_FINISH : Z_NO_FLUSH;
+		ret = version->deflate (&strm, flush);
+	} while (ret == Z_OK && flush != Z_FINISH);
+	version->end (&strm);
+	return (ret == Z_STREAM_END) ? strm.total_out : 0;
+}
+
+// Checks that a raw deflate stream gives back the original
+static int _bench_inflates_to (const unsigned char* in, u_long inSize,
+	const unsigned char* expected, u_long expectedSize, unsigned char* scratch)
+{
+	z_stream strm;
+	int ret;
+
+	memset (&strm, 0, sizeof(z_stream));
+	if (inflateInit2 (&strm, -MAX_WBITS) != Z_OK) {
+		return 0;
+	}
+	strm.next_in = (Bytef*)in;
+	strm.avail_in = inSize;
+	strm.next_out = scratch;
+	strm.avail_out = expectedSize;
+	ret = inflate (&strm, Z_FINISH);
+	inflateEnd (&strm);
+	return ret == Z_STREAM_END && strm.total_out == expectedSize
+		&& memcmp (scratch, expected, expectedSize) == 0;
+}
+
+// Compresses in with a gzip wrapper, giving deflate at most piece bytes of
+// input and output at a time (0 for all of it) and asking for a sync flush
+// after every third piece of input, then checks that it inflates back
+static int _bench_round_trip (const DEFLATE_LEVEL* level, const unsigned char* in, u_long inSize,
+	u_long piece, unsigned char* packed, u_long packedSize, unsigned char* scratch)
+{
+	z_stream strm;
+	u_long done = 0, pieces = 0, avail, packedLength;
+	int flush, ret;
+
+	memset (&strm, 0, sizeof(z_stream));
+	if (deflateInit2 (&strm, level->level, Z_DEFLATED, MAX_WBITS + 16, 8, level->strategy) != Z_OK) {
+		return 0;
+	}
+	strm.next_out = packed;
+	do {
+		if (strm.avail_in == 0) {
+			avail = (piece == 0 || inSize - done < piece) ? inSize - done : piece;
+			strm.next_in = (Bytef*)in + done;
+			strm.avail_in = avail;
+			done += avail;
+			pieces++;
+		}
+		if (done < inSize || strm.avail_in != 0) {
+			flush = (pieces % 3 == 0 && strm.avail_in != 0) ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+		} else {
+			flush = Z_FINISH;
+		}
+		strm.avail_out = packedSize - strm.total_out;
+		if (piece != 0 && piece < strm.avail_out) {
+			strm.avail_out = piece;
+		}
+		ret = deflate (&strm, flush);
+	} while ((ret == Z_OK || ret == Z_BUF_ERROR) && strm.total_out < packedSize);
+	packedLength = strm.total_out;
+	deflateEnd (&strm);
+	if (ret != Z_STREAM_END) {
+		return 0;
+	}
+
+	memset (&strm, 0, sizeof(z_stream));
+	if (inflateInit2 (&strm, MAX_WBITS + 16) != Z_OK) {
+		return 0;
+	}
+	strm.next_in = packed;
+	strm.avail_in = packedLength;
+	strm.next_out = scratch;
+	strm.avail_out = inSize;
+	ret = inflate (&strm, Z_FINISH);
+	inflateEnd (&strm);
+	return ret == Z_STREAM_END && strm.total_out == inSize && memcmp (scratch, in, inSize) == 0;
+}
+
+// Data of the given kind for the round trips: text, random bytes, zeros,
+// or a short pattern repeated
+static void _bench_trip_data (unsigned char* data, u_long size, int kind,
+	const unsigned char* text, u_long textSize)
+{
+	u_long i;
+
+	for (i = 0; i < size; i++) {
+		switch (kind) {
+			case 0: data[i] = text[i % textSize]; break;
+			case 1: data[i] = (unsigned char)rand (); break;
+			case 2: data[i] = 0; break;
+			default: data[i] = (unsigned char)("abcabd"[i % 6] + (i / 65536)); break;
+		}
+	}
+}
+
+// Runs of text, noise and patterns of 1 to 9 bytes, so that the stream has
+// matches at every short distance next to long ones
+static void _bench_fuzz_data (unsigned char* data, u_long size,
+	const unsigned char* text, u_long textSize)
+{
+	u_long i = 0, run, period, from;
+
+	while (i < size) {
+		run = 1 + rand () % 600;
+		if (run > size - i) {
+			run = size - i;
+		}
+		switch (rand () % 3) {
+			case 0:
+				from = rand () % textSize;
+				for (; run > 0; run--, i++) {
+					data[i] = text[from++ % textSize];
+				}
+				break;
+			case 1:
+				for (; run > 0; run--, i++) {
+					data[i] = (unsigned char)rand ();
+				}
+				break;
+			default:
+				period = 1 + rand () % 9;
+				for (from = 0; from < period && from < run; from++) {
+					data[i + from] = (unsigned char)rand ();
+				}
+				for (; from < run; from++) {
+					data[i + from] = data[i + from - period];
+				}
+				i += run;
+				break;
+		}
+	}
+}
+
+// Inflates a raw stream of windowBits with the given version, taking at most
+// inPiece bytes of input and outPiece of output at a time (0 for all of it).
+// Returns the last result and puts the output length and message in *length
+// and *msg.
+static int _bench_inflate_pieces (const INFLATE_VERSION* version, int windowBits,
+	const unsigned char* in, u_long inSize, unsigned char* out, u_long outSize,
+	u_long inPiece, u_long outPiece, u_long* length, const char** msg)
+{
+	z_stream strm;
+	u_long done = 0, avail;
+	int ret;
+
+	memset (&strm, 0, sizeof(z_stream));
+	if (version->init (&strm, -windowBits, ZLIB_VERSION, sizeof(z_stream)) != Z_OK) {
+		return Z_MEM_ERROR;
+	}
+	strm.next_out = out;
+	do {
+		if (strm.avail_in == 0) {
+			avail = (inPiece == 0 || inSize - done < inPiece) ? inSize - done : inPiece;
+			strm.next_in = (Bytef*)in + done;
+			strm.avail_in = avail;
+			done += avail;
+		}
+		strm.avail_out = outSize - strm.total_out;
+		if (outPiece != 0 && outPiece < strm.avail_out) {
+			strm.avail_out = outPiece;
+		}
+		ret = version->inflate (&strm, Z_NO_FLUSH);
+	} while ((ret == Z_OK || (ret == Z_BUF_ERROR && strm.avail_out == 0))
+		&& (done < inSize || strm.avail_in != 0) && strm.total_out < outSize);
+	*length = strm.total_out;
+	*msg = strm.msg;
+#ifdef TABLE_CACHE
+	if (version->inflate == inflate) {
+		_bench_blocks = ((struct inflate_state*)strm.state)->uses;
+		_bench_reused = ((struct inflate_state*)strm.state)->hits;
+	}
+#endif
+	version->end (&strm);
+	return ret;
+}
+
+typedef struct {
+	const unsigned char* in;
+	u_long inSize;
+	unsigned char* out;
+	u_long outSize;
+	u_long length;
+} BACK_STATE;
+
+static unsigned _bench_back_in (void* desc, unsigned char** buf) {
+	BACK_STATE* back = (BACK_STATE*)desc;
+	unsigned avail = back->inSize;
+
+	*buf = (unsigned char*)back->in;
+	back->in += avail;
+	back->inSize = 0;
+	return avail;
+}
+
+static int _bench_back_out (void* desc, unsigned char* buf, unsigned len) {
+	BACK_STATE* back = (BACK_STATE*)desc;
+
+	if (len > back->outSize - back->length) {
+		return 1;
+	}
+	memcpy (back->out + back->length, buf, len);
+	back->length += len;
+	return 0;
+}
+
+// Inflates a raw stream with the given version's inflateBack, with the output
+// written through the window as minigzip does; returns as _bench_inflate_pieces
+static int _bench_inflate_back (const INFLATE_VERSION* version, int windowBits,
+	const unsigned char* in, u_long inSize,
+	unsigned char* out, u_long outSize, u_long* length, const char** msg)
+{
+	z_stream strm;
+	BACK_STATE back;
+	unsigned char* window = malloc (1UL << windowBits);
+	int ret;
+
+	memset (&strm, 0, sizeof(z_stream));
+	if (window == NULL || version->backInit (&strm, windowBits, window,
+		ZLIB_VERSION, sizeof(z_stream)) != Z_OK)
+	{
+		free (window);
+		return Z_MEM_ERROR;
+	}
+	back.in = in;
+	back.inSize = inSize;
+	back.out = out;
+	back.outSize = outSize;
+	back.length = 0;
+	ret = version->back (&strm, _bench_back_in, &back, _bench_back_out, &back);
+	*length = back.length;
+	*msg = strm.msg;
+	version->backEnd (&strm);
+	free (window);
+	return ret;
+}
+
+// Whether two inflates gave the same result, message and output
+static int _bench_same_inflate (int expectRet, u_long expectSize, const char* expectMsg,
+	const unsigned char* expect, int gotRet, u_long gotSize, const char* gotMsg, const unsigned char* got)
+{
+	if (gotRet != expectRet || gotSize != expectSize || memcmp (got, expect, expectSize) != 0
+		|| (expectMsg == NULL) != (gotMsg == NULL) || (expectMsg != NULL && strcmp (expectMsg, gotMsg) != 0))
+	{
+		fprintf (stderr, "zbench: gave %d, %lu bytes, %s, not %d, %lu bytes, %s\n",
+			gotRet, gotSize, gotMsg ? gotMsg : "no message",
+			expectRet, expectSize, expectMsg ? expectMsg : "no message");
+		return 0;
+	}
+	return 1;
+}
+
+static int _bench_fail (const char* what) {
+	fprintf (stderr, "zbench: %s gave a different result\n", what);
+	return 1;
+}
+
+int main (int argc, char* argv[]) {
+	u_long totalMB = 256, bufferKB = 128, textMB = 16;
+	u_long size, reps, i;
+	unsigned char *src, *dst;
+	unsigned char *text, *packed;
+	u_long textSize, packedSize, packedBound;
+	uLong expected, crc;
+	int misaligned, v;
+	u_long level;
+	int option;
+
+	while ((option = getopt (argc, argv, "s:b:d:")) != -1) {
+		switch (option) {
+			case 's': totalMB = atoi (optarg); break;
+			case 'b': bufferKB = atoi (optarg); break;
+			case 'd': textMB = atoi (optarg); break;
+			default:
+				fprintf (stderr, "usage: %s [-s MB] [-b KB] [-d MB] [file]\n", argv[0]);
+				return 2;
+		}
+	}
+	size = bufferKB * 1024;
+	reps = totalMB * 1024 / bufferKB;
+	_bench_bytes = size * reps;
+
+	// One spare alignment unit, so the data can start one byte in
+	if (posix_memalign ((void**)&src, BENCH_ALIGN, size + BENCH_ALIGN) != 0
+		|| posix_memalign ((void**)&dst, BENCH_ALIGN, size + BENCH_ALIGN) != 0)
+	{
+		fprintf (stderr, "zbench: out of memory\n");
+		return 1;
+	}
+	srand (1);
+	for (i = 0; i < size + BENCH_ALIGN; i++) {
+		src[i] = (unsigned char)rand ();
+	}
+
+	printf ("%-14s %-12s %10s %10s\n", "workload", "variant", "MB/s", "size");
+
+	for (misaligned = 0; misaligned <= 1; misaligned++) {
+		const char* name = misaligned ? "crc32 +1" : "crc32";
+		unsigned char* data = src + misaligned;
+
+		expected = z_crc32 (0L, Z_NULL, 0);
+		_bench_begin ();
+		for (i = 0; i < reps; i++) {
+			expected = z_crc32 (expected, data, size);
+		}
+		_bench_end (name, "by four", _bench_bytes, 0);
+
+		crc = crc32 (0L, Z_NULL, 0);
+		_bench_begin ();
+		for (i = 0; i < reps; i++) {
+			crc = crc32 (crc, data, size);
+		}
+		_bench_end (name, "by eight", _bench_bytes, 0);
+		if (crc != expected) {
+			return _bench_fail (name);
+		}
+	}
+
+	// Copying then summing, as read_buf did, against doing both at once,
+	// with the destination aligned like the source and then not
+	for (misaligned = 0; misaligned <= 1; misaligned++) {
+		const char* name = misaligned ? "copy+crc +1" : "copy+crc";
+		unsigned char* out = dst + misaligned;
+
+		expected = crc32 (0L, Z_NULL, 0);
+		_bench_begin ();
+		for (i = 0; i < reps; i++) {
+			memcpy (out, src, size);
+			expected = z_crc32 (expected, out, size);
+		}
+		_bench_end (name, "memcpy+crc", _bench_bytes, 0);
+
+		crc = crc32 (0L, Z_NULL, 0);
+		_bench_begin ();
+		for (i = 0; i < reps; i++) {
+			crc = crc32_copy (crc, out, src, size);
+		}
+		_bench_end (name, "crc32_copy", _bench_bytes, 0);
+		if (crc != expected || memcmp (out, src, size) != 0) {
+			return _bench_fail (name);
+		}
+	}
+
+	// Odd lengths and offsets, against four bytes at a time
+	for (i = 0; i < 4096; i++) {
+		u_long offset = rand () % BENCH_ALIGN, length = rand () % (size - BENCH_ALIGN);
+		u_long outOffset = rand () % BENCH_ALIGN;
+
+		expected = z_crc32 (0L, src + offset, length);
+		if (crc32 (0L, src + offset, length) != expected) {
+			return _bench_fail ("crc32 at an odd offset");
+		}
+		if (crc32_copy (0L, dst + outOffset, src + offset, length) != expected
+			|| memcmp (dst + outOffset, src + offset, length) != 0)
+		{
+			return _bench_fail ("crc32_copy at an odd offset");
+		}
+	}
+
+	if (optind < argc) {
+		FILE* fp = fopen (argv[optind], "rb");
+
+		if (fp == NULL) {
+			fprintf (stderr, "zbench: can't open %s\n", argv[optind]);
+			return 1;
+		}
+		fseek (fp, 0, SEEK_END);
+		textSize = ftell (fp);
+		fseek (fp, 0, SEEK_SET);
+		text = malloc (textSize);
+		if (text == NULL || fread (text, 1, textSize, fp) != textSize) {
+			fprintf (stderr, "zbench: can't read %s\n", argv[optind]);
+			return 1;
+		}
+		fclose (fp);
+	} else {
+		textSize = textMB * 1024 * 1024;
+		text = malloc (textSize);
+		if (text == NULL) {
+			fprintf (stderr, "zbench: out of memory\n");
+			return 1;
+		}
+		_bench_text (text, textSize);
+	}
+	if (textSize == 0) {
+		fprintf (stderr, "zbench: nothing to compress\n");
+		return 1;
+	}
+	// Room for the round trips as well, whose sync flushes add 5 bytes each
+	packedBound = (textSize > BENCH_TRIP_MAX ? textSize : BENCH_TRIP_MAX) * 3;
+	packed = malloc (packedBound);
+	dst = realloc (dst, textSize > BENCH_TRIP_MAX ? textSize : BENCH_TRIP_MAX);
+	if (packed == NULL || dst == NULL) {
+		fprintf (stderr, "zbench: out of memory\n");
+		return 1;
+	}
+
+	// The round trips need the text, so that comes first
+	{
+		u_long trips = 0, length, piece;
+		int kind;
+		unsigned char* data = malloc (BENCH_TRIP_MAX);
+
+		if (data == NULL) {
+			fprintf (stderr, "zbench: out of memory\n");
+			return 1;
+		}
+		for (level = 0; level < BENCH_LEVELS; level++) {
+			for (kind = 0; kind < BENCH_TRIP_KINDS; kind++) {
+				for (length = 0; length < sizeof(_bench_trip_lengths) / sizeof(u_long); length++) {
+					for (piece = 0; piece < sizeof(_bench_trip_pieces) / sizeof(u_long); piece++) {
+						u_long tripSize = _bench_trip_lengths[length];
+
+						// A byte at a time is slow, so only for short inputs
+						if (_bench_trip_pieces[piece] == 1 && tripSize > 1000) {
+							continue;
+						}
+						_bench_trip_data (data, tripSize, kind, text, textSize);
+						if (!_bench_round_trip (&_bench_levels[level], data, tripSize,
+							_bench_trip_pieces[piece], packed, packedBound, dst))
+						{
+							fprintf (stderr, "zbench: %s, data kind %d, %lu bytes in pieces of %lu\n",
+								_bench_levels[level].name, kind, tripSize, _bench_trip_pieces[piece]);
+							return _bench_fail ("round trip");
+						}
+						trips++;
+					}
+				}
+			}
+		}
+		free (data);
+		printf ("%-14s %-12s %10lu\n", "round trips", "ok", trips);
+	}
+
+	// Random settings, damage and piece sizes, against the reference inflate
+	{
+		static const int strategies[] = { Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+		unsigned char* data = malloc (BENCH_FUZZ_MAX);
+		unsigned char* expect = malloc (BENCH_FUZZ_MAX);
+		u_long stream, dataSize, streamSize, expectSize, gotSize, damage;
+		DEFLATE_LEVEL random;
+		const char *expectMsg, *gotMsg;
+		int windowBits, expectRet, gotRet, errors = 0;
+
+		if (data == NULL || expect == NULL) {
+			fprintf (stderr, "zbench: out of memory\n");
+			return 1;
+		}
+		for (stream = 0; stream < BENCH_FUZZ_STREAMS; stream++) {
+			u_long inPiece = (rand () % 4 == 0) ? 0 : 1 + rand () % ((rand () % 2) ? 16 : 4096);
+			u_long outPiece = (rand () % 4 == 0) ? 0 : 1 + rand () % ((rand () % 2) ? 300 : 8192);
+
+			windowBits = 9 + rand () % 7;
+			dataSize = rand () % BENCH_FUZZ_MAX;
+			_bench_fuzz_data (data, dataSize, text, textSize);
+			if (stream % 10 == 9) {
+				// Plain noise, which mostly fails in the first block
+				streamSize = 1 + rand () % 2000;
+				_bench_trip_data (packed, streamSize, 1, text, textSize);
+			} else {
+				z_stream strm;
+
+				random.level = rand () % 10;
+				random.strategy = strategies[rand () % 5];
+				memset (&strm, 0, sizeof(z_stream));
+				if (deflateInit2 (&strm, random.level, Z_DEFLATED, -windowBits, 8, random.strategy) != Z_OK) {
+					return _bench_fail ("deflateInit2");
+				}
+				strm.next_out = packed;
+				strm.avail_out = packedBound;
+				if (stream % 10 == 4 && dataSize > 0) {
+					// One piece over and over, each after a full flush, so
+					// that the blocks repeat their codes
+					u_long piece = 1 + rand () % 4000, done;
+
+					for (done = 0; done < dataSize; done += piece) {
+						strm.next_in = data;
+						strm.avail_in = (dataSize - done < piece) ? dataSize - done : piece;
+						if (deflate (&strm, Z_FULL_FLUSH) != Z_OK) {
+							return _bench_fail ("deflate");
+						}
+					}
+				} else {
+					strm.next_in = data;
+					strm.avail_in = dataSize;
+				}
+				if (deflate (&strm, Z_FINISH) != Z_STREAM_END) {
+					return _bench_fail ("deflate");
+				}
+				streamSize = strm.total_out;
+				deflateEnd (&strm);
+				// A third get a few bytes changed, and some of those are cut short
+				if (stream % 3 == 0) {
+					for (damage = 1 + rand () % 4; damage > 0; damage--) {
+						packed[rand () % streamSize] ^= 1 << (rand () % 8);
+					}
+					if (rand () % 2) {
+						streamSize = 1 + rand () % streamSize;
+					}
+				}
+			}
+
+			// Same pieces for both, since whether a distance too far back is
+			// caught depends on how much output inflate was given
+			expectRet = _bench_inflate_pieces (&_bench_inflates[0], windowBits, packed, streamSize,
+				expect, BENCH_FUZZ_MAX, inPiece, outPiece, &expectSize, &expectMsg);
+			if (expectRet == Z_DATA_ERROR) {
+				errors++;
+			}
+			gotRet = _bench_inflate_pieces (&_bench_inflates[1], windowBits, packed, streamSize,
+				dst, BENCH_FUZZ_MAX, inPiece, outPiece, &gotSize, &gotMsg);
+			if (!_bench_same_inflate (expectRet, expectSize, expectMsg, expect,
+				gotRet, gotSize, gotMsg, dst))
+			{
+				fprintf (stderr, "zbench: stream %lu of %lu bytes, in pieces of %lu and %lu\n",
+					stream, streamSize, inPiece, outPiece);
+				return _bench_fail ("inflate");
+			}
+
+			expectRet = _bench_inflate_back (&_bench_inflates[0], windowBits, packed, streamSize,
+				expect, BENCH_FUZZ_MAX, &expectSize, &expectMsg);
+			gotRet = _bench_inflate_back (&_bench_inflates[1], windowBits, packed, streamSize,
+				dst, BENCH_FUZZ_MAX, &gotSize, &gotMsg);
+			if (!_bench_same_inflate (expectRet, expectSize, expectMsg, expect,
+				gotRet, gotSize, gotMsg, dst))
+			{
+				fprintf (stderr, "zbench: stream %lu of %lu bytes\n", stream, streamSize);
+				return _bench_fail ("inflateBack");
+			}
+		}
+		free (expect);
+		free (data);
+		printf ("%-14s %-12s %10lu %9d\n", "inflate fuzz", "ok", stream, errors);
+	}
+
+	for (level = 0; level < BENCH_LEVELS; level++) {
+		const char* name = _bench_levels[level].name;
+
+		for (v = 0; v < 2; v++) {
+			_bench_begin ();
+			packedSize = _bench_deflate (&_bench_deflates[v], &_bench_levels[level],
+				text, textSize, packed, packedBound, size);
+			_bench_end (name, _bench_deflates[v].variant, textSize, (double)packedSize / textSize);
+			if (packedSize == 0 || !_bench_inflates_to (packed, packedSize, text, textSize, dst)) {
+				return _bench_fail (name);
+			}
+		}
+	}
+
+	for (level = 0; level < sizeof(_bench_inflate_levels) / sizeof(int); level++) {
+		const DEFLATE_LEVEL* deflated = &_bench_levels[_bench_inflate_levels[level]];
+		char name[32];
+		u_long length;
+		const char* msg;
+
+		sprintf (name, "in%s", deflated->name + 2);
+		packedSize = _bench_deflate (&_bench_deflates[1], deflated, text, textSize, packed, packedBound, size);
+		for (v = 0; v < 2; v++) {
+			_bench_begin ();
+			if (_bench_inflate_pieces (&_bench_inflates[v], MAX_WBITS, packed, packedSize,
+				dst, textSize, size, size, &length, &msg) != Z_STREAM_END
+				|| length != textSize || memcmp (dst, text, textSize) != 0)
+			{
+				return _bench_fail (name);
+			}
+			_bench_end (name, _bench_inflates[v].variant, textSize, 0);
+		}
+		if (_bench_blocks != 0) {
+			printf ("%-14s %-12s %10lu %9.1f%%\n", name, "tables kept",
+				_bench_blocks, 100.0 * _bench_reused / _bench_blocks);
+		}
+	}
+
+	free (packed);
+	free (text);
+	free (src);
+	free (dst);
+	return 0;
+}
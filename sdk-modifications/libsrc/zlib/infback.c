@@ -22,8 +22,10 @@ local void fixedtables OF((struct inflate_state FAR *state));
    strm provides memory allocation functions in zalloc and zfree, or
    Z_NULL to use the library memory allocation functions.
 
-   windowBits is in the range 8..15, and window is a user-supplied
-   window and output buffer that is 2**windowBits bytes.
+   windowBits is in the range 8..MAX_BACK_WBITS, and window is a user-supplied
+   window and output buffer that is 2**windowBits bytes.  Distances are
+   limited to 32K whatever its size, so a window larger than that only
+   holds more output between calls to out().
  */
 int ZEXPORT inflateBackInit_(strm, windowBits, window, version, stream_size)
 z_streamp strm;
@@ -38,7 +40,7 @@ int stream_size;
         stream_size != (int)(sizeof(z_stream)))
         return Z_VERSION_ERROR;
     if (strm == Z_NULL || window == Z_NULL ||
-        windowBits < 8 || windowBits > 15)
+        windowBits < 8 || windowBits > MAX_BACK_WBITS)
         return Z_STREAM_ERROR;
     strm->msg = Z_NULL;                 /* in case we return an error */
     if (strm->zalloc == (alloc_func)0) {
@@ -66,6 +68,8 @@ int stream_size;
     state->window = window;
     state->wnext = 0;
     state->whave = 0;
+    state->sane = 1;                /* inflate_fast() checks distances */
+    inflate_cache_init(state);
     return Z_OK;
 }
 
@@ -453,25 +457,11 @@ void FAR *out_desc;
                 break;
             }
 
-            /* build code tables -- note: do not change the lenbits or distbits
-               values here (9 and 6) without reading the comments in inftrees.h
-               concerning the ENOUGH constants, which depend on those values */
-            state->next = state->codes;
-            state->lencode = (code const FAR *)(state->next);
-            state->lenbits = 9;
-            ret = inflate_table(LENS, state->lens, state->nlen, &(state->next),
-                                &(state->lenbits), state->work);
-            if (ret) {
-                strm->msg = (char *)"invalid literal/lengths set";
-                state->mode = BAD;
-                break;
-            }
-            state->distcode = (code const FAR *)(state->next);
-            state->distbits = 6;
-            ret = inflate_table(DISTS, state->lens + state->nlen, state->ndist,
-                            &(state->next), &(state->distbits), state->work);
+            /* build code tables, or find them already built */
+            ret = inflate_dynamic(state);
             if (ret) {
-                strm->msg = (char *)"invalid distances set";
+                strm->msg = ret == 1 ? (char *)"invalid literal/lengths set" :
+                                       (char *)"invalid distances set";
                 state->mode = BAD;
                 break;
             }
@@ -480,7 +470,8 @@ void FAR *out_desc;
 
         case LEN:
             /* use inflate_fast() if we have enough input and output */
-            if (have >= 6 && left >= 258) {
+            if (have >= INFLATE_FAST_MIN_HAVE &&
+                left >= INFLATE_FAST_MIN_LEFT) {
                 RESTORE();
                 if (state->whave < state->wsize)
                     state->whave = state->wsize - left;
@@ -633,6 +624,11 @@ z_streamp strm;
 {
     if (strm == Z_NULL || strm->state == Z_NULL || strm->zfree == (free_func)0)
         return Z_STREAM_ERROR;
+#ifdef TABLE_CACHE
+    Tracev((stderr, "inflate: tables reused for %lu of %lu dynamic blocks\n",
+            ((struct inflate_state FAR *)strm->state)->hits,
+            ((struct inflate_state FAR *)strm->state)->uses));
+#endif
     ZFREE(strm, strm->state);
     strm->state = Z_NULL;
     Tracev((stderr, "inflate: end\n"));
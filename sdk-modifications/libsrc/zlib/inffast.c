@@ -29,6 +29,78 @@
 #  define PUP(a) *++(a)
 #endif
 
+#ifdef WORD_INFLATE
+/* Fill the bit buffer to 24 bits or more from a four byte load, counting
+   whole bytes only.  Part of the next byte may be left above bits in hold,
+   but the next load puts the same bits there, so it is only ever or'ed in.
+ */
+#  define REFILL() \
+    do { \
+        hold |= (unsigned long)LOAD_WRD(in + OFF) << bits; \
+        in += (31 - bits) >> 3; \
+        bits |= 24; \
+    } while (0)
+
+local unsigned char FAR *copy_match OF((unsigned char FAR *out,
+                                        unsigned dist, unsigned len));
+
+/*
+   Copy a match of len bytes from dist bytes back in the output, and return
+   the end of the copy.  Whole words are stored, so up to seven bytes past
+   the end may be written over, which inflate_fast() leaves room for.  The
+   copy goes eight bytes at a time when dist is at least eight, or four at
+   a time when it is at least four.  For shorter distances, the repeating
+   pattern is built in a word that is stored every dist bytes, or every four
+   when dist is one or two, so that distance one is a plain fill.
+ */
+local unsigned char FAR *copy_match(out, dist, len)
+unsigned char FAR *out;
+unsigned dist;
+unsigned len;
+{
+    unsigned char FAR *from = out - dist;
+    unsigned char FAR *stop = out + len;
+    wrd pat;
+
+    if (dist >= 8) {
+        do {
+            STORE_WRD(out, LOAD_WRD(from));
+            STORE_WRD(out + 4, LOAD_WRD(from + 4));
+            out += 8;
+            from += 8;
+        } while (out < stop);
+    }
+    else if (dist >= 4) {
+        do {
+            STORE_WRD(out, LOAD_WRD(from));
+            out += 4;
+            from += 4;
+        } while (out < stop);
+    }
+    else {
+        if (dist == 1)
+            pat = *from * 0x01010101U;
+        else if (dist == 2)
+            pat = LOAD_USH(from) * 0x00010001U;
+        else
+            pat = (LOAD_WRD(from) & 0xffffff) | ((wrd)*from << 24);
+        if (dist == 3) {
+            do {
+                STORE_WRD(out, pat);
+                out += 3;
+            } while (out < stop);
+        }
+        else {
+            do {
+                STORE_WRD(out, pat);
+                out += 4;
+            } while (out < stop);
+        }
+    }
+    return stop;
+}
+#endif
+
 /*
    Decode literal, length, and distance codes and write out the resulting
    literal and match bytes until either not enough input or output is
@@ -40,8 +112,8 @@
    Entry assumptions:
 
         state->mode == LEN
-        strm->avail_in >= 6
-        strm->avail_out >= 258
+        strm->avail_in >= INFLATE_FAST_MIN_HAVE
+        strm->avail_out >= INFLATE_FAST_MIN_LEFT
         start >= strm->avail_out
         state->bits < 8
 
@@ -57,12 +129,14 @@
       length code, 5 bits for the length extra, 15 bits for the distance code,
       and 13 bits for the distance extra.  This totals 48 bits, or six bytes.
       Therefore if strm->avail_in >= 6, then there is enough input to avoid
-      checking for available input while decoding.
+      checking for available input while decoding.  With WORD_INFLATE, the
+      three four byte loads a pair can take reach at most ten bytes ahead.
 
     - The maximum bytes that a single length/distance pair can output is 258
       bytes, which is the maximum length that can be coded.  inflate_fast()
       requires strm->avail_out >= 258 for each loop to avoid checking for
-      output space.
+      output space.  With WORD_INFLATE, a copy may write seven bytes beyond
+      that, so 265 bytes are needed.
  */
 void ZLIB_INTERNAL inflate_fast(strm, start)
 z_streamp strm;
@@ -97,10 +171,10 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
     /* copy state to local variables */
     state = (struct inflate_state FAR *)strm->state;
     in = strm->next_in - OFF;
-    last = in + (strm->avail_in - 5);
+    last = in + (strm->avail_in - (INFLATE_FAST_MIN_HAVE - 1));
     out = strm->next_out - OFF;
     beg = out - (start - strm->avail_out);
-    end = out + (strm->avail_out - 257);
+    end = out + (strm->avail_out - (INFLATE_FAST_MIN_LEFT - 1));
 #ifdef INFLATE_STRICT
     dmax = state->dmax;
 #endif
@@ -118,12 +192,16 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
     /* decode literals and length/distances until end-of-block or not enough
        input data or output space */
     do {
+#ifdef WORD_INFLATE
+        REFILL();
+#else
         if (bits < 15) {
             hold += (unsigned long)(PUP(in)) << bits;
             bits += 8;
             hold += (unsigned long)(PUP(in)) << bits;
             bits += 8;
         }
+#endif
         here = lcode[hold & lmask];
       dolen:
         op = (unsigned)(here.bits);
@@ -140,21 +218,27 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
             len = (unsigned)(here.val);
             op &= 15;                           /* number of extra bits */
             if (op) {
+#ifndef WORD_INFLATE                    /* else 24 bits cover code and extra */
                 if (bits < op) {
                     hold += (unsigned long)(PUP(in)) << bits;
                     bits += 8;
                 }
+#endif
                 len += (unsigned)hold & ((1U << op) - 1);
                 hold >>= op;
                 bits -= op;
             }
             Tracevv((stderr, "inflate:         length %u\n", len));
+#ifdef WORD_INFLATE
+            REFILL();
+#else
             if (bits < 15) {
                 hold += (unsigned long)(PUP(in)) << bits;
                 bits += 8;
                 hold += (unsigned long)(PUP(in)) << bits;
                 bits += 8;
             }
+#endif
             here = dcode[hold & dmask];
           dodist:
             op = (unsigned)(here.bits);
@@ -164,6 +248,10 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
             if (op & 16) {                      /* distance base */
                 dist = (unsigned)(here.val);
                 op &= 15;                       /* number of extra bits */
+#ifdef WORD_INFLATE
+                if (bits < op)
+                    REFILL();
+#else
                 if (bits < op) {
                     hold += (unsigned long)(PUP(in)) << bits;
                     bits += 8;
@@ -172,6 +260,7 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
                         bits += 8;
                     }
                 }
+#endif
                 dist += (unsigned)hold & ((1U << op) - 1);
 #ifdef INFLATE_STRICT
                 if (dist > dmax) {
@@ -266,6 +355,9 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
                     }
                 }
                 else {
+#ifdef WORD_INFLATE
+                    out = copy_match(out + OFF, dist, len) - OFF;
+#else
                     from = out - dist;          /* copy direct from output */
                     do {                        /* minimum length is three */
                         PUP(out) = PUP(from);
@@ -278,6 +370,7 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
                         if (len > 1)
                             PUP(out) = PUP(from);
                     }
+#endif
                 }
             }
             else if ((op & 64) == 0) {          /* 2nd level distance code */
@@ -315,9 +408,12 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
     /* update state and return */
     strm->next_in = in + OFF;
     strm->next_out = out + OFF;
-    strm->avail_in = (unsigned)(in < last ? 5 + (last - in) : 5 - (in - last));
+    strm->avail_in = (unsigned)(in < last ?
+                                (INFLATE_FAST_MIN_HAVE - 1) + (last - in) :
+                                (INFLATE_FAST_MIN_HAVE - 1) - (in - last));
     strm->avail_out = (unsigned)(out < end ?
-                                 257 + (end - out) : 257 - (out - end));
+                                 (INFLATE_FAST_MIN_LEFT - 1) + (end - out) :
+                                 (INFLATE_FAST_MIN_LEFT - 1) - (out - end));
     state->hold = hold;
     state->bits = bits;
     return;
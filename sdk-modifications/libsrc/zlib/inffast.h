@@ -9,3 +9,20 @@
  */
 
 void ZLIB_INTERNAL inflate_fast OF((z_streamp strm, unsigned start));
+
+#if !defined(NO_WORD_INFLATE) && !defined(ASMINF) && defined(__GNUC__) && \
+    !defined(WRD_BIG_ENDIAN)
+#  define WORD_INFLATE
+#endif
+/* With WORD_INFLATE, inflate_fast() fills its bit buffer from a four byte
+ * load and copies matches four or eight bytes at a time, which needs more
+ * input and output space to be available before it is called. The output
+ * is the same. Compile with -DNO_WORD_INFLATE to go a byte at a time again.
+ */
+#ifdef WORD_INFLATE
+#  define INFLATE_FAST_MIN_HAVE 10
+#  define INFLATE_FAST_MIN_LEFT 265
+#else
+#  define INFLATE_FAST_MIN_HAVE 6
+#  define INFLATE_FAST_MIN_LEFT 258
+#endif
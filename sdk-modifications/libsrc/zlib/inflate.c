@@ -93,7 +93,7 @@
 
 /* function prototypes */
 local void fixedtables OF((struct inflate_state FAR *state));
-local int updatewindow OF((z_streamp strm, unsigned out));
+local int updatewindow OF((z_streamp strm, unsigned out, int check));
 #ifdef BUILDFIXED
    void makefixed OF((void));
 #endif
@@ -210,6 +210,7 @@ int stream_size;
     Tracev((stderr, "inflate: allocated\n"));
     strm->state = (struct internal_state FAR *)state;
     state->window = Z_NULL;
+    inflate_cache_init(state);
     ret = inflateReset2(strm, windowBits);
     if (ret != Z_OK) {
         ZFREE(strm, state);
@@ -300,6 +301,111 @@ struct inflate_state FAR *state;
     state->distbits = 5;
 }
 
+/*
+   Empty the cache of dynamic block code tables, and zero its counts.  This
+   is done once when the state is allocated: the tables depend only on the
+   code lengths, so they remain good across streams.
+ */
+void ZLIB_INTERNAL inflate_cache_init(state)
+struct inflate_state FAR *state;
+{
+#ifdef TABLE_CACHE
+    unsigned n;
+
+    for (n = 0; n < TABLE_CACHE_SIZE; n++) {
+        state->cache[n].nlen = 0;
+        state->cache[n].used = 0;
+    }
+    state->uses = 0;
+    state->hits = 0;
+#endif
+}
+
+/*
+   Set up the length/literal and distance code tables of a dynamic block from
+   the state->nlen + state->ndist code lengths in state->lens[].  Return 0 if
+   that went well, 1 if the length/literal lengths are not a valid code, or 2
+   if the distance lengths are not.
+
+   With TABLE_CACHE, the tables are looked up first among those built for the
+   last TABLE_CACHE_SIZE different sets of lengths.  Repetitive data often
+   gives the same codes block after block, and then the tables are not built
+   again.  The numbers of lengths serve as the hash: sets that agree on those
+   mostly differ within the first few lengths, which is cheaper to find than
+   a hash of all of them.  On a miss, the tables are built in place of the
+   least recently used ones.
+   state->uses and state->hits count the lookups and the reuses, for
+   inflateEnd() to trace and for measuring.
+ */
+int ZLIB_INTERNAL inflate_dynamic(state)
+struct inflate_state FAR *state;
+{
+    code FAR *next;
+#ifdef TABLE_CACHE
+    table_cache FAR *entry;
+    table_cache FAR *oldest;
+    unsigned n, count;
+
+    /* look for tables built from the same lengths */
+    count = state->nlen + state->ndist;
+    state->uses++;
+    oldest = state->cache;
+    for (entry = state->cache; entry < state->cache + TABLE_CACHE_SIZE;
+         entry++) {
+        if (entry->nlen == state->nlen && entry->ndist == state->ndist) {
+            for (n = 0; n < count; n++)
+                if (entry->lens[n] != state->lens[n]) break;
+            if (n == count) {
+                entry->used = state->uses;
+                state->hits++;
+                state->lencode = (code const FAR *)entry->codes;
+                state->lenbits = entry->lenbits;
+                state->distcode = (code const FAR *)entry->codes +
+                                  entry->distoff;
+                state->distbits = entry->distbits;
+                return 0;
+            }
+        }
+        if (entry->used < oldest->used)
+            oldest = entry;
+    }
+
+    /* not there, so build them over the least recently used */
+    entry = oldest;
+    entry->nlen = 0;
+    next = entry->codes;
+#else
+    next = state->codes;
+#endif
+
+    /* note: do not change the lenbits or distbits values here (9 and 6)
+       without reading the comments in inftrees.h concerning the ENOUGH
+       constants, which depend on those values */
+    state->lencode = (code const FAR *)next;
+    state->lenbits = 9;
+    if (inflate_table(LENS, state->lens, state->nlen, &next,
+                      &(state->lenbits), state->work))
+        return 1;
+    state->distcode = (code const FAR *)next;
+    state->distbits = 6;
+    if (inflate_table(DISTS, state->lens + state->nlen, state->ndist, &next,
+                      &(state->distbits), state->work))
+        return 2;
+
+#ifdef TABLE_CACHE
+    entry->used = state->uses;
+    entry->nlen = state->nlen;
+    entry->ndist = state->ndist;
+    entry->lenbits = state->lenbits;
+    entry->distbits = state->distbits;
+    entry->distoff = (unsigned)(state->distcode - entry->codes);
+    zmemcpy(entry->lens, state->lens, count * sizeof(unsigned short));
+#else
+    state->next = next;
+#endif
+    return 0;
+}
+
 #ifdef MAKEFIXED
 #include <stdio.h>
 
@@ -367,7 +473,9 @@ void makefixed()
    when a window is already in use, or when output has been written during this
    inflate call, but the end of the deflate stream has not been reached yet.
    It is also called to create a window for dictionary data when a dictionary
-   is loaded.
+   is loaded.  If check is true, the CRC-32 of a gzip stream in state->check is
+   updated with all of the output, using crc32_copy() for the part that is
+   copied to the window, so that that part is only read once.
 
    Providing output buffers larger than 32K to inflate() should provide a speed
    advantage, since only the last 32K of output is copied to the sliding window
@@ -375,9 +483,18 @@ void makefixed()
    output will fall in the output data, making match copies simpler and faster.
    The advantage may be dependent on the size of the processor's data caches.
  */
-local int updatewindow(strm, out)
+#define WINCOPY(dst, src, len) \
+    do { \
+        if (check) \
+            state->check = crc32_copy(state->check, dst, src, len); \
+        else \
+            zmemcpy(dst, src, len); \
+    } while (0)
+
+local int updatewindow(strm, out, check)
 z_streamp strm;
 unsigned out;
+int check;
 {
     struct inflate_state FAR *state;
     unsigned copy, dist;
@@ -402,17 +519,20 @@ unsigned out;
     /* copy state->wsize or less output bytes into the circular window */
     copy = out - strm->avail_out;
     if (copy >= state->wsize) {
-        zmemcpy(state->window, strm->next_out - state->wsize, state->wsize);
+        if (check)
+            state->check = crc32(state->check, strm->next_out - copy,
+                                 copy - state->wsize);
+        WINCOPY(state->window, strm->next_out - state->wsize, state->wsize);
         state->wnext = 0;
         state->whave = state->wsize;
     }
     else {
         dist = state->wsize - state->wnext;
         if (dist > copy) dist = copy;
-        zmemcpy(state->window + state->wnext, strm->next_out - copy, dist);
+        WINCOPY(state->window + state->wnext, strm->next_out - copy, dist);
         copy -= dist;
         if (copy) {
-            zmemcpy(state->window, strm->next_out - copy, copy);
+            WINCOPY(state->window, strm->next_out - copy, copy);
             state->wnext = copy;
             state->whave = state->wsize;
         }
@@ -623,6 +743,7 @@ int flush;
     code last;                  /* parent table entry */
     unsigned len;               /* length to copy for repeats, bits to drop */
     int ret;                    /* return code */
+    int fused;                  /* true if updatewindow() updated the check */
 #ifdef GUNZIP
     unsigned char hbuf[4];      /* buffer for gzip header crc calculation */
 #endif
@@ -995,25 +1116,11 @@ int flush;
                 break;
             }
 
-            /* build code tables -- note: do not change the lenbits or distbits
-               values here (9 and 6) without reading the comments in inftrees.h
-               concerning the ENOUGH constants, which depend on those values */
-            state->next = state->codes;
-            state->lencode = (code const FAR *)(state->next);
-            state->lenbits = 9;
-            ret = inflate_table(LENS, state->lens, state->nlen, &(state->next),
-                                &(state->lenbits), state->work);
+            /* build code tables, or find them already built */
+            ret = inflate_dynamic(state);
             if (ret) {
-                strm->msg = (char *)"invalid literal/lengths set";
-                state->mode = BAD;
-                break;
-            }
-            state->distcode = (code const FAR *)(state->next);
-            state->distbits = 6;
-            ret = inflate_table(DISTS, state->lens + state->nlen, state->ndist,
-                            &(state->next), &(state->distbits), state->work);
-            if (ret) {
-                strm->msg = (char *)"invalid distances set";
+                strm->msg = ret == 1 ? (char *)"invalid literal/lengths set" :
+                                       (char *)"invalid distances set";
                 state->mode = BAD;
                 break;
             }
@@ -1023,7 +1130,8 @@ int flush;
         case LEN_:
             state->mode = LEN;
         case LEN:
-            if (have >= 6 && left >= 258) {
+            if (have >= INFLATE_FAST_MIN_HAVE &&
+                left >= INFLATE_FAST_MIN_LEFT) {
                 RESTORE();
                 inflate_fast(strm, out);
                 LOAD();
@@ -1233,18 +1341,26 @@ int flush;
      */
   inf_leave:
     RESTORE();
+    fused = 0;
     if (state->wsize || (out != strm->avail_out && state->mode < BAD &&
-            (state->mode < CHECK || flush != Z_FINISH)))
-        if (updatewindow(strm, out)) {
+            (state->mode < CHECK || flush != Z_FINISH))) {
+#ifdef GUNZIP
+        /* a gzip check can be computed while copying to the window */
+        fused = state->wrap && state->flags;
+#endif
+        if (updatewindow(strm, out, fused)) {
             state->mode = MEM;
             return Z_MEM_ERROR;
         }
+    }
     in -= strm->avail_in;
     out -= strm->avail_out;
     strm->total_in += in;
     strm->total_out += out;
     state->total += out;
-    if (state->wrap && out)
+    if (fused)
+        strm->adler = state->check;
+    else if (state->wrap && out)
         strm->adler = state->check =
             UPDATE(state->check, strm->next_out - out, out);
     strm->data_type = state->bits + (state->last ? 64 : 0) +
@@ -1262,6 +1378,10 @@ z_streamp strm;
     if (strm == Z_NULL || strm->state == Z_NULL || strm->zfree == (free_func)0)
         return Z_STREAM_ERROR;
     state = (struct inflate_state FAR *)strm->state;
+#ifdef TABLE_CACHE
+    Tracev((stderr, "inflate: tables reused for %lu of %lu dynamic blocks\n",
+            state->hits, state->uses));
+#endif
     if (state->window != Z_NULL) ZFREE(strm, state->window);
     ZFREE(strm, strm->state);
     strm->state = Z_NULL;
@@ -1300,7 +1420,7 @@ uInt dictLength;
     avail = strm->avail_out;
     strm->next_out = (Bytef *)dictionary + dictLength;
     strm->avail_out = 0;
-    ret = updatewindow(strm, dictLength);
+    ret = updatewindow(strm, dictLength, 0);
     strm->avail_out = avail;
     strm->next_out = next;
     if (ret) {
@@ -1461,6 +1581,16 @@ z_streamp source;
         copy->lencode = copy->codes + (state->lencode - state->codes);
         copy->distcode = copy->codes + (state->distcode - state->codes);
     }
+#ifdef TABLE_CACHE
+    else if ((char FAR *)state->lencode >= (char FAR *)state->cache &&
+             (char FAR *)state->lencode <
+             (char FAR *)(state->cache + TABLE_CACHE_SIZE)) {
+        copy->lencode = (code const FAR *)((char FAR *)copy->cache +
+            ((char FAR *)state->lencode - (char FAR *)state->cache));
+        copy->distcode = (code const FAR *)((char FAR *)copy->cache +
+            ((char FAR *)state->distcode - (char FAR *)state->cache));
+    }
+#endif
     copy->next = copy->codes + (state->next - state->codes);
     if (window != Z_NULL) {
         wsize = 1U << state->wbits;
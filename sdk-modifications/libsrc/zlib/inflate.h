@@ -16,6 +16,14 @@
 #  define GUNZIP
 #endif
 
+/* define NO_TABLE_CACHE when compiling to build the code tables of every
+   dynamic block again instead of keeping those of the last few blocks for
+   reuse.  The cache adds about 25K bytes to the inflate state. */
+#ifndef NO_TABLE_CACHE
+#  define TABLE_CACHE
+#  define TABLE_CACHE_SIZE 4
+#endif
+
 /* Possible inflate modes between inflate() calls */
 typedef enum {
     HEAD,       /* i: waiting for magic header */
@@ -77,7 +85,23 @@ typedef enum {
         CHECK -> LENGTH -> DONE
  */
 
-/* state maintained between inflate() calls.  Approximately 10K bytes. */
+#ifdef TABLE_CACHE
+/* Code tables built for an earlier dynamic block, with the code lengths they
+   were built from.  A later block sending the same lengths uses them again. */
+typedef struct {
+    unsigned long used;         /* state->uses when last used, 0 if never */
+    unsigned nlen;              /* number of length code lengths, 0 if empty */
+    unsigned ndist;             /* number of distance code lengths */
+    unsigned lenbits;           /* index bits for the length/literal table */
+    unsigned distbits;          /* index bits for the distance table */
+    unsigned distoff;           /* offset of the distance table in codes[] */
+    unsigned short lens[320];   /* the code lengths */
+    code codes[ENOUGH];         /* length/literal then distance tables */
+} table_cache;
+#endif
+
+/* state maintained between inflate() calls.  Approximately 10K bytes, or
+   35K bytes with TABLE_CACHE. */
 struct inflate_state {
     inflate_mode mode;          /* current inflate mode */
     int last;                   /* true if processing last block */
@@ -119,4 +143,14 @@ struct inflate_state {
     int sane;                   /* if false, allow invalid distance too far */
     int back;                   /* bits back of last unprocessed length/lit */
     unsigned was;               /* initial length of match */
+#ifdef TABLE_CACHE
+        /* tables of recent dynamic blocks */
+    table_cache cache[TABLE_CACHE_SIZE];
+    unsigned long uses;         /* dynamic blocks since the cache was emptied */
+    unsigned long hits;         /* how many of those reused cached tables */
+#endif
 };
+
+/* in inflate.c, also used by infback.c */
+void ZLIB_INTERNAL inflate_cache_init OF((struct inflate_state FAR *state));
+int ZLIB_INTERNAL inflate_dynamic OF((struct inflate_state FAR *state));
@@ -169,6 +169,14 @@ local void gen_trees_header OF((void));
        send_bits(s, tree[c].Code, tree[c].Len); }
 #endif
 
+#ifdef WIDE_BI_BUF
+#  define send_code_extra(s, c, tree, value, extra) \
+     send_bits(s, tree[c].Code | ((value) << tree[c].Len), tree[c].Len + (extra))
+   /* Send a code of the given tree and its extra bits at once, at most 28
+    * bits in all. The arguments must not have side effects.
+    */
+#endif
+
 /* ===========================================================================
  * Output a short LSB first on the stream.
  * IN assertion: there is enough room in pendingBuf.
@@ -178,9 +186,27 @@ local void gen_trees_header OF((void));
     put_byte(s, (uch)((ush)(w) >> 8)); \
 }
 
+/* ===========================================================================
+ * Output a full bit buffer on the stream, LSB first.
+ * IN assertion: there is enough room in pendingBuf.
+ */
+#ifndef WIDE_BI_BUF
+#  define put_bi_buf(s, w) put_short(s, w)
+#elif defined(STORE_WRD) && !defined(WRD_BIG_ENDIAN)
+#  define put_bi_buf(s, w) { \
+    STORE_WRD(s->pending_buf + s->pending, w); \
+    s->pending += 4; \
+}
+#else
+#  define put_bi_buf(s, w) { \
+    put_short(s, (ush)(w)); \
+    put_short(s, (ush)((w) >> 16)); \
+}
+#endif
+
 /* ===========================================================================
  * Send a value on a given number of bits.
- * IN assertion: length <= 16 and value fits in length bits.
+ * IN assertion: length < Buf_size and value fits in length bits.
  */
 #ifdef DEBUG
 local void send_bits      OF((deflate_state *s, int value, int length));
@@ -191,20 +217,21 @@ local void send_bits(s, value, length)
     int length; /* number of bits */
 {
     Tracevv((stderr," l %2d v %4x ", length, value));
-    Assert(length > 0 && length <= 15, "invalid length");
+    Assert(length >= 0 && length < Buf_size, "invalid length");
     s->bits_sent += (ulg)length;
 
     /* If not enough room in bi_buf, use (valid) bits from bi_buf and
-     * (16 - bi_valid) bits from value, leaving (width - (16-bi_valid))
-     * unused bits in value.
+     * (Buf_size - bi_valid) bits from value, leaving
+     * (width - (Buf_size-bi_valid)) unused bits in value. bi_buf is written
+     * out when it is full, so bi_valid stays below Buf_size.
      */
-    if (s->bi_valid > (int)Buf_size - length) {
-        s->bi_buf |= (ush)value << s->bi_valid;
-        put_short(s, s->bi_buf);
-        s->bi_buf = (ush)value >> (Buf_size - s->bi_valid);
+    if (s->bi_valid >= (int)Buf_size - length) {
+        s->bi_buf |= (bitbuf)value << s->bi_valid;
+        put_bi_buf(s, s->bi_buf);
+        s->bi_buf = (bitbuf)value >> (Buf_size - s->bi_valid);
         s->bi_valid += length - Buf_size;
     } else {
-        s->bi_buf |= (ush)value << s->bi_valid;
+        s->bi_buf |= (bitbuf)value << s->bi_valid;
         s->bi_valid += length;
     }
 }
@@ -212,14 +239,14 @@ local void send_bits(s, value, length)
 
 #define send_bits(s, value, length) \
 { int len = length;\
-  if (s->bi_valid > (int)Buf_size - len) {\
+  if (s->bi_valid >= (int)Buf_size - len) {\
     int val = value;\
-    s->bi_buf |= (ush)val << s->bi_valid;\
-    put_short(s, s->bi_buf);\
-    s->bi_buf = (ush)val >> (Buf_size - s->bi_valid);\
+    s->bi_buf |= (bitbuf)val << s->bi_valid;\
+    put_bi_buf(s, s->bi_buf);\
+    s->bi_buf = (bitbuf)val >> (Buf_size - s->bi_valid);\
     s->bi_valid += len - Buf_size;\
   } else {\
-    s->bi_buf |= (ush)(value) << s->bi_valid;\
+    s->bi_buf |= (bitbuf)(value) << s->bi_valid;\
     s->bi_valid += len;\
   }\
 }
@@ -900,6 +927,89 @@ void ZLIB_INTERNAL _tr_align(s)
     bi_flush(s);
 }
 
+/* ===========================================================================
+ * Start a block that deflate_quick() writes with the fixed codes as it goes.
+ */
+void ZLIB_INTERNAL _tr_quick_start(s, last)
+    deflate_state *s;
+    int last;         /* one if this is the last block for a file */
+{
+    send_bits(s, (STATIC_TREES<<1)+last, 3);
+}
+
+/* ===========================================================================
+ * Send a literal byte with its fixed code.
+ */
+void ZLIB_INTERNAL _tr_quick_lit(s, c)
+    deflate_state *s;
+    unsigned c;       /* the literal byte */
+{
+    send_code(s, c, static_ltree);
+    Tracecv(isgraph(c), (stderr," '%c' ", c));
+}
+
+/* ===========================================================================
+ * Send a match with the fixed codes, as compress_block() would.
+ */
+void ZLIB_INTERNAL _tr_quick_match(s, dist, lc)
+    deflate_state *s;
+    unsigned dist;    /* distance of matched string */
+    unsigned lc;      /* match length */
+{
+    unsigned code;    /* the code to send */
+    int extra;        /* number of extra bits to send */
+
+    lc -= MIN_MATCH;
+    code = _length_code[lc];
+#ifdef WIDE_BI_BUF
+    extra = extra_lbits[code];
+    /* base_length[] is 0 for length 258, which has no extra bits */
+    send_code_extra(s, code+LITERALS+1, static_ltree,
+                    extra ? lc - base_length[code] : 0, extra);
+    dist--; /* dist is now the match distance - 1 */
+    code = d_code(dist);
+    Assert (code < D_CODES, "bad d_code");
+
+    extra = extra_dbits[code];
+    send_code_extra(s, code, static_dtree, dist - base_dist[code], extra);
+#else
+    send_code(s, code+LITERALS+1, static_ltree); /* send the length code */
+    extra = extra_lbits[code];
+    if (extra != 0) {
+        lc -= base_length[code];
+        send_bits(s, lc, extra);         /* send the extra length bits */
+    }
+    dist--; /* dist is now the match distance - 1 */
+    code = d_code(dist);
+    Assert (code < D_CODES, "bad d_code");
+
+    send_code(s, code, static_dtree);    /* send the distance code */
+    extra = extra_dbits[code];
+    if (extra != 0) {
+        dist -= base_dist[code];
+        send_bits(s, dist, extra);       /* send the extra distance bits */
+    }
+#endif
+}
+
+/* ===========================================================================
+ * End a block started by _tr_quick_start(), and the output with it if this
+ * is the last block.
+ */
+void ZLIB_INTERNAL _tr_quick_end(s, last)
+    deflate_state *s;
+    int last;         /* one if this is the last block for a file */
+{
+    send_code(s, END_BLOCK, static_ltree);
+    if (last) {
+        bi_windup(s);
+    }
+#ifdef DEBUG
+    /* The symbols were not counted as they went */
+    s->compressed_len = s->bits_sent;
+#endif
+}
+
 /* ===========================================================================
  * Determine the best encoding for the current block: dynamic trees, static
  * trees or store, and output the encoded block to the zip file.
@@ -1075,6 +1185,18 @@ local void compress_block(s, ltree, dtree)
         } else {
             /* Here, lc is the match length - MIN_MATCH */
             code = _length_code[lc];
+#ifdef WIDE_BI_BUF
+            extra = extra_lbits[code];
+            /* base_length[] is 0 for length 258, which has no extra bits */
+            send_code_extra(s, code+LITERALS+1, ltree,
+                            extra ? lc - base_length[code] : 0, extra);
+            dist--; /* dist is now the match distance - 1 */
+            code = d_code(dist);
+            Assert (code < D_CODES, "bad d_code");
+
+            extra = extra_dbits[code];
+            send_code_extra(s, code, dtree, dist - base_dist[code], extra);
+#else
             send_code(s, code+LITERALS+1, ltree); /* send the length code */
             extra = extra_lbits[code];
             if (extra != 0) {
@@ -1091,6 +1213,7 @@ local void compress_block(s, ltree, dtree)
                 dist -= base_dist[code];
                 send_bits(s, dist, extra);   /* send the extra distance bits */
             }
+#endif
         } /* literal or match pair ? */
 
         /* Check that the overlay between pending_buf and d_buf+l_buf is ok: */
@@ -1167,11 +1290,7 @@ local unsigned bi_reverse(code, len)
 local void bi_flush(s)
     deflate_state *s;
 {
-    if (s->bi_valid == 16) {
-        put_short(s, s->bi_buf);
-        s->bi_buf = 0;
-        s->bi_valid = 0;
-    } else if (s->bi_valid >= 8) {
+    while (s->bi_valid >= 8) {
         put_byte(s, (Byte)s->bi_buf);
         s->bi_buf >>= 8;
         s->bi_valid -= 8;
@@ -1184,10 +1303,10 @@ local void bi_flush(s)
 local void bi_windup(s)
     deflate_state *s;
 {
-    if (s->bi_valid > 8) {
-        put_short(s, s->bi_buf);
-    } else if (s->bi_valid > 0) {
+    while (s->bi_valid > 0) {
         put_byte(s, (Byte)s->bi_buf);
+        s->bi_buf >>= 8;
+        s->bi_valid -= 8;
     }
     s->bi_buf = 0;
     s->bi_valid = 0;
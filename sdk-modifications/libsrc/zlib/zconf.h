@@ -21,8 +21,13 @@
 #  define _dist_code            z__dist_code
 #  define _length_code          z__length_code
 #  define _tr_align             z__tr_align
+#  define _tr_flush_bits        z__tr_flush_bits
 #  define _tr_flush_block       z__tr_flush_block
 #  define _tr_init              z__tr_init
+#  define _tr_quick_end         z__tr_quick_end
+#  define _tr_quick_lit         z__tr_quick_lit
+#  define _tr_quick_match       z__tr_quick_match
+#  define _tr_quick_start       z__tr_quick_start
 #  define _tr_stored_block      z__tr_stored_block
 #  define _tr_tally             z__tr_tally
 #  define adler32               z_adler32
@@ -34,6 +39,7 @@
 #    define compressBound         z_compressBound
 #  endif
 #  define crc32                 z_crc32
+#  define crc32_copy            z_crc32_copy
 #  define crc32_combine         z_crc32_combine
 #  define crc32_combine64       z_crc32_combine64
 #  define deflate               z_deflate
@@ -105,7 +111,9 @@
 #  define inflateSyncPoint      z_inflateSyncPoint
 #  define inflateUndermine      z_inflateUndermine
 #  define inflateResetKeep      z_inflateResetKeep
+#  define inflate_cache_init    z_inflate_cache_init
 #  define inflate_copyright     z_inflate_copyright
+#  define inflate_dynamic       z_inflate_dynamic
 #  define inflate_fast          z_inflate_fast
 #  define inflate_table         z_inflate_table
 #  ifndef Z_SOLO
@@ -244,6 +252,13 @@
 #  define MAX_WBITS   15 /* 32K LZ77 window */
 #endif
 
+/* Maximum value for windowBits in inflateBackInit. Windows larger than
+ * 1 << MAX_WBITS don't reach further back, but let out() write more at once.
+ */
+#ifndef MAX_BACK_WBITS
+#  define MAX_BACK_WBITS 17 /* 128K window */
+#endif
+
 /* The memory requirements for deflate are (in bytes):
             (1 << (windowBits+2)) +  (1 << (memLevel+9))
  that is: 128K for windowBits=15  +  128K for memLevel = 8  (default values)
@@ -994,7 +994,9 @@ ZEXTERN int ZEXPORT inflateBackInit OF((z_streamp strm, int windowBits,
    supplied buffer of that size.  Except for special applications where it is
    assured that deflate was used with small window sizes, windowBits must be 15
    and a 32K byte window must be supplied to be able to decompress general
-   deflate streams.
+   deflate streams.  windowBits may also be up to MAX_BACK_WBITS, for a
+   window larger than 32K: the extra room holds more output between calls to
+   out(), and the streams that can be decompressed are the same as with 15.
 
      See inflateBack() for the usage of these routines.
 
@@ -1592,6 +1594,16 @@ ZEXTERN uLong ZEXPORT crc32   OF((uLong crc, const Bytef *buf, uInt len));
      if (crc != original_crc) error();
 */
 
+ZEXTERN uLong ZEXPORT crc32_copy OF((uLong crc, Bytef *dst, const Bytef *src,
+                                     uInt len));
+/*
+     Copy the bytes src[0..len-1] to dst[0..len-1], which must not overlap
+   them, and return the CRC-32 updated with them, as crc32(crc, src, len)
+   would.  Each byte is read once, so this is faster than memcpy() followed by
+   crc32().  If src is Z_NULL, this function returns the required initial
+   value for the crc and copies nothing.
+*/
+
 /*
 ZEXTERN uLong ZEXPORT crc32_combine OF((uLong crc1, uLong crc2, z_off_t len2));
 
@@ -1651,8 +1663,14 @@ struct gzFile_s {
     z_off64_t pos;
 };
 ZEXTERN int ZEXPORT gzgetc_ OF((gzFile file));
-#define gzgetc(g) \
-    ((g)->have ? ((g)->have--, (g)->pos++, *((g)->next)++) : gzgetc_(g))
+#ifdef Z_PREFIX
+#  undef z_gzgetc
+#  define z_gzgetc(g) \
+          ((g)->have ? ((g)->have--, (g)->pos++, *((g)->next)++) : gzgetc_(g))
+#else
+#  define gzgetc(g) \
+          ((g)->have ? ((g)->have--, (g)->pos++, *((g)->next)++) : gzgetc_(g))
+#endif
 
 /* provide 64-bit offset functions if _LARGEFILE64_SOURCE defined, and/or
  * change the regular functions to 64 bits if _FILE_OFFSET_BITS is 64 (if
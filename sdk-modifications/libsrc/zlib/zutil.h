@@ -50,6 +50,23 @@ typedef unsigned short ush;
 typedef ush FAR ushf;
 typedef unsigned long  ulg;
 
+#ifdef __GNUC__
+typedef unsigned int wrd; /* 32 bits */
+
+/* Unaligned loads and stores; on MIPS these become lwl/lwr and swl/swr pairs
+ */
+struct unaligned_wrd { wrd w; } __attribute__((packed));
+struct unaligned_ush { ush h; } __attribute__((packed));
+#  define LOAD_WRD(p) (((const struct unaligned_wrd FAR *)(p))->w)
+#  define LOAD_USH(p) (((const struct unaligned_ush FAR *)(p))->h)
+#  define STORE_WRD(p, x) (((struct unaligned_wrd FAR *)(p))->w = (x))
+
+#  if defined(__MIPSEB__) || defined(__BIG_ENDIAN__) || \
+      (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#    define WRD_BIG_ENDIAN
+#  endif
+#endif
+
 extern const char * const z_errmsg[10]; /* indexed by 2-zlib_error */
 /* (size given to avoid silly warnings with Visual C++) */
 
@@ -17,6 +17,7 @@
 
 #include "zlib.h"
 #include <stdio.h>
+#include <sys/stat.h>
 
 #define DS2COMP_RETRY 55
 #define DS2COMP_STOP  56
@@ -333,17 +334,46 @@ const char *gzerror(gz, err)
 
 #endif
 
-#define COMPRESSION_BUFFER_SIZE    16384
-#define DECOMPRESSION_BUFFER_SIZE 131072
+#define IO_BUFFER_BITS                17 /* MAX_BACK_WBITS, for inflateBack */
+#define IO_BUFFER_SIZE (1 << IO_BUFFER_BITS)
 #define MAX_NAME_LEN                1024
 
+/* gzip header flags (RFC 1952) */
+#define GZ_FHCRC    0x02
+#define GZ_FEXTRA   0x04
+#define GZ_FNAME    0x08
+#define GZ_FCOMMENT 0x10
+
+#define GZ_HEADER_LEN  10
+#define GZ_TRAILER_LEN  8
+#define GZ_OS_UNIX      3  /* what zlib's gz layer writes here */
+#define DEFLATE_MAX_RATIO 1032  /* most bytes one compressed byte expands to */
+
+#include "minigzip.h"
 #include "gui.h"
 #include "draw.h"
 #include "message.h"
 
 int  error            OF((const char *message));
-int  gz_compress      OF((FILE   *in, gzFile out));
-int  gz_uncompress    OF((gzFile in, FILE   *out));
+local unsigned int io_chunk_size OF((FILE *file));
+
+/* What the inflateBack callbacks work on while uncompressing */
+typedef struct {
+    FILE *in;                /* compressed file, read into gz_buf */
+    FILE *out;               /* uncompressed file, written from io_buf */
+    unsigned int in_chunk;   /* bytes to read from in at once */
+    uLong crc;               /* CRC-32 of the member's output so far */
+    uLong size;              /* length of the member's output so far */
+    const char *failure;     /* error that made out() stop inflateBack */
+    int result;              /* DS2COMP_STOP if the user made it stop */
+} gz_back_state;
+
+local unsigned gz_back_in OF((void FAR *desc, unsigned char FAR * FAR *buf));
+local int gz_back_out OF((void FAR *desc, unsigned char FAR *buf, unsigned len));
+local int gz_next_byte OF((z_stream *strm, gz_back_state *state));
+local int gz_skip_header OF((z_stream *strm, gz_back_state *state));
+int  gz_compress      OF((FILE   *in, FILE   *out, unsigned int level));
+int  gz_uncompress    OF((FILE   *in, FILE   *out));
 int  GzipCompress     OF((const char  *file, unsigned int level));
 int  GzipUncompress   OF((const char  *file));
 
@@ -363,99 +393,348 @@ int error(message)
     return result ? DS2COMP_RETRY : Z_ERRNO;
 }
 
+/* Uncompressed data goes through io_buf on its way to or from the card, and
+ * compressed data through gz_buf. deflate works directly on them, and
+ * inflateBack uses io_buf as its window. Both are aligned for DMA and hold
+ * a whole number of clusters. */
+local char io_buf[IO_BUFFER_SIZE] __attribute__((aligned(32)));
+local char gz_buf[IO_BUFFER_SIZE] __attribute__((aligned(32)));
+
+/* ===========================================================================
+ * Return the number of bytes to read or write at once in the given file:
+ * the largest multiple of its cluster size that fits in io_buf.
+ * Transfers of that size, from the start of the file, cover whole clusters,
+ * which the file system sends to the card directly instead of splitting
+ * them around partial sectors in its cache.
+ */
+local unsigned int io_chunk_size(file)
+    FILE *file;
+{
+    struct stat st;
+    unsigned int cluster = 512;
+
+    if (fstat(file->fd, &st) == 0 && st.st_blksize > 0
+     && st.st_blksize <= IO_BUFFER_SIZE)
+        cluster = st.st_blksize;
+    return IO_BUFFER_SIZE - IO_BUFFER_SIZE % cluster;
+}
+
+/* ===========================================================================
+ * inflateBack input function: read the next chunk of the compressed file
+ * into gz_buf. Return its length, or 0 at the end of the file or on a read
+ * error.
+ */
+local unsigned gz_back_in(desc, buf)
+    void FAR *desc;
+    unsigned char FAR * FAR *buf;
+{
+    gz_back_state *state = (gz_back_state *) desc;
+    int len = fread(gz_buf, 1, state->in_chunk, state->in);
+
+    if (len <= 0)
+        return 0;
+    *buf = (unsigned char FAR *) gz_buf;
+    return len;
+}
+
+/* ===========================================================================
+ * inflateBack output function: write len bytes of the window, which is
+ * io_buf, to the uncompressed file, and account for them in the CRC.
+ * Whenever the window is full, that is a whole number of clusters.
+ * Return non-zero to stop inflateBack on a write error or if the user
+ * interrupted the process.
+ */
+local int gz_back_out(desc, buf, len)
+    void FAR *desc;
+    unsigned char FAR *buf;
+    unsigned len;
+{
+    gz_back_state *state = (gz_back_state *) desc;
+
+    state->crc = crc32(state->crc, buf, len);
+    state->size += len;
+    if (fwrite(buf, 1, len, state->out) != len) {
+        state->failure = msg[MSG_ERROR_OUTPUT_FILE_WRITE];
+        return 1;
+    }
+
+    if (ReadInputDuringCompression() & DS_BUTTON_B) {
+        state->result = DS2COMP_STOP;
+        return 1;
+    }
+
+    UpdateProgress(ftell(state->in));
+    return 0;
+}
+
+/* ===========================================================================
+ * Return the next byte of compressed input, reading the next chunk of the
+ * file into gz_buf if all of it has been consumed.
+ * Return -1 at the end of the file or on a read error.
+ */
+local int gz_next_byte(strm, state)
+    z_stream *strm;
+    gz_back_state *state;
+{
+    if (strm->avail_in == 0) {
+        strm->avail_in = gz_back_in(state, &strm->next_in);
+        if (strm->avail_in == 0)
+            return -1;
+    }
+    strm->avail_in--;
+    return *strm->next_in++;
+}
+
+/* ===========================================================================
+ * Consume a gzip member header from the compressed input.
+ * Return 1 if a header was consumed, 0 at the end of the file or if the
+ * input doesn't start with a gzip header, and -1 if the header is damaged.
+ */
+local int gz_skip_header(strm, state)
+    z_stream *strm;
+    gz_back_state *state;
+{
+    int c, flags, n;
+
+    if (gz_next_byte(strm, state) != 0x1f)
+        return 0;
+    if (gz_next_byte(strm, state) != 0x8b)
+        return 0;
+    if (gz_next_byte(strm, state) != Z_DEFLATED)
+        return -1;
+    flags = gz_next_byte(strm, state);
+    if (flags < 0 || (flags & 0xe0))
+        return -1;
+    /* modification time, extra flags and operating system */
+    for (n = 0; n < 6; n++)
+        if (gz_next_byte(strm, state) < 0)
+            return -1;
+    if (flags & GZ_FEXTRA) {
+        c = gz_next_byte(strm, state);
+        n = gz_next_byte(strm, state);
+        if (c < 0 || n < 0)
+            return -1;
+        for (n = c | (n << 8); n > 0; n--)
+            if (gz_next_byte(strm, state) < 0)
+                return -1;
+    }
+    if (flags & GZ_FNAME)
+        do {
+            c = gz_next_byte(strm, state);
+            if (c < 0)
+                return -1;
+        } while (c != 0);
+    if (flags & GZ_FCOMMENT)
+        do {
+            c = gz_next_byte(strm, state);
+            if (c < 0)
+                return -1;
+        } while (c != 0);
+    if (flags & GZ_FHCRC)
+        for (n = 0; n < 2; n++)
+            if (gz_next_byte(strm, state) < 0)
+                return -1;
+    return 1;
+}
+
 /* ===========================================================================
- * Compress input to output then close both files.
+ * Compress input to output in the gzip format then close both files.
+ * deflate reads straight from io_buf and writes straight into gz_buf; the
+ * gzip header and trailer are written around its raw output.
+ * level is 1 to 9, or GZ_LEVEL_QUICK.
  * Return Z_OK on success, Z_ERRNO or DS2COMP_RETRY otherwise.
  * May return DS2COMP_STOP if the user interrupted the process.
  */
-
-int gz_compress(in, out)
+int gz_compress(in, out, level)
     FILE   *in;
-    gzFile out;
+    FILE   *out;
+    unsigned int level;
 {
-    local char buf[COMPRESSION_BUFFER_SIZE];
-    int len;
-    int err;
+    unsigned int in_chunk = io_chunk_size(in);
+    unsigned int out_chunk = io_chunk_size(out);
+    unsigned char *trailer;
+    z_stream strm;
+    uLong crc = crc32(0L, Z_NULL, 0);
+    uLong size = 0;
+    const char *failure = NULL;
+    int result = Z_OK;
+    int len, flush;
+
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    if (level == GZ_LEVEL_QUICK
+        ? deflateInit2(&strm, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8,
+                       Z_FIXED) != Z_OK
+        : deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+                       Z_DEFAULT_STRATEGY) != Z_OK) {
+        fclose(in);
+        fclose(out);
+        return error(msg[MSG_ERROR_OUTPUT_FILE_WRITE]);
+    }
+
+    /* The header starts the first chunk of output. No name or time is
+     * stored, like zlib's gz layer does. */
+    memset(gz_buf, 0, GZ_HEADER_LEN);
+    gz_buf[0] = 0x1f;
+    gz_buf[1] = 0x8b;
+    gz_buf[2] = Z_DEFLATED;
+    gz_buf[8] = level == 9 ? 2 : (level <= 1 ? 4 : 0);
+    gz_buf[9] = GZ_OS_UNIX;
+    strm.next_out = (Bytef *) gz_buf + GZ_HEADER_LEN;
+    strm.avail_out = out_chunk - GZ_HEADER_LEN;
 
-    for (;;) {
-        len = fread(buf, 1, sizeof(buf), in);
+    do {
+        len = fread(io_buf, 1, in_chunk, in);
         if (len < 0) {
-            fclose(in);
-            gzclose(out);
-            return error(msg[MSG_ERROR_INPUT_FILE_READ]);
+            failure = msg[MSG_ERROR_INPUT_FILE_READ];
+            break;
         }
-        if (len == 0) break;
-
-        if (gzwrite(out, buf, len) != len) {
-            gzerror(out, &err);
-            fclose(in);
-            gzclose(out);
-            return error(msg[MSG_ERROR_OUTPUT_FILE_WRITE]);
+        crc = crc32(crc, (Bytef *) io_buf, len);
+        size += len;
+        /* fread only comes up short at the end of the file */
+        flush = (unsigned int) len < in_chunk ? Z_FINISH : Z_NO_FLUSH;
+
+        strm.next_in = (Bytef *) io_buf;
+        strm.avail_in = len;
+        for (;;) {
+            int ret = deflate(&strm, flush);
+            if (strm.avail_out == 0) {
+                if (fwrite(gz_buf, 1, out_chunk, out) != out_chunk) {
+                    failure = msg[MSG_ERROR_OUTPUT_FILE_WRITE];
+                    break;
+                }
+                strm.next_out = (Bytef *) gz_buf;
+                strm.avail_out = out_chunk;
+            }
+            else if (ret == Z_STREAM_ERROR) {
+                failure = msg[MSG_ERROR_OUTPUT_FILE_WRITE];
+                break;
+            }
+            else if (flush == Z_NO_FLUSH || ret == Z_STREAM_END)
+                break; /* all of the input was consumed */
         }
+        if (failure)
+            break;
 
         if (ReadInputDuringCompression() & DS_BUTTON_B) {
-            fclose(in);
-            gzclose(out);
-            return DS2COMP_STOP;
+            result = DS2COMP_STOP;
+            break;
         }
 
         UpdateProgress(ftell(in));
+    } while (flush != Z_FINISH);
+
+    if (failure == NULL && result == Z_OK) {
+        /* The trailer may not fit in what is left of the last chunk */
+        if (strm.avail_out < GZ_TRAILER_LEN) {
+            len = out_chunk - strm.avail_out;
+            if (fwrite(gz_buf, 1, len, out) != len)
+                failure = msg[MSG_ERROR_OUTPUT_FILE_WRITE];
+            strm.next_out = (Bytef *) gz_buf;
+            strm.avail_out = out_chunk;
+        }
+        trailer = strm.next_out;
+        trailer[0] = (unsigned char) crc;
+        trailer[1] = (unsigned char) (crc >> 8);
+        trailer[2] = (unsigned char) (crc >> 16);
+        trailer[3] = (unsigned char) (crc >> 24);
+        trailer[4] = (unsigned char) size;
+        trailer[5] = (unsigned char) (size >> 8);
+        trailer[6] = (unsigned char) (size >> 16);
+        trailer[7] = (unsigned char) (size >> 24);
+        len = out_chunk - strm.avail_out + GZ_TRAILER_LEN;
+        if (failure == NULL && fwrite(gz_buf, 1, len, out) != len)
+            failure = msg[MSG_ERROR_OUTPUT_FILE_WRITE];
     }
+
+    deflateEnd(&strm);
     fclose(in);
-    if (gzclose(out) != Z_OK) {
-        return error(msg[MSG_ERROR_OUTPUT_FILE_WRITE]);
-    }
+    if (fclose(out) && failure == NULL && result == Z_OK)
+        failure = msg[MSG_ERROR_OUTPUT_FILE_WRITE];
 
-    return Z_OK;
+    return failure ? error(failure) : result;
 }
 
 /* ===========================================================================
- * Uncompress input to output then close both files.
+ * Uncompress gzip input to output then close both files. Each gzip member
+ * is checked against the CRC and size in its trailer. Members may follow
+ * one another; anything else after the first is ignored, like gzread does.
+ * inflateBack decodes straight into io_buf, used as its window, and
+ * gz_back_out writes the window to the file, so the output is not copied.
  * Return Z_OK on success, Z_ERRNO or DS2COMP_RETRY otherwise.
  * May return DS2COMP_STOP if the user interrupted the process.
  */
 int gz_uncompress(in, out)
-    gzFile in;
+    FILE   *in;
     FILE   *out;
 {
-    local char buf[DECOMPRESSION_BUFFER_SIZE];
-    int len;
-    int err;
-
-    for (;;) {
-        len = gzread(in, buf, sizeof(buf));
-        if (len < 0) {
-            gzerror(in, &err);
-            gzclose(in);
-            fclose(out);
-            return error(msg[MSG_ERROR_COMPRESSED_FILE_READ]);
+    gz_back_state state;
+    unsigned char trailer[GZ_TRAILER_LEN];
+    z_stream strm;
+    int members, header, ret, c, n;
+
+    state.in = in;
+    state.out = out;
+    state.in_chunk = io_chunk_size(in);
+    state.failure = NULL;
+    state.result = Z_OK;
+
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    if (inflateBackInit(&strm, IO_BUFFER_BITS, (unsigned char FAR *) io_buf)
+        != Z_OK) {
+        fclose(in);
+        fclose(out);
+        return error(msg[MSG_ERROR_COMPRESSED_FILE_READ]);
+    }
+    strm.next_in = Z_NULL;
+    strm.avail_in = 0;
+
+    for (members = 0; ; members++) {
+        header = gz_skip_header(&strm, &state);
+        if (header == 0 && members > 0)
+            break; /* end of the file, or trailing garbage */
+        if (header <= 0) {
+            state.failure = msg[MSG_ERROR_COMPRESSED_FILE_READ];
+            break;
         }
-        if (len == 0) break;
 
-        if (fwrite(buf, 1, len, out) != len) {
-            gzclose(in);
-            fclose(out);
-            return error(msg[MSG_ERROR_OUTPUT_FILE_WRITE]);
+        /* inflateBack starts with what is left in next_in after the
+         * header, and leaves what follows the member there */
+        state.crc = crc32(0L, Z_NULL, 0);
+        state.size = 0;
+        ret = inflateBack(&strm, gz_back_in, &state, gz_back_out, &state);
+        if (ret != Z_STREAM_END) {
+            /* Unless out() stopped it, the data is damaged or truncated */
+            if (state.failure == NULL && state.result == Z_OK)
+                state.failure = msg[MSG_ERROR_COMPRESSED_FILE_READ];
+            break;
         }
 
-        if (ReadInputDuringCompression() & DS_BUTTON_B) {
-            gzclose(in);
-            fclose(out);
-            return DS2COMP_STOP;
+        for (n = 0; n < GZ_TRAILER_LEN; n++) {
+            c = gz_next_byte(&strm, &state);
+            if (c < 0)
+                break;
+            trailer[n] = (unsigned char) c;
+        }
+        if (n < GZ_TRAILER_LEN
+         || state.crc != (trailer[0] | (trailer[1] << 8) | (trailer[2] << 16)
+                          | ((uLong) trailer[3] << 24))
+         || (state.size & 0xffffffffUL) != (trailer[4] | (trailer[5] << 8)
+                          | (trailer[6] << 16) | ((uLong) trailer[7] << 24))) {
+            state.failure = msg[MSG_ERROR_COMPRESSED_FILE_READ];
+            break;
         }
-
-        UpdateProgress(gzoffset(in));
-    }
-    if (fclose(out)) {
-        gzclose(in);
-        return error(msg[MSG_ERROR_OUTPUT_FILE_WRITE]);
     }
 
-    if (gzclose(in) != Z_OK) {
-        return error(msg[MSG_ERROR_COMPRESSED_FILE_READ]);
-    }
+    inflateBackEnd(&strm);
+    fclose(in);
+    if (fclose(out) && state.failure == NULL && state.result == Z_OK)
+        state.failure = msg[MSG_ERROR_OUTPUT_FILE_WRITE];
 
-    return Z_OK;
+    return state.failure ? error(state.failure) : state.result;
 }
 
 /* ===========================================================================
@@ -470,16 +749,12 @@ int GzipCompress(file, level)
     unsigned int level;
 {
     local char outfile[MAX_NAME_LEN];
-    local char mode[4];
 
-    strcpy(mode, "wb ");
     if (level > 9)
         level = 9;
-    mode[2] = (char) ('0' + level);
 
     FILE  *in;
-    gzFile out;
-    int    err;
+    FILE  *out;
 
     strcpy(outfile, file);
     strcat(outfile, GZ_SUFFIX);
@@ -500,24 +775,26 @@ int GzipCompress(file, level)
         }
     }
 
-    out = gzopen(outfile, mode);
+    out = fopen(outfile, "wb");
     if (out == NULL) {
-        gzerror(out, &err);
-        // Even if err == Z_OK, a NULL gzFile is unusable.
         return error(msg[MSG_ERROR_OUTPUT_FILE_OPEN]) != DS2COMP_RETRY;
     }
     in = fopen(file, "rb");
     if (in == NULL) {
-        gzclose(out);
+        fclose(out);
         return error(msg[MSG_ERROR_INPUT_FILE_READ]) != DS2COMP_RETRY;
     }
 
     // Get the length of the source file for progress indication
     fseek(in, 0, SEEK_END);
     InitProgress(msg[MSG_PROGRESS_COMPRESSING], file, ftell(in));
+    // The output is rarely larger than the input. Reserve that much, so
+    // that it is written in one piece; what is left over is freed when
+    // it is closed. If that fails, it will simply be allocated as it grows.
+    fat_fallocate(out, ftell(in));
     fseek(in, 0, SEEK_SET);
 
-    int result = gz_compress(in, out);
+    int result = gz_compress(in, out, level);
     if (result == Z_OK) {
         remove(file); // compression succeeded, delete the original file
         return 1;
@@ -539,10 +816,12 @@ int GzipUncompress(file)
 {
     local char buf[MAX_NAME_LEN];
     const char *infile, *outfile;
+    FILE  *in;
     FILE  *out;
-    gzFile in;
-    int    err;
     int len = strlen(file);
+    unsigned char trailer[4];
+    unsigned long compressedSize;
+    unsigned long uncompressedSize = 0;
 
     strcpy(buf, file);
 
@@ -572,29 +851,35 @@ int GzipUncompress(file)
         }
     }
 
-    in = gzopen(infile, "rb");
+    in = fopen(infile, "rb");
     if (in == NULL) {
-        gzerror(in, &err);
-        // Even if err == Z_OK, a NULL gzFile is unusable.
         return error(msg[MSG_ERROR_COMPRESSED_FILE_READ]) != DS2COMP_RETRY;
     }
 
-    { // Get the length of the compressed file for progress indication
-        FILE *inCheck = fopen(infile, "rb");
-        if (inCheck == NULL) { // It existed just now...
-            gzclose(in);
-            return error(msg[MSG_ERROR_INPUT_FILE_READ]) != DS2COMP_RETRY;
-        }
-        fseek(inCheck, 0, SEEK_END);
-        InitProgress(msg[MSG_PROGRESS_DECOMPRESSING], infile, ftell(inCheck));
-        fclose(inCheck);
-    }
+    // Get the length of the compressed file for progress indication
+    fseek(in, 0, SEEK_END);
+    compressedSize = ftell(in);
+    InitProgress(msg[MSG_PROGRESS_DECOMPRESSING], infile, compressedSize);
+    // The gzip trailer ends with the uncompressed size, modulo 2^32
+    fseek(in, -4, SEEK_END);
+    if (fread(trailer, 1, 4, in) == 4)
+        uncompressedSize = trailer[0] | (trailer[1] << 8)
+            | (trailer[2] << 16) | ((unsigned long) trailer[3] << 24);
+    fseek(in, 0, SEEK_SET);
 
     out = fopen(outfile, "wb");
     if (out == NULL) {
-        gzclose(in);
+        fclose(in);
         return error(msg[MSG_ERROR_OUTPUT_FILE_OPEN]) != DS2COMP_RETRY;
     }
+    // Reserve the whole file up front, so that it is written in one piece.
+    // The trailer only covers the last member and may be damaged or made
+    // up, so skip this unless deflate could actually expand the file that
+    // much; fat_fallocate itself reserves nothing if the size is over the
+    // free space. Otherwise, it will simply be allocated as it grows.
+    if (uncompressedSize != 0
+     && uncompressedSize <= (unsigned long long) compressedSize * DEFLATE_MAX_RATIO)
+        fat_fallocate(out, uncompressedSize);
 
     int result = gz_uncompress(in, out);
     if (result == Z_OK) {
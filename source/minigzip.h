@@ -1,4 +1,10 @@
 #include "zlib.h"
 
+/* Compresses at level 1 with only the fixed Huffman codes, which zlib does in
+ * a single quick pass. It is above the zlib levels rather than 0, since a
+ * saved compression level of 0 has always meant level 1.
+ */
+#define GZ_LEVEL_QUICK 10
+
 int  GzipCompress     OF((const char  *file, unsigned int level));
 int  GzipUncompress   OF((const char  *file));
@@ -25,6 +25,7 @@
 
 #include <dirent.h>
 #include <stdio.h>
+#include <strings.h>
 #include <sys/stat.h>
 
 #ifdef STDC
@@ -79,6 +80,7 @@
 
 #define DECOMPRESSION_BUFFER_SIZE 131072
 #define MAX_NAME_LEN                1024
+#define DEFLATE_MAX_RATIO           1032 // most bytes one compressed byte expands to
 
 #include "gui.h"
 #include "draw.h"
@@ -86,8 +88,336 @@
 
 extern int error    OF((const char *message)); // to avoid duplicate definitions,
                                                // this one is in minigzip.c
+
+/* A directory known to exist during an extraction, and what is in it. */
+typedef struct {
+    char     *path;       /* full path of the directory */
+    char    **names;      /* names in it, sorted, if listed */
+    unsigned  name_count;
+    unsigned  name_space;
+    int       listed;     /* names holds everything in the directory */
+} known_dir;
+
+/* One member of the .zip file, in the order it is to be extracted. */
+typedef struct {
+    unz64_file_pos pos;    /* its record in the central directory */
+    ZPOS64_T       offset; /* its local header in the .zip file */
+} extract_step;
+
+local int compare_steps      OF((const void *a, const void *b));
+local unsigned plan_extraction OF((unzFile in));
+local void close_archive     OF((unzFile in));
+local int compare_names      OF((const void *a, const void *b));
+local known_dir *find_dir    OF((const char *path));
+local known_dir *add_dir     OF((const char *path, int listed));
+local int add_name           OF((known_dir *dir, const char *name, int sorted));
+local int list_dir           OF((known_dir *dir));
+local known_dir *lookup_dir  OF((const char *base, const char *member,
+                                 size_t length));
+local int member_exists      OF((known_dir *dir, const char *name,
+                                 const char *outfile));
 int ZipUncompress   OF((const char  *file));
 
+local extract_step *extract_plan = NULL;
+
+local known_dir **known_dirs = NULL;
+local unsigned    known_dir_count = 0, known_dir_space = 0;
+local unsigned    known_dir_last = 0;   /* the last one found */
+
+/* ===========================================================================
+ * Orders members by the offset of their local headers, then by their place
+ * in the central directory.
+ */
+local int compare_steps(a, b)
+    const void *a;
+    const void *b;
+{
+    const extract_step *step_a = (const extract_step *) a;
+    const extract_step *step_b = (const extract_step *) b;
+
+    if (step_a->offset != step_b->offset)
+        return step_a->offset < step_b->offset ? -1 : 1;
+    if (step_a->pos.num_of_file != step_b->pos.num_of_file)
+        return step_a->pos.num_of_file < step_b->pos.num_of_file ? -1 : 1;
+    return 0;
+}
+
+/* ===========================================================================
+ * Lists the members of the .zip file into extract_plan, sorted so that
+ * extracting them in that order reads the .zip file in one forward sweep
+ * instead of seeking back and forth when the central directory is not in
+ * the order of the data.
+ * Returns the number of members planned, or 0 if the central directory
+ *   cannot be read in full or memory runs out; extract_plan is then NULL and
+ *   the members are extracted in central directory order.
+ */
+local unsigned plan_extraction(in)
+    unzFile in;
+{
+    unsigned count = 0, size = 0;
+    int err;
+
+    for (err = unzGoToFirstFile(in); err == UNZ_OK; err = unzGoToNextFile(in)) {
+        if (count == size) {
+            extract_step *grown;
+            size = size ? size * 2 : 64;
+            grown = realloc(extract_plan, size * sizeof(extract_step));
+            if (grown == NULL)
+                break;
+            extract_plan = grown;
+        }
+        if (unzGetFilePos64(in, &extract_plan[count].pos) != UNZ_OK
+         || unzGetLocalHeaderOffset64(in, &extract_plan[count].offset) != UNZ_OK)
+            break;
+        count++;
+    }
+
+    if (err != UNZ_END_OF_LIST_OF_FILE || count == 0) {
+        free(extract_plan);
+        extract_plan = NULL;
+        return 0;
+    }
+
+    qsort(extract_plan, count, sizeof(extract_step), compare_steps);
+    return count;
+}
+
+/* ===========================================================================
+ * Closes the .zip file and frees what was used to extract it.
+ */
+local void close_archive(in)
+    unzFile in;
+{
+    unsigned i, j;
+
+    unzClose(in);
+    free(extract_plan);
+    extract_plan = NULL;
+
+    for (i = 0; i < known_dir_count; i++) {
+        for (j = 0; j < known_dirs[i]->name_count; j++)
+            free(known_dirs[i]->names[j]);
+        free(known_dirs[i]->names);
+        free(known_dirs[i]->path);
+        free(known_dirs[i]);
+    }
+    free(known_dirs);
+    known_dirs = NULL;
+    known_dir_count = known_dir_space = known_dir_last = 0;
+}
+
+/* ===========================================================================
+ * Orders names the way FAT compares them, ignoring case.
+ */
+local int compare_names(a, b)
+    const void *a;
+    const void *b;
+{
+    return strcasecmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+/* ===========================================================================
+ * Returns the known directory at path, or NULL if it is not known yet.
+ */
+local known_dir *find_dir(path)
+    const char *path;
+{
+    unsigned i;
+
+    // Members of the same directory tend to follow each other.
+    if (known_dir_count && strcasecmp(known_dirs[known_dir_last]->path, path) == 0)
+        return known_dirs[known_dir_last];
+    for (i = 0; i < known_dir_count; i++) {
+        if (strcasecmp(known_dirs[i]->path, path) == 0) {
+            known_dir_last = i;
+            return known_dirs[i];
+        }
+    }
+    return NULL;
+}
+
+/* ===========================================================================
+ * Records that the directory at path exists. If listed is set, it is known
+ * to be empty, having just been made.
+ * Returns the new known directory, or NULL if memory runs out.
+ */
+local known_dir *add_dir(path, listed)
+    const char *path;
+    int listed;
+{
+    known_dir *dir;
+
+    if (known_dir_count == known_dir_space) {
+        unsigned space = known_dir_space ? known_dir_space * 2 : 16;
+        known_dir **grown = realloc(known_dirs, space * sizeof(known_dir *));
+        if (grown == NULL)
+            return NULL;
+        known_dirs = grown;
+        known_dir_space = space;
+    }
+    dir = calloc(1, sizeof(known_dir));
+    if (dir == NULL)
+        return NULL;
+    dir->path = malloc(strlen(path) + 1);
+    if (dir->path == NULL) {
+        free(dir);
+        return NULL;
+    }
+    strcpy(dir->path, path);
+    dir->listed = listed;
+    known_dir_last = known_dir_count;
+    known_dirs[known_dir_count++] = dir;
+    return dir;
+}
+
+/* ===========================================================================
+ * Adds name to the names in dir, in its sorted place if sorted is set, or
+ * at the end if they are to be sorted afterwards.
+ * Returns 0 if memory runs out.
+ */
+local int add_name(dir, name, sorted)
+    known_dir *dir;
+    const char *name;
+    int sorted;
+{
+    unsigned low = dir->name_count, high, middle;
+    char *copy;
+
+    if (dir->name_count == dir->name_space) {
+        unsigned space = dir->name_space ? dir->name_space * 2 : 64;
+        char **grown = realloc(dir->names, space * sizeof(char *));
+        if (grown == NULL)
+            return 0;
+        dir->names = grown;
+        dir->name_space = space;
+    }
+    copy = malloc(strlen(name) + 1);
+    if (copy == NULL)
+        return 0;
+    strcpy(copy, name);
+
+    if (sorted) {
+        low = 0;
+        high = dir->name_count;
+        while (low < high) {
+            middle = low + (high - low) / 2;
+            if (strcasecmp(dir->names[middle], name) < 0)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        memmove(&dir->names[low + 1], &dir->names[low],
+                (dir->name_count - low) * sizeof(char *));
+    }
+    dir->names[low] = copy;
+    dir->name_count++;
+    return 1;
+}
+
+/* ===========================================================================
+ * Reads the names in dir once, so that whether members exist in it can be
+ * answered without opening them.
+ * Returns 0 if the directory cannot be read or memory runs out.
+ */
+local int list_dir(dir)
+    known_dir *dir;
+{
+    DIR *handle;
+    struct dirent *entry;
+    int ok = 1;
+
+    handle = opendir(dir->path);
+    if (handle == NULL)
+        return 0;
+    while (dir->name_count)
+        free(dir->names[--dir->name_count]);
+    while (ok && (entry = readdir(handle)) != NULL)
+        ok = add_name(dir, entry->d_name, 0);
+    closedir(handle);
+
+    if (dir->name_count > 1)
+        qsort(dir->names, dir->name_count, sizeof(char *), compare_names);
+    dir->listed = ok;
+    return ok;
+}
+
+/* ===========================================================================
+ * Finds the directory made of base, a '/' and the first length characters
+ * of member, which is base itself if length is 0. Directories on the way
+ * that are not known yet are looked for once with opendir and made if
+ * missing; base is assumed to exist.
+ * Returns the known directory, or NULL if the path is too long or memory
+ *   runs out.
+ */
+local known_dir *lookup_dir(base, member, length)
+    const char *base;
+    const char *member;
+    size_t length;
+{
+    char path[PATH_MAX + 1];
+    size_t base_len = strlen(base), i;
+    known_dir *dir;
+
+    if (base_len + 1 + length > PATH_MAX)
+        return NULL;
+    strcpy(path, base);
+    if (length) {
+        path[base_len] = '/';
+        memcpy(&path[base_len + 1], member, length);
+        path[base_len + 1 + length] = '\0';
+    }
+
+    dir = find_dir(path);
+    if (dir != NULL)
+        return dir;
+    if (length == 0)
+        return add_dir(path, 0);
+
+    // Check each directory on the way, the last one being the whole path.
+    for (i = 1; i <= length; i++) {
+        if (i < length && member[i] != '/')
+            continue;
+        path[base_len + 1 + i] = '\0';
+        dir = find_dir(path);
+        if (dir == NULL) {
+            DIR *handle = opendir(path);
+            if (handle != NULL) {
+                closedir(handle);
+                dir = add_dir(path, 0);
+            } else {
+                mkdir(path, 0755);
+                dir = add_dir(path, 1); // empty, having just been made
+            }
+            if (dir == NULL)
+                return NULL;
+        }
+        if (i < length)
+            path[base_len + 1 + i] = '/';
+    }
+    return dir;
+}
+
+/* ===========================================================================
+ * Returns whether name exists in dir, the directory of outfile. The
+ * directory is read once for all its members; outfile itself is only opened
+ * if dir is NULL or cannot be read.
+ */
+local int member_exists(dir, name, outfile)
+    known_dir *dir;
+    const char *name;
+    const char *outfile;
+{
+    if (dir != NULL && (dir->listed || list_dir(dir)))
+        return dir->name_count != 0
+            && bsearch(&name, dir->names, dir->name_count, sizeof(char *), compare_names) != NULL;
+
+    FILE *probe = fopen(outfile, "rb");
+    if (probe == NULL)
+        return 0;
+    fclose(probe);
+    return 1;
+}
+
 /* ===========================================================================
  * Uncompress the given .zip file and preserve it.
  * Returns 1 on success or if the user does not want to retry or has
@@ -116,14 +446,16 @@ int ZipUncompress(file)
 
     unz_global_info global_info;
     if (unzGetGlobalInfo(in, &global_info) != UNZ_OK) {
-        unzClose(in);
+        close_archive(in);
         return error(msg[MSG_ERROR_COMPRESSED_FILE_READ]) != DS2COMP_RETRY;
     }
 
     InitProgressMultiFile(msg[MSG_PROGRESS_DECOMPRESSING], file, global_info.number_entry);
 
-    if (unzGoToFirstFile(in) != UNZ_OK) {
-        unzClose(in);
+    // Extract in the order of the data in the .zip file if possible.
+    unsigned int PlanCount = plan_extraction(in), PlanIndex = 0;
+    if ((PlanCount ? unzGoToFilePos64(in, &extract_plan[0].pos) : unzGoToFirstFile(in)) != UNZ_OK) {
+        close_archive(in);
         return error(msg[MSG_ERROR_COMPRESSED_FILE_READ]) != DS2COMP_RETRY;
     }
     unsigned int CurrentFile = 0;
@@ -136,7 +468,7 @@ int ZipUncompress(file)
         unz_file_info file_info;
         char Filename[PATH_MAX + 1];
         if (unzGetCurrentFileInfo(in, &file_info, Filename, sizeof (Filename), NULL, 0 /* not interested in the extra field */, NULL, 0 /* not interested in the global comment */) != UNZ_OK) {
-            unzClose(in);
+            close_archive(in);
             return error(msg[MSG_ERROR_COMPRESSED_FILE_READ]) != DS2COMP_RETRY;
         }
 
@@ -151,15 +483,15 @@ int ZipUncompress(file)
         strcpy(outfile, Path);
         strcat(outfile, "/");
         strcat(outfile, Filename); // buffer overflow possible
-        // 2. Check whether the file exists.
-        unsigned int FileExists = 0;
-        FILE *outCheck = fopen(outfile, "rb");
-        if (outCheck) {
-            // The target file exists. Ask the user if he or she wishes
-            // to overwrite it.
-            FileExists = 1;
-            fclose(outCheck);  // ... after closing it
-        }
+        // 2. Make missing parent directories, each one once per archive; if
+        //    they were missing, so is the file. Then check whether the file
+        //    exists. If it does, ask the user whether they wish to
+        //    overwrite it.
+        // Assume the directory containing the .zip archive exists.
+        char *BaseName = strrchr(Filename, '/');
+        known_dir *OutDir = lookup_dir(Path, Filename, BaseName ? (size_t) (BaseName - Filename) : 0);
+        BaseName = BaseName ? BaseName + 1 : Filename;
+        unsigned int FileExists = member_exists(OutDir, BaseName, outfile);
         // a) It does, but the user already said they want to leave files
         //    intact. Next!
         if (FileExists && LeaveAllFiles /* && AllFilesAsked */)
@@ -194,35 +526,27 @@ int ZipUncompress(file)
             }
         }
 
-        // 3. Make missing parent directories.
-        // Assume the directory containing the .zip archive exists.
-        unsigned int DirLen = 0;
-        while (Filename[DirLen]) {
-            if (Filename[DirLen] == '/') { // Found a new path component
-                char IntermediatePath[PATH_MAX + 1];
-                strcpy(IntermediatePath, Path);
-                strcat(IntermediatePath, "/");
-                Filename[DirLen] = '\0';
-                strcat(IntermediatePath, Filename); // buffer overflow possible
-                Filename[DirLen] = '/';
-                DIR *IntermediateDir = opendir(IntermediatePath);
-                if (IntermediateDir)
-                    closedir(IntermediateDir);
-                else
-                    mkdir(IntermediatePath, 0755);
-            }
-            DirLen++;
-        }
-
-        // 4. Open the output file.
+        // 3. Open the output file.
         out = fopen(outfile, "wb");
         if (out == NULL) {
-            unzClose(in);
+            close_archive(in);
             return error(msg[MSG_ERROR_OUTPUT_FILE_OPEN]) != DS2COMP_RETRY;
         }
+        // Reserve the whole file up front, so that it is written in one
+        // piece. The size comes from the archive, which may be damaged or
+        // made up, so skip this unless deflate could actually expand the
+        // member that much; fat_fallocate itself reserves nothing if the
+        // size is over the free space. Otherwise, the file will simply be
+        // allocated as it grows.
+        if (file_info.uncompressed_size != 0
+         && file_info.uncompressed_size <= (unsigned long long) file_info.compressed_size * DEFLATE_MAX_RATIO)
+            fat_fallocate(out, file_info.uncompressed_size);
+        // A later member with the same name is now asked about.
+        if (OutDir != NULL && OutDir->listed && !FileExists && !add_name(OutDir, BaseName, 1))
+            OutDir->listed = 0;
 
         if (unzOpenCurrentFile(in) != UNZ_OK) {
-            unzClose(in);
+            close_archive(in);
             fclose(out);
             return error(msg[MSG_ERROR_COMPRESSED_FILE_READ]) != DS2COMP_RETRY;
         }
@@ -230,12 +554,12 @@ int ZipUncompress(file)
         local char buf[DECOMPRESSION_BUFFER_SIZE];
         int len;
 
-        // 5. Unpack into the output file. Update progress accordingly.
+        // 4. Unpack into the output file. Update progress accordingly.
         for (;;) {
             len = unzReadCurrentFile(in, buf, sizeof(buf));
             if (len < 0) {
                 unzCloseCurrentFile(in);
-                unzClose(in);
+                close_archive(in);
                 fclose(out);
                 remove(outfile); // PARTIAL FILE
                 return error(msg[MSG_ERROR_COMPRESSED_FILE_READ]) != DS2COMP_RETRY;
@@ -244,7 +568,7 @@ int ZipUncompress(file)
 
             if (fwrite(buf, 1, len, out) != len) {
                 unzCloseCurrentFile(in);
-                unzClose(in);
+                close_archive(in);
                 fclose(out);
                 remove(outfile); // PARTIAL FILE
                 return error(msg[MSG_ERROR_OUTPUT_FILE_WRITE]) != DS2COMP_RETRY;
@@ -252,7 +576,7 @@ int ZipUncompress(file)
 
             if (ReadInputDuringCompression() & DS_BUTTON_B) {
                 unzCloseCurrentFile(in);
-                unzClose(in);
+                close_archive(in);
                 fclose(out);
                 remove(outfile); // PARTIAL FILE
                 return 1;
@@ -263,26 +587,30 @@ int ZipUncompress(file)
 
         fclose(out);
         if (unzCloseCurrentFile(in) != UNZ_OK) { // CRC32 mismatch
-            unzClose(in);
+            close_archive(in);
             remove(outfile); // BAD FILE
             return error(msg[MSG_ERROR_COMPRESSED_FILE_READ]) != DS2COMP_RETRY;
         }
 
 next_file: ;
-        int result = unzGoToNextFile(in);
+        int result;
+        if (PlanCount)
+            result = (++PlanIndex < PlanCount) ? unzGoToFilePos64(in, &extract_plan[PlanIndex].pos) : UNZ_END_OF_LIST_OF_FILE;
+        else
+            result = unzGoToNextFile(in);
         if (result == UNZ_END_OF_LIST_OF_FILE) {
             unzCloseCurrentFile(in);
-            unzClose(in);
+            close_archive(in);
             return 1;
         } else if (result != UNZ_OK) {
             unzCloseCurrentFile(in);
-            unzClose(in);
+            close_archive(in);
             return error(msg[MSG_ERROR_COMPRESSED_FILE_READ]) != DS2COMP_RETRY;
         }
     }
 
     // The .zip file should already be closed above, but if control goes here,
     // then close it anyway.
-    unzClose(in);
+    close_archive(in);
     return 1;
 }
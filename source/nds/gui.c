@@ -61,6 +61,7 @@ char msg_data[16 * 1024] __attribute__((section(".noinit")));
 
 #define LANGUAGE_PACK   "SYSTEM/language.msg"
 #define APPLICATION_CONFIG_FILENAME "SYSTEM/ds2comp.cfg"
+#define FS_STATS_LOG_FILENAME "SYSTEM/fsstats.log"
 
 #define APPLICATION_CONFIG_HEADER  "D2CM1.0"
 #define APPLICATION_CONFIG_HEADER_SIZE 7
@@ -1554,6 +1555,42 @@ static void DisplayExit(struct Entry* DrawnEntry, struct Entry* ActiveEntry, uin
 	draw_string_vcenter(DS2_GetSubScreen(), 154, 177, 75, TextColor, *DrawnEntry->Name);
 }
 
+/*
+ * Appends the card activity of the last job to the file system statistics
+ * log. Nothing is written unless the log already exists, so creating an
+ * empty SYSTEM/fsstats.log turns logging on.
+ */
+static void LogFileSystemStats(const char* Job, const char* Path)
+{
+	char tmp_path[PATH_MAX];
+	FAT_STATS stats;
+	FILE* fp;
+
+	if (fat_getStats(&stats) != 0)
+		return;
+
+	sprintf(tmp_path, "%s/%s", main_path, FS_STATS_LOG_FILENAME);
+	fp = fopen(tmp_path, "rb");
+	if (fp == NULL)
+		return;
+	fclose(fp);
+
+	fp = fopen(tmp_path, "a");
+	if (fp == NULL)
+		return;
+	fprintf(fp, "%s %s: reads %u (%u sectors), writes %u (%u sectors), "
+		"cache hits %u, misses %u, read-ahead %u sectors, write-backs %u, "
+		"FAT lookups %u, FAT updates %u, path components %u, dentry hits %u\n",
+		Job, Path,
+		stats.cache.readCommands, stats.cache.sectorsRead,
+		stats.cache.writeCommands, stats.cache.sectorsWritten,
+		stats.cache.hits, stats.cache.misses,
+		stats.cache.readAheadSectors, stats.cache.writeBacks,
+		stats.partition.fatLookups, stats.partition.fatUpdates,
+		stats.partition.pathComponents, stats.partition.dentryHits);
+	fclose(fp);
+}
+
 void ActionCompress(struct Menu** ActiveMenu, uint32_t* ActiveEntryIndex)
 {
 	const char *file_ext[] = { NULL }; // Show all files
@@ -1573,9 +1610,11 @@ void ActionCompress(struct Menu** ActiveMenu, uint32_t* ActiveEntryIndex)
 		uint32_t level = application_config.CompressionLevel;
 		if (level == 0)
 			level = 1;
-		else if (level > 9)
+		else if (level > 9 && level != GZ_LEVEL_QUICK)
 			level = 9;
+		fat_resetStats();
 		while (!GzipCompress(line_buffer, level)); // retry if needed
+		LogFileSystemStats("compress", line_buffer);
 
 		DS2_LowClockSpeed();
 		*ActiveMenu = NULL;
@@ -1598,10 +1637,12 @@ void ActionDecompress(struct Menu** ActiveMenu, uint32_t* ActiveEntryIndex)
 		DS2_SetScreenBacklights(DS_SCREEN_UPPER);
 
 		DS2_HighClockSpeed();
+		fat_resetStats();
 		if (strcasecmp(&line_buffer[strlen(line_buffer) - 3 /* .gz */], ".gz") == 0)
 			while (!GzipUncompress(line_buffer)); // retry if needed
 		else if (strcasecmp(&line_buffer[strlen(line_buffer) - 4 /* .zip */], ".zip") == 0)
 			while (!ZipUncompress(line_buffer)); // retry if needed
+		LogFileSystemStats("decompress", line_buffer);
 
 		DS2_LowClockSpeed();
 		*ActiveMenu = NULL;
@@ -1669,7 +1710,9 @@ static void DisplayCompressionLevelValue(struct Entry* DrawnEntry, struct Entry*
 	const char* Value = Temp;
 	bool Error = false;
 
-	if (*(uint32_t*) DrawnEntry->Target < DrawnEntry->ChoiceCount)
+	if (*(uint32_t*) DrawnEntry->Target == GZ_LEVEL_QUICK)
+		Value = msg[MSG_OPTIONS_COMPRESSION_LEVEL_QUICK];
+	else if (*(uint32_t*) DrawnEntry->Target < DrawnEntry->ChoiceCount)
 		sprintf(Temp, "%" PRIu32, *(uint32_t*) DrawnEntry->Target);
 	else {
 		Value = "Out of bounds";
@@ -1735,7 +1778,7 @@ static struct Entry Options_Language = {
 };
 
 static struct Entry Options_CompressionLevel = {
-	ENTRY_OPTION(&msg[MSG_OPTIONS_COMPRESSION_LEVEL], &application_config.CompressionLevel, 10),
+	ENTRY_OPTION(&msg[MSG_OPTIONS_COMPRESSION_LEVEL], &application_config.CompressionLevel, GZ_LEVEL_QUICK + 1),
 	.DisplayValue = DisplayCompressionLevelValue
 };
 
@@ -30,6 +30,7 @@ enum MSG {
 	MSG_FILE_MENU_SORTING_LIST,
 
 	MSG_OPTIONS_COMPRESSION_LEVEL,
+	MSG_OPTIONS_COMPRESSION_LEVEL_QUICK,
 	MSG_OPTIONS_LANGUAGE,
 	MSG_OPTIONS_CARD_CAPACITY,
 	MSG_OPTIONS_RESET,
@@ -84,10 +84,27 @@
 #define UNZ_BUFSIZE (16384)
 #endif
 
+/* The buffer for compressed data is the smallest power of 2 from
+   UNZ_BUFSIZE to UNZ_MAXBUFSIZE that holds the whole file, or less if
+   memory is short. Both must be powers of 2. */
+#ifndef UNZ_MAXBUFSIZE
+#define UNZ_MAXBUFSIZE (262144)
+#endif
+
+/* filestream_pos when the position of the filestream is not known */
+#define UNZ_UNKNOWNPOS ((ZPOS64_T)-1)
+
 #ifndef UNZ_MAXFILENAMEINZIP
 #define UNZ_MAXFILENAMEINZIP (256)
 #endif
 
+/* Central directories up to this size are read in one go by unzOpen and
+   walked in memory afterwards. Define NOCDINDEX to always read them from
+   the file, record by record. */
+#ifndef UNZ_MAXCDINDEX
+#define UNZ_MAXCDINDEX (2*1024*1024)
+#endif
+
 #ifndef ALLOC
 # define ALLOC(size) (malloc(size))
 #endif
@@ -108,12 +125,28 @@ typedef struct unz_file_info64_internal_s
     ZPOS64_T offset_curfile;/* relative offset of local header 8 bytes */
 } unz_file_info64_internal;
 
+#ifndef NOCDINDEX
+/* unz64_cd_entry_s is one central directory record read in memory. The
+   other fields of the record, its file name, extra field and comment are
+   taken from the copy of the central directory when needed */
+typedef struct unz64_cd_entry_s
+{
+    uLong    record;            /* offset of the record in the central dir */
+    uLong    crc;               /* crc-32 */
+    uLong    compression_method;/* compression method */
+    ZPOS64_T compressed_size;   /* compressed size, after the zip64 field */
+    ZPOS64_T uncompressed_size; /* uncompressed size, after the zip64 field */
+    ZPOS64_T offset_curfile;    /* relative offset of local header */
+} unz64_cd_entry;
+#endif
+
 
 /* file_in_zip_read_info_s contain internal information about a file in zipfile,
     when reading and decompress it */
 typedef struct
 {
     char  *read_buffer;         /* internal buffer for compressed data */
+    uInt  read_buffer_size;     /* size of read_buffer, a power of 2 */
     z_stream stream;            /* zLib stream structure for inflate */
 
 #ifdef HAVE_BZIP2
@@ -147,6 +180,8 @@ typedef struct
     zlib_filefunc64_32_def z_filefunc;
     int is64bitOpenFunction;
     voidpf filestream;        /* io structore of the zipfile */
+    ZPOS64_T filestream_pos;    /* position of filestream, as left by
+                                   unzReadCurrentFile, or UNZ_UNKNOWNPOS */
     unz_global_info64 gi;       /* public global information */
     ZPOS64_T byte_before_the_zipfile;/* byte before the zipfile, (>0 for sfx)*/
     ZPOS64_T num_file;             /* number of the current file in the zipfile*/
@@ -166,6 +201,13 @@ typedef struct
 
     int isZip64;
 
+#ifndef NOCDINDEX
+    unsigned char* cd_buffer;   /* the central directory, NULL if not read */
+    unz64_cd_entry* cd_entry;   /* its records, in central directory order */
+    uLong cd_count;             /* number of records in cd_entry */
+    uLong cd_hint;              /* record last looked up in cd_entry */
+#endif
+
 #    ifndef NOUNCRYPT
     unsigned long keys[3];     /* keys defining the pseudo-random sequence */
     const z_crc_t* pcrc_32_tab;
@@ -551,6 +593,239 @@ local ZPOS64_T unz64local_SearchCentralDir64(const zlib_filefunc64_32_def* pzlib
     return relativeOffset;
 }
 
+#ifndef NOCDINDEX
+/* ===========================================================================
+   Reads little endian values from the copy of the central directory
+*/
+local uLong unz64local_peekShort OF((const unsigned char* p));
+local uLong unz64local_peekShort (const unsigned char* p)
+{
+    return (uLong)p[0] | ((uLong)p[1]<<8);
+}
+
+local uLong unz64local_peekLong OF((const unsigned char* p));
+local uLong unz64local_peekLong (const unsigned char* p)
+{
+    return (uLong)p[0] | ((uLong)p[1]<<8) | ((uLong)p[2]<<16) | ((uLong)p[3]<<24);
+}
+
+local ZPOS64_T unz64local_peekLong64 OF((const unsigned char* p));
+local ZPOS64_T unz64local_peekLong64 (const unsigned char* p)
+{
+    return (ZPOS64_T)unz64local_peekLong(p) |
+           ((ZPOS64_T)unz64local_peekLong(p+4)<<32);
+}
+
+/*
+  Parse the record at offset record of the copy of the central directory
+    into *pentry (if not NULL), reading the zip64 extra field the same way
+    as unz64local_GetCurrentFileInfoInternal.
+  return the offset of the next record, or 0 if this one does not fit in
+    the copy and must be read from the file
+*/
+local uLong unz64local_ParseCentralDirRecord OF((const unsigned char* buf,
+                                                 uLong size,
+                                                 uLong record,
+                                                 unz64_cd_entry* pentry));
+
+local uLong unz64local_ParseCentralDirRecord (const unsigned char* buf,
+                                              uLong size,
+                                              uLong record,
+                                              unz64_cd_entry* pentry)
+{
+    const unsigned char* rec = buf + record;
+    uLong size_filename, size_file_extra, size_file_comment;
+    uLong pos, acc;
+
+    if ((size - record < SIZECENTRALDIRITEM) ||
+        (unz64local_peekLong(rec) != 0x02014b50))
+        return 0;
+
+    size_filename = unz64local_peekShort(rec + 28);
+    size_file_extra = unz64local_peekShort(rec + 30);
+    size_file_comment = unz64local_peekShort(rec + 32);
+    if (size - record - SIZECENTRALDIRITEM <
+        size_filename + size_file_extra + size_file_comment)
+        return 0;
+
+    if (pentry != NULL)
+    {
+        pentry->record = record;
+        pentry->compression_method = unz64local_peekShort(rec + 10);
+        pentry->crc = unz64local_peekLong(rec + 16);
+        pentry->compressed_size = unz64local_peekLong(rec + 20);
+        pentry->uncompressed_size = unz64local_peekLong(rec + 24);
+        pentry->offset_curfile = unz64local_peekLong(rec + 42);
+
+        pos = record + SIZECENTRALDIRITEM + size_filename;
+        acc = 0;
+        while (acc < size_file_extra)
+        {
+            uLong headerId;
+            uLong dataSize;
+
+            if (size - pos < 4)
+                return 0;
+            headerId = unz64local_peekShort(buf + pos);
+            dataSize = unz64local_peekShort(buf + pos + 2);
+            pos += 4;
+
+            /* ZIP64 extra fields */
+            if (headerId == 0x0001)
+            {
+                if (pentry->uncompressed_size == MAXU32)
+                {
+                    if (size - pos < 8)
+                        return 0;
+                    pentry->uncompressed_size = unz64local_peekLong64(buf + pos);
+                    pos += 8;
+                }
+
+                if (pentry->compressed_size == MAXU32)
+                {
+                    if (size - pos < 8)
+                        return 0;
+                    pentry->compressed_size = unz64local_peekLong64(buf + pos);
+                    pos += 8;
+                }
+
+                if (pentry->offset_curfile == MAXU32)
+                {
+                    if (size - pos < 8)
+                        return 0;
+                    pentry->offset_curfile = unz64local_peekLong64(buf + pos);
+                    pos += 8;
+                }
+
+                /* the disk start number has 2 bytes, so it is never MAXU32 */
+            }
+            else
+            {
+                if (size - pos < dataSize)
+                    return 0;
+                pos += dataSize;
+            }
+
+            acc += 2 + 2 + dataSize;
+        }
+    }
+
+    return record + SIZECENTRALDIRITEM + size_filename + size_file_extra +
+           size_file_comment;
+}
+
+/*
+  Read the central directory of the zipfile in one go and index its records,
+    so that going through the files and getting their info reads nothing
+    more from the zipfile.
+  Records that can't be parsed, and the ones after them, are still read
+    from the zipfile. Nothing is kept if the central directory is larger than
+    UNZ_MAXCDINDEX or there is not enough memory for it.
+*/
+local void unz64local_IndexCentralDir OF((unz64_s* s));
+local void unz64local_IndexCentralDir (unz64_s* s)
+{
+    unsigned char* buf;
+    unz64_cd_entry* entry;
+    uLong size, record, count, i;
+
+    s->cd_buffer = NULL;
+    s->cd_entry = NULL;
+    s->cd_count = 0;
+    s->cd_hint = 0;
+
+    if ((s->size_central_dir == 0) || (s->size_central_dir > UNZ_MAXCDINDEX))
+        return;
+    size = (uLong)s->size_central_dir;
+
+    buf = (unsigned char*)ALLOC(size);
+    if (buf == NULL)
+        return;
+
+    if ((ZSEEK64(s->z_filefunc, s->filestream,
+                 s->offset_central_dir + s->byte_before_the_zipfile,
+                 ZLIB_FILEFUNC_SEEK_SET) != 0) ||
+        (ZREAD64(s->z_filefunc, s->filestream, buf, size) != size))
+    {
+        TRYFREE(buf);
+        return;
+    }
+
+    for (record = 0, count = 0; record < size; count++)
+    {
+        record = unz64local_ParseCentralDirRecord(buf, size, record, NULL);
+        if (record == 0)
+            break;
+    }
+
+    entry = (count > 0) ? (unz64_cd_entry*)ALLOC(count * sizeof(unz64_cd_entry)) : NULL;
+    if (entry == NULL)
+    {
+        TRYFREE(buf);
+        return;
+    }
+
+    for (record = 0, i = 0; i < count; i++)
+    {
+        record = unz64local_ParseCentralDirRecord(buf, size, record, &entry[i]);
+        if (record == 0)
+            break;
+    }
+
+    if (i == 0)
+    {
+        TRYFREE(entry);
+        TRYFREE(buf);
+        return;
+    }
+
+    s->cd_buffer = buf;
+    s->cd_entry = entry;
+    s->cd_count = i;
+}
+
+/*
+  Find the indexed record at pos_in_central_dir pos.
+  return NULL if that record is not in the index
+*/
+local const unz64_cd_entry* unz64local_FindCentralDirEntry OF((unz64_s* s,
+                                                              ZPOS64_T pos));
+local const unz64_cd_entry* unz64local_FindCentralDirEntry (unz64_s* s,
+                                                           ZPOS64_T pos)
+{
+    uLong record, low, high, middle;
+
+    if ((pos < s->offset_central_dir) ||
+        (pos - s->offset_central_dir >= s->size_central_dir))
+        return NULL;
+    record = (uLong)(pos - s->offset_central_dir);
+
+    /* going through the files asks for the record after the last one */
+    if (s->cd_entry[s->cd_hint].record == record)
+        return &s->cd_entry[s->cd_hint];
+    if ((s->cd_hint + 1 < s->cd_count) &&
+        (s->cd_entry[s->cd_hint + 1].record == record))
+        return &s->cd_entry[++s->cd_hint];
+
+    low = 0;
+    high = s->cd_count;
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+        if (s->cd_entry[middle].record < record)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if ((low < s->cd_count) && (s->cd_entry[low].record == record))
+    {
+        s->cd_hint = low;
+        return &s->cd_entry[low];
+    }
+    return NULL;
+}
+#endif
+
 /*
   Open a Zip file. path contain the full pathname (by example,
      on a Windows NT computer "c:\\test\\zlib114.zip" or on an Unix computer
@@ -729,12 +1004,16 @@ local unzFile unzOpenInternal (const void *path,
     us.central_pos = central_pos;
     us.pfile_in_zip_read = NULL;
     us.encrypted = 0;
+    us.filestream_pos = UNZ_UNKNOWNPOS;
 
 
     s=(unz64_s*)ALLOC(sizeof(unz64_s));
     if( s != NULL)
     {
         *s=us;
+#ifndef NOCDINDEX
+        unz64local_IndexCentralDir(s);
+#endif
         unzGoToFirstFile((unzFile)s);
     }
     return (unzFile)s;
@@ -795,6 +1074,10 @@ extern int ZEXPORT unzClose (unzFile file)
         unzCloseCurrentFile(file);
 
     ZCLOSE64(s->z_filefunc, s->filestream);
+#ifndef NOCDINDEX
+    TRYFREE(s->cd_entry);
+    TRYFREE(s->cd_buffer);
+#endif
     TRYFREE(s);
     return UNZ_OK;
 }
@@ -841,6 +1124,101 @@ local void unz64local_DosDateToTmuDate (ZPOS64_T ulDosDate, tm_unz* ptm)
     ptm->tm_sec =  (uInt) (2*(ulDosDate&0x1f)) ;
 }
 
+#ifndef NOCDINDEX
+/*
+  Get Info about the current file from its indexed record, like
+    unz64local_GetCurrentFileInfoInternal does from the zipfile
+*/
+local int unz64local_GetIndexedFileInfo OF((const unz64_s* s,
+                                           const unz64_cd_entry* entry,
+                                           unz_file_info64 *pfile_info,
+                                           unz_file_info64_internal
+                                           *pfile_info_internal,
+                                           char *szFileName,
+                                           uLong fileNameBufferSize,
+                                           void *extraField,
+                                           uLong extraFieldBufferSize,
+                                           char *szComment,
+                                           uLong commentBufferSize));
+
+local int unz64local_GetIndexedFileInfo (const unz64_s* s,
+                                         const unz64_cd_entry* entry,
+                                         unz_file_info64 *pfile_info,
+                                         unz_file_info64_internal
+                                         *pfile_info_internal,
+                                         char *szFileName,
+                                         uLong fileNameBufferSize,
+                                         void *extraField,
+                                         uLong extraFieldBufferSize,
+                                         char *szComment,
+                                         uLong commentBufferSize)
+{
+    const unsigned char* rec = s->cd_buffer + entry->record;
+    const unsigned char* field = rec + SIZECENTRALDIRITEM;
+    unz_file_info64 file_info;
+    uLong uSizeRead;
+
+    file_info.version = unz64local_peekShort(rec + 4);
+    file_info.version_needed = unz64local_peekShort(rec + 6);
+    file_info.flag = unz64local_peekShort(rec + 8);
+    file_info.compression_method = entry->compression_method;
+    file_info.dosDate = unz64local_peekLong(rec + 12);
+    unz64local_DosDateToTmuDate(file_info.dosDate,&file_info.tmu_date);
+    file_info.crc = entry->crc;
+    file_info.compressed_size = entry->compressed_size;
+    file_info.uncompressed_size = entry->uncompressed_size;
+    file_info.size_filename = unz64local_peekShort(rec + 28);
+    file_info.size_file_extra = unz64local_peekShort(rec + 30);
+    file_info.size_file_comment = unz64local_peekShort(rec + 32);
+    file_info.disk_num_start = unz64local_peekShort(rec + 34);
+    file_info.internal_fa = unz64local_peekShort(rec + 36);
+    file_info.external_fa = unz64local_peekLong(rec + 38);
+
+    if (szFileName!=NULL)
+    {
+        if (file_info.size_filename<fileNameBufferSize)
+        {
+            *(szFileName+file_info.size_filename)='\0';
+            uSizeRead = file_info.size_filename;
+        }
+        else
+            uSizeRead = fileNameBufferSize;
+        memcpy(szFileName,field,uSizeRead);
+    }
+    field += file_info.size_filename;
+
+    if (extraField!=NULL)
+    {
+        if (file_info.size_file_extra<extraFieldBufferSize)
+            uSizeRead = file_info.size_file_extra;
+        else
+            uSizeRead = extraFieldBufferSize;
+        memcpy(extraField,field,uSizeRead);
+    }
+    field += file_info.size_file_extra;
+
+    if (szComment!=NULL)
+    {
+        if (file_info.size_file_comment<commentBufferSize)
+        {
+            *(szComment+file_info.size_file_comment)='\0';
+            uSizeRead = file_info.size_file_comment;
+        }
+        else
+            uSizeRead = commentBufferSize;
+        memcpy(szComment,field,uSizeRead);
+    }
+
+    if (pfile_info!=NULL)
+        *pfile_info=file_info;
+
+    if (pfile_info_internal!=NULL)
+        pfile_info_internal->offset_curfile = entry->offset_curfile;
+
+    return UNZ_OK;
+}
+#endif
+
 /*
   Get Info about the current file in the zipfile, with internal only info
 */
@@ -877,6 +1255,22 @@ local int unz64local_GetCurrentFileInfoInternal (unzFile file,
     if (file==NULL)
         return UNZ_PARAMERROR;
     s=(unz64_s*)file;
+
+#ifndef NOCDINDEX
+    if (s->cd_entry!=NULL)
+    {
+        const unz64_cd_entry* entry;
+        entry = unz64local_FindCentralDirEntry(s,s->pos_in_central_dir);
+        if (entry!=NULL)
+            return unz64local_GetIndexedFileInfo(s,entry,pfile_info,
+                                                 pfile_info_internal,
+                                                 szFileName,fileNameBufferSize,
+                                                 extraField,extraFieldBufferSize,
+                                                 szComment,commentBufferSize);
+    }
+#endif
+
+    s->filestream_pos = UNZ_UNKNOWNPOS;
     if (ZSEEK64(s->z_filefunc, s->filestream,
               s->pos_in_central_dir+s->byte_before_the_zipfile,
               ZLIB_FILEFUNC_SEEK_SET)!=0)
@@ -1231,6 +1625,40 @@ extern int ZEXPORT unzLocateFile (unzFile file, const char *szFileName, int iCas
     if (!s->current_file_ok)
         return UNZ_END_OF_LIST_OF_FILE;
 
+#ifndef NOCDINDEX
+    /* With every file indexed, only the names need to be compared */
+    if ((s->cd_entry!=NULL) && (s->gi.number_entry!=0) &&
+        (s->gi.number_entry!=0xffff) && (s->cd_count>=s->gi.number_entry))
+    {
+        uLong i;
+        for (i=0;i<(uLong)s->gi.number_entry;i++)
+        {
+            char szCurrentFileName[UNZ_MAXFILENAMEINZIP+1];
+            const unsigned char* rec = s->cd_buffer + s->cd_entry[i].record;
+            uLong size_filename = unz64local_peekShort(rec + 28);
+
+            if (size_filename>UNZ_MAXFILENAMEINZIP)
+                size_filename=UNZ_MAXFILENAMEINZIP;
+            memcpy(szCurrentFileName,rec+SIZECENTRALDIRITEM,size_filename);
+            szCurrentFileName[size_filename]='\0';
+
+            if (unzStringFileNameCompare(szCurrentFileName,
+                                            szFileName,iCaseSensitivity)==0)
+            {
+                s->pos_in_central_dir = s->offset_central_dir +
+                                        s->cd_entry[i].record;
+                s->num_file = i;
+                err = unz64local_GetCurrentFileInfoInternal(file,&s->cur_file_info,
+                                                           &s->cur_file_info_internal,
+                                                           NULL,0,NULL,0,NULL,0);
+                s->current_file_ok = (err == UNZ_OK);
+                return err;
+            }
+        }
+        return UNZ_END_OF_LIST_OF_FILE;
+    }
+#endif
+
     /* Save the current state */
     num_fileSaved = s->num_file;
     pos_in_central_dirSaved = s->pos_in_central_dir;
@@ -1373,6 +1801,7 @@ local int unz64local_CheckCurrentFileCoherencyHeader (unz64_s* s, uInt* piSizeVa
     *poffset_local_extrafield = 0;
     *psize_local_extrafield = 0;
 
+    s->filestream_pos = UNZ_UNKNOWNPOS;
     if (ZSEEK64(s->z_filefunc, s->filestream,s->cur_file_info_internal.offset_curfile +
                                 s->byte_before_the_zipfile,ZLIB_FILEFUNC_SEEK_SET)!=0)
         return UNZ_ERRNO;
@@ -1479,7 +1908,21 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
     if (pfile_in_zip_read_info==NULL)
         return UNZ_INTERNALERROR;
 
-    pfile_in_zip_read_info->read_buffer=(char*)ALLOC(UNZ_BUFSIZE);
+    /* Large files get the largest buffer there is memory for, so that
+       they are read in as few pieces as possible */
+    pfile_in_zip_read_info->read_buffer_size = UNZ_BUFSIZE;
+    while ((pfile_in_zip_read_info->read_buffer_size < UNZ_MAXBUFSIZE) &&
+           (pfile_in_zip_read_info->read_buffer_size < s->cur_file_info.compressed_size))
+        pfile_in_zip_read_info->read_buffer_size *= 2;
+    for (;;)
+    {
+        pfile_in_zip_read_info->read_buffer =
+            (char*)ALLOC(pfile_in_zip_read_info->read_buffer_size);
+        if ((pfile_in_zip_read_info->read_buffer != NULL) ||
+            (pfile_in_zip_read_info->read_buffer_size <= UNZ_BUFSIZE))
+            break;
+        pfile_in_zip_read_info->read_buffer_size /= 2;
+    }
     pfile_in_zip_read_info->offset_local_extrafield = offset_local_extrafield;
     pfile_in_zip_read_info->size_local_extrafield = size_local_extrafield;
     pfile_in_zip_read_info->pos_local_extrafield=0;
@@ -1596,6 +2039,7 @@ extern int ZEXPORT unzOpenCurrentFile3 (unzFile file, int* method,
         int i;
         s->pcrc_32_tab = get_crc_table();
         init_keys(password,s->keys,s->pcrc_32_tab);
+        s->filestream_pos = UNZ_UNKNOWNPOS;
         if (ZSEEK64(s->z_filefunc, s->filestream,
                   s->pfile_in_zip_read->pos_in_zipfile +
                      s->pfile_in_zip_read->byte_before_the_zipfile,
@@ -1649,6 +2093,25 @@ extern ZPOS64_T ZEXPORT unzGetCurrentFileZStreamPos64( unzFile file)
 
 /** Addition for GDAL : END */
 
+/*
+  Seek the zipfile to pos for unzReadCurrentFile, unless it is already
+    there after the previous read of the current file
+  return 0 if there is no problem
+*/
+local int unz64local_SeekForRead OF((unz64_s* s, ZPOS64_T pos));
+local int unz64local_SeekForRead (unz64_s* s, ZPOS64_T pos)
+{
+    if (s->filestream_pos == pos)
+        return 0;
+    if (ZSEEK64(s->z_filefunc, s->filestream, pos, ZLIB_FILEFUNC_SEEK_SET)!=0)
+    {
+        s->filestream_pos = UNZ_UNKNOWNPOS;
+        return -1;
+    }
+    s->filestream_pos = pos;
+    return 0;
+}
+
 /*
   Read bytes from the current file.
   buf contain buffer where data must be copied
@@ -1696,25 +2159,76 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
 
     while (pfile_in_zip_read_info->stream.avail_out>0)
     {
+        /* Stored data needs no work, so when the caller asks for at least
+           a buffer of it, read it straight into the caller's buffer in one
+           go instead of copying it through read_buffer */
+        if ((pfile_in_zip_read_info->stream.avail_in==0) &&
+            (pfile_in_zip_read_info->rest_read_compressed>0) &&
+            (pfile_in_zip_read_info->stream.avail_out>=UNZ_BUFSIZE) &&
+#            ifndef NOUNCRYPT
+            (!s->encrypted) &&
+#            endif
+            ((pfile_in_zip_read_info->compression_method==0) || (pfile_in_zip_read_info->raw)))
+        {
+            uInt uReadThis = pfile_in_zip_read_info->stream.avail_out;
+            if (pfile_in_zip_read_info->rest_read_compressed<uReadThis)
+                uReadThis = (uInt)pfile_in_zip_read_info->rest_read_compressed;
+            if (unz64local_SeekForRead(s,
+                      pfile_in_zip_read_info->pos_in_zipfile +
+                         pfile_in_zip_read_info->byte_before_the_zipfile)!=0)
+                return UNZ_ERRNO;
+            if (ZREAD64(pfile_in_zip_read_info->z_filefunc,
+                      pfile_in_zip_read_info->filestream,
+                      pfile_in_zip_read_info->stream.next_out,
+                      uReadThis)!=uReadThis)
+            {
+                s->filestream_pos = UNZ_UNKNOWNPOS;
+                return UNZ_ERRNO;
+            }
+            s->filestream_pos += uReadThis;
+
+            pfile_in_zip_read_info->pos_in_zipfile += uReadThis;
+            pfile_in_zip_read_info->rest_read_compressed-=uReadThis;
+
+            pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,
+                                pfile_in_zip_read_info->stream.next_out,
+                                uReadThis);
+
+            pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uReadThis;
+            pfile_in_zip_read_info->rest_read_uncompressed-=uReadThis;
+            pfile_in_zip_read_info->stream.avail_out -= uReadThis;
+            pfile_in_zip_read_info->stream.next_out += uReadThis;
+            pfile_in_zip_read_info->stream.total_out += uReadThis;
+            iRead += uReadThis;
+            continue;
+        }
+
         if ((pfile_in_zip_read_info->stream.avail_in==0) &&
             (pfile_in_zip_read_info->rest_read_compressed>0))
         {
-            uInt uReadThis = UNZ_BUFSIZE;
+            ZPOS64_T uReadPos = pfile_in_zip_read_info->pos_in_zipfile +
+                                pfile_in_zip_read_info->byte_before_the_zipfile;
+            uInt uReadThis = pfile_in_zip_read_info->read_buffer_size;
+            /* When more than a buffer is left, end each read on a multiple
+               of the buffer size, a cluster boundary, so that the card
+               reads whole clusters straight into read_buffer */
+            if (pfile_in_zip_read_info->rest_read_compressed>uReadThis)
+                uReadThis -= (uInt)(uReadPos & (uReadThis-1));
             if (pfile_in_zip_read_info->rest_read_compressed<uReadThis)
                 uReadThis = (uInt)pfile_in_zip_read_info->rest_read_compressed;
             if (uReadThis == 0)
                 return UNZ_EOF;
-            if (ZSEEK64(pfile_in_zip_read_info->z_filefunc,
-                      pfile_in_zip_read_info->filestream,
-                      pfile_in_zip_read_info->pos_in_zipfile +
-                         pfile_in_zip_read_info->byte_before_the_zipfile,
-                         ZLIB_FILEFUNC_SEEK_SET)!=0)
+            if (unz64local_SeekForRead(s,uReadPos)!=0)
                 return UNZ_ERRNO;
             if (ZREAD64(pfile_in_zip_read_info->z_filefunc,
                       pfile_in_zip_read_info->filestream,
                       pfile_in_zip_read_info->read_buffer,
                       uReadThis)!=uReadThis)
+            {
+                s->filestream_pos = UNZ_UNKNOWNPOS;
                 return UNZ_ERRNO;
+            }
+            s->filestream_pos += uReadThis;
 
 
 #            ifndef NOUNCRYPT
@@ -1740,7 +2254,7 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
 
         if ((pfile_in_zip_read_info->compression_method==0) || (pfile_in_zip_read_info->raw))
         {
-            uInt uDoCopy,i ;
+            uInt uDoCopy;
 
             if ((pfile_in_zip_read_info->stream.avail_in == 0) &&
                 (pfile_in_zip_read_info->rest_read_compressed == 0))
@@ -1752,15 +2266,12 @@ extern int ZEXPORT unzReadCurrentFile  (unzFile file, voidp buf, unsigned len)
             else
                 uDoCopy = pfile_in_zip_read_info->stream.avail_in ;
 
-            for (i=0;i<uDoCopy;i++)
-                *(pfile_in_zip_read_info->stream.next_out+i) =
-                        *(pfile_in_zip_read_info->stream.next_in+i);
-
-            pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uDoCopy;
-
-            pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,
+            pfile_in_zip_read_info->crc32 = crc32_copy(pfile_in_zip_read_info->crc32,
                                 pfile_in_zip_read_info->stream.next_out,
+                                pfile_in_zip_read_info->stream.next_in,
                                 uDoCopy);
+
+            pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uDoCopy;
             pfile_in_zip_read_info->rest_read_uncompressed-=uDoCopy;
             pfile_in_zip_read_info->stream.avail_in -= uDoCopy;
             pfile_in_zip_read_info->stream.avail_out -= uDoCopy;
@@ -1957,6 +2468,7 @@ extern int ZEXPORT unzGetLocalExtrafield (unzFile file, voidp buf, unsigned len)
     if (read_now==0)
         return 0;
 
+    s->filestream_pos = UNZ_UNKNOWNPOS;
     if (ZSEEK64(pfile_in_zip_read_info->z_filefunc,
               pfile_in_zip_read_info->filestream,
               pfile_in_zip_read_info->offset_local_extrafield +
@@ -2035,6 +2547,7 @@ extern int ZEXPORT unzGetGlobalComment (unzFile file, char * szComment, uLong uS
     if (uReadThis>s->gi.size_comment)
         uReadThis = s->gi.size_comment;
 
+    s->filestream_pos = UNZ_UNKNOWNPOS;
     if (ZSEEK64(s->z_filefunc,s->filestream,s->central_pos+22,ZLIB_FILEFUNC_SEEK_SET)!=0)
         return UNZ_ERRNO;
 
@@ -2097,4 +2610,18 @@ extern int ZEXPORT unzSetOffset64(unzFile file, ZPOS64_T pos)
 extern int ZEXPORT unzSetOffset (unzFile file, uLong pos)
 {
     return unzSetOffset64(file,pos);
+}
+
+extern int ZEXPORT unzGetLocalHeaderOffset64 (unzFile file, ZPOS64_T* poffset)
+{
+    unz64_s* s;
+
+    if ((file==NULL) || (poffset==NULL))
+        return UNZ_PARAMERROR;
+    s=(unz64_s*)file;
+    if (!s->current_file_ok)
+        return UNZ_END_OF_LIST_OF_FILE;
+
+    *poffset = s->cur_file_info_internal.offset_curfile;
+    return UNZ_OK;
 }
\ No newline at end of file
@@ -411,6 +411,12 @@ extern uLong ZEXPORT unzGetOffset (unzFile file);
 extern int ZEXPORT unzSetOffset64 (unzFile file, ZPOS64_T pos);
 extern int ZEXPORT unzSetOffset (unzFile file, uLong pos);
 
+/* Get the offset of the local header of the current file in the zipfile.
+  Extracting files in the order of these offsets reads the zipfile forward
+    only.
+  return UNZ_OK if there is no problem */
+extern int ZEXPORT unzGetLocalHeaderOffset64 (unzFile file, ZPOS64_T* poffset);
+
 
 
 #ifdef __cplusplus